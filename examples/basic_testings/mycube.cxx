@@ -1,5 +1,6 @@
 #include "mycube.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "world_view.hxx"
 
 #include <glm/fwd.hpp>
@@ -25,8 +26,11 @@ MyCube::MyCube(vec3 tangent, vec3 bitangent, vec3 pos) :
         2, 3, 7, 2, 7, 6, 0, 4, 6, 0, 6, 2, 1, 7, 5, 1, 3, 7,
     };
 
-    diffuse.from_image("tex_diffuse.jpg");
-    specular.from_image("tex_specular.jpg");
+    // decoded in the background, uploaded as Window::draw polls the loader
+    diffuse  = std::make_shared<TextureObject>();
+    specular = std::make_shared<TextureObject>();
+    TextureLoader::shared().load(diffuse, "tex_diffuse.jpg");
+    TextureLoader::shared().load(specular, "tex_specular.jpg");
 
     MY_CHECK_FAIL
     vao.bind();
@@ -53,7 +57,7 @@ MyWorld::MyWorld() {
 }
 bool MyWorld::draw(mf::DrawableFrame &fbo) {
     fbo.clear_color(cur_rect); // bind +viewport+clear
-    glEnable(GL_DEPTH_TEST);
+    GLState::current().set_enabled(GL_DEPTH_TEST, true);
     MY_CHECK_FAIL
     for (auto cube : cubes) {
         cube->vao.bind();
@@ -71,14 +75,14 @@ bool MyWorld::draw(mf::DrawableFrame &fbo) {
         prog->set_value("light.pos", vec3(0, 10, 0));
         prog->set_value("light.diffuse", vec3(1));
         prog->set_value("light.specular", vec3(1));
-        cube->diffuse.activate_sampler(prog, "material.diffuse", 0);
-        cube->specular.activate_sampler(prog, "material.specular", 1);
+        cube->diffuse->activate_sampler(prog, "material.diffuse", 0);
+        cube->specular->activate_sampler(prog, "material.specular", 1);
         prog->set_value("material.shininess", 2.f);
         MY_CHECK_FAIL
 
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
         MY_CHECK_FAIL
     }
-    glDisable(GL_DEPTH_TEST);
+    GLState::current().set_enabled(GL_DEPTH_TEST, false);
     return false;
 }
@@ -46,11 +46,11 @@ class MyCube {
     std::vector<int>   indices;
     float              scale;
 
-    VertexArrayObject  vao;
-    VertexBufferObject vbo;
-    BufferObject       ebo;
-    TextureObject      diffuse;
-    TextureObject      specular;
+    VertexArrayObject              vao;
+    VertexBufferObject             vbo;
+    BufferObject                   ebo;
+    std::shared_ptr<TextureObject> diffuse;
+    std::shared_ptr<TextureObject> specular;
 
     vec3 pos_;
     vec3 tangent_;
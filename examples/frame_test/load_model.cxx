@@ -1,5 +1,6 @@
 #include "checkfail.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "model.hxx"
 #include "shader_program.hxx"
 #include "widget.hxx"
@@ -27,7 +28,7 @@ class MyModel : public WorldViewBase {
         fbo.clear_color(cur_rect, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, {0, 255, 0, 1});
         MY_CHECK_FAIL
         fbo.viewport(cur_rect);
-        glEnable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, true);
 
         for (const auto &mesh : model_.meshes) {
             prog->use();
@@ -39,7 +40,7 @@ class MyModel : public WorldViewBase {
 
             glDrawElements(GL_TRIANGLES, mesh.indices_.size(), GL_UNSIGNED_INT, 0);
         }
-        glDisable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, false);
         return false;
     }
 
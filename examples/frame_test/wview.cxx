@@ -1,6 +1,7 @@
 #include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "model.hxx"
 #include "shader_program.hxx"
 #include "widget.hxx"
@@ -24,11 +25,11 @@ class SimpleView : public WorldViewBase {
         fbo.clear_color(cur_rect, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, {0, 255, 0, 1});
         MY_CHECK_FAIL
         fbo.viewport(cur_rect);
-        glEnable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, true);
 
         // draw
 
-        glDisable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, false);
         return false;
     }
     VertexArrayObject  vao;
@@ -0,0 +1,99 @@
+// 10k wind turbines placed on Ground's heightfield: batched height and normal queries on one
+// thread and on a pool, against the scalar queries. no GL context, nothing is read back:
+//     ./bench_placement
+
+#include "heightfield.hxx"
+#include "model_ground.hxx"
+#include "thread_pool.hxx"
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <spdlog/spdlog.h>
+
+using hmk4_models::Ground;
+
+// run f, return wall time in ms
+template<typename F> static double timed(F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main() {
+    // 100 x 100 turbines 100m apart, jittered, on the repeated tile of a Ground at its default
+    // offset. turbines on slopes over max_slope_deg are dropped
+    const int   side = 100, n = side * side;
+    const float pitch = 100, jitter = 30, max_slope_deg = 15;
+    const auto  offs  = glm::vec3(0, -66, 0);
+
+    // as Ground::Ground builds its own
+    auto corner = glm::vec2(offs.x - Ground::chunk_width / 2, offs.z - Ground::chunk_height / 2);
+    auto                 tile = Ground::gen_tile();
+    terrain::Heightfield field(tile, corner, 1 / Ground::pix_per_m, offs.y);
+
+    // texel centers hold the tile's heights, also one tile over
+    const float period = Ground::tile_size / Ground::pix_per_m;
+    bool        same   = true;
+    for (int t = 0; t < field.rows(); t += 7) {
+        for (int s = 0; s < field.cols(); s += 5) {
+            auto  xz = corner + (glm::vec2(s, t) + .5f) / Ground::pix_per_m;
+            float h  = tile.at(t, s, 0) + offs.y;
+            same     = same && std::abs(field.height_at(xz) - h) < 1e-4f;
+            same     = same && std::abs(field.height_at(xz + period) - h) < 1e-4f;
+        }
+    }
+
+    std::mt19937                          rng(1145);
+    std::uniform_real_distribution<float> uni(-jitter, jitter);
+    std::vector<float>                    xs(n), zs(n);
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            xs[i * side + j] = (i - side / 2) * pitch + uni(rng);
+            zs[i * side + j] = (j - side / 2) * pitch + uni(rng);
+        }
+    }
+
+    std::vector<float>     ys(n), ys_pool(n);
+    std::vector<glm::vec3> ns(n), ns_pool(n);
+    std::vector<glm::vec3> placed;
+
+    const float min_ny = std::cos(glm::radians(max_slope_deg));
+    double      t_one  = timed([&] {
+        field.sample(xs.data(), zs.data(), ys.data(), ns.data(), n);
+        placed.clear();
+        for (int i = 0; i < n; i++) {
+            if (ns[i].y >= min_ny) placed.push_back(glm::vec3(xs[i], ys[i], zs[i]));
+        }
+    });
+
+    mf::ThreadPool pool(4);
+    double         t_pool = timed([&] {
+        pool.parallel_for(0, n, 1024, [&](int i0, int i1) {
+            field.sample(
+                xs.data() + i0, zs.data() + i0, ys_pool.data() + i0, ns_pool.data() + i0, i1 - i0
+            );
+        });
+    });
+
+    // one point per call takes the scalar path
+    double t_scalar = timed([&] {
+        for (int i = 0; i < n; i++) {
+            float     y;
+            glm::vec3 nrm;
+            field.sample(&xs[i], &zs[i], &y, &nrm, 1);
+            same = same && y == ys[i] && nrm == ns[i] && y == ys_pool[i] && nrm == ns_pool[i];
+        }
+    });
+
+    spdlog::info(
+        "{} turbines, {} placed: batched {:.3f}ms, pool of {} {:.3f}ms, scalar {:.3f}ms", n,
+        placed.size(), t_one, pool.nb_threads(), t_pool, t_scalar
+    );
+    if (!same) spdlog::error("bench_placement: queries off the tile or the scalar path");
+    return same ? 0 : -1;
+}
\ No newline at end of file
@@ -0,0 +1,149 @@
+// Ground's normal_map against the per-fragment normals defr_ground.fs computed before it: central
+// differences of the bilinear height over +-0.2m. both are emulated on the CPU on the tile's
+// storage (R16 heights, RG16F slopes) and their box mipmaps, at random points. no GL context:
+//     ./check_ground_normals
+
+#include "model_ground.hxx"
+#include "types.hxx"
+#include "volumetric_cloud.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <spdlog/spdlog.h>
+
+using hmk4_models::Ground;
+
+// a square periodic mip level, row-major
+template<typename T> struct Level {
+    int            size;
+    std::vector<T> texels;
+
+    const T &at(int t, int s) const {
+        t = (t % size + size) % size, s = (s % size + size) % size;
+        return texels[(size_t)t * size + s];
+    }
+    // GL_LINEAR with GL_REPEAT at texel coordinates (u, v) * size
+    T bilinear(float u, float v) const {
+        float x = u * size - .5f, y = v * size - .5f;
+        int   s = (int)std::floor(x), t = (int)std::floor(y);
+        float fx = x - s, fy = y - t;
+        T     a = at(t, s) * (1 - fx) + at(t, s + 1) * fx;
+        T     b = at(t + 1, s) * (1 - fx) + at(t + 1, s + 1) * fx;
+        return a * (1 - fy) + b * fy;
+    }
+    // 2x2 box, as glGenerateMipmap
+    Level down() const {
+        Level ret{size / 2, std::vector<T>((size_t)size * size / 4)};
+        for (int t = 0; t < ret.size; t++) {
+            for (int s = 0; s < ret.size; s++) {
+                ret.texels[(size_t)t * ret.size + s] =
+                    (at(2 * t, 2 * s) + at(2 * t, 2 * s + 1) + at(2 * t + 1, 2 * s) +
+                     at(2 * t + 1, 2 * s + 1)) *
+                    .25f;
+            }
+        }
+        return ret;
+    }
+};
+
+static glm::vec2 to_rg16f(glm::vec2 v) {
+    return glm::vec2((float)terrain::half(v.x), (float)terrain::half(v.y));
+}
+
+int main() {
+    const int   n       = Ground::tile_size;
+    const float ppm     = Ground::pix_per_m;
+    const int   nb_mips = 4;
+    // degrees between the normals at the texel centers: R16 and RG16F rounding only. between the
+    // centers the differences of the bilinear heights jump at every texel border while the map is
+    // smooth, so single normals can be far apart (~10 deg mean, ~40 max at mip 0 on this tile,
+    // whose finer octave is 1.25 texels per cell); what shading sees is bounded instead, the mean
+    // n.y (measured 0.940 vs 0.974 at mip 0, closer above)
+    const double tol_center = 0.1, tol_y = 0.05;
+
+    auto tile = Ground::gen_tile();
+
+    auto   t0     = std::chrono::steady_clock::now();
+    auto   slopes = terrain::gen_slope_map(tile, Ground::slope_scale);
+    auto   t1     = std::chrono::steady_clock::now();
+    double t_gen  = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    // the textures as Ground uploads them
+    terrain::QuantizeParams quant;
+    auto                    stored = terrain::dequantize<float>(
+        terrain::quantize<uint16_t>(tile, quant), quant
+    );
+    Level<float>     height{n, std::vector<float>((size_t)n * n)};
+    Level<glm::vec2> normal{n, std::vector<glm::vec2>((size_t)n * n)};
+    for (int t = 0; t < n; t++) {
+        for (int s = 0; s < n; s++) {
+            height.texels[(size_t)t * n + s] = stored.at(t, s, 0);
+            normal.texels[(size_t)t * n + s] = to_rg16f(slopes.at(t, s, 0));
+        }
+    }
+
+    // angle in degrees between the per-fragment normal and the map's at (u, v) of the current
+    // level, and their y
+    auto compare = [&](float u, float v, double &angle, double &y_frag, double &y_map) {
+        // defr_ground.fs's dx = 0.4 / pix_per_m meters, in tile coordinates
+        float     d  = 0.4f / n;
+        float     du = (height.bilinear(u + d, v) - height.bilinear(u - d, v)) / 2 * ppm;
+        float     dv = (height.bilinear(u, v + d) - height.bilinear(u, v - d)) / 2 * ppm;
+        glm::vec2 s  = normal.bilinear(u, v);
+
+        glm::vec3 n_frag = glm::normalize(glm::vec3(-du, 1, -dv));
+        glm::vec3 n_map  = glm::normalize(glm::vec3(-s.x, 1, -s.y));
+        angle  = std::acos(std::clamp((double)glm::dot(n_frag, n_map), -1., 1.)) * 180 / M_PI;
+        y_frag = n_frag.y;
+        y_map  = n_map.y;
+    };
+
+    std::mt19937                          rng(1145);
+    std::uniform_real_distribution<float> uni(0, 1);
+
+    // at the texel centers both are the same differences, up to the storage
+    double angle, y_frag, y_map, max_center = 0;
+    for (int t = 0; t < n; t++) {
+        for (int s = 0; s < n; s++) {
+            compare((s + .5f) / n, (t + .5f) / n, angle, y_frag, y_map);
+            max_center = std::max(max_center, angle);
+        }
+    }
+    spdlog::info("texel centers: max {:.3f} deg (tolerance {})", max_center, tol_center);
+    bool ok = max_center <= tol_center;
+
+    // anywhere: the map interpolates the slopes, the differences follow the bilinear heights
+    for (int mip = 0; mip < nb_mips; mip++) {
+        double sum = 0, max_angle = 0, sum_y_frag = 0, sum_y_map = 0;
+        int    nb_samples = 100000;
+        for (int i = 0; i < nb_samples; i++) {
+            compare(uni(rng), uni(rng), angle, y_frag, y_map);
+            sum += angle;
+            max_angle = std::max(max_angle, angle);
+            sum_y_frag += y_frag;
+            sum_y_map += y_map;
+        }
+        double dy = std::abs(sum_y_frag - sum_y_map) / nb_samples;
+        spdlog::info(
+            "mip {}: mean {:.3f} deg, max {:.3f} deg, mean n.y {:.4f} vs {:.4f} (tolerance {})",
+            mip, sum / nb_samples, max_angle, sum_y_frag / nb_samples, sum_y_map / nb_samples,
+            tol_y
+        );
+        ok = ok && dy <= tol_y;
+
+        height = height.down();
+        normal = normal.down();
+        for (auto &s : normal.texels) {
+            s = to_rg16f(s);
+        }
+    }
+    spdlog::info("gen_slope_map {}x{}: {:.2f}ms", n, n, t_gen);
+
+    if (!ok) spdlog::error("check_ground_normals: normal map off the per-fragment normals");
+    return ok ? 0 : -1;
+}
\ No newline at end of file
@@ -4,8 +4,6 @@ out vec4 FragColor;
 
 in vec2 texCoord;
 
-uniform vec3 view_pos;
-
 uniform struct {
     sampler2D t_pos;
     sampler2D t_norm;
@@ -14,23 +12,7 @@ uniform struct {
     sampler2D t_vis;
 } gbuffer;
 
-// light attr
-uniform vec3  light_pos;
-uniform vec3  light_color;
-uniform float s_light;
-uniform float shininess;
-
-// cloud
-uniform struct CLOUD_T_ {
-    vec3      aabb_min;
-    vec3      aabb_max;
-    float     sigma_a;
-    float     sigma_s;
-    mat4      world2tex;
-    sampler3D tex;
-} cloud;
-uniform mat4  world2view;
-uniform float fovy;
+#include "frame_uniforms.glsl"
 
 const float s_emit            = 0.05;
 const float nb_iter1          = 60;
@@ -38,6 +20,9 @@ const float nb_iter2          = 7;
 const float strength_modifier = 8.;
 const vec3  bkgd_color        = vec3(0.53, 0.81, .92);
 const float s_bkgd            = .5;
+const float occupancy_eps     = 1e-6;
+// view samples closer than this (in voxels, on every axis) share one light ray
+const float light_reuse       = 0.5;
 
 // utils
 bool should_discard(vec2 uv) { return texture(gbuffer.t_pos, uv).z == 0.; }
@@ -128,14 +113,65 @@ void query_intersect_range(vec3 ro, vec3 rd, out float t_enter, out float t_exit
 }
 
 // requires: struct cloud
-float sample_cloud(vec3 pos) {
+float sample_cloud(vec3 pos, float lod) {
     vec3  cloud_uvw = (cloud.world2tex * vec4(pos, 1)).xyz;
-    float density   = texture(cloud.tex, cloud_uvw).r;
+    float density   = textureLod(cloud_tex, cloud_uvw, lod).r * cloud.scale + cloud.bias;
 
     return abs(density);
 }
+float sample_cloud(vec3 pos) { return sample_cloud(pos, 0.); }
+
+// position in voxels, texel centers at integers
+// requires: struct cloud
+vec3 to_voxel(vec3 pos) {
+    return (cloud.world2tex * vec4(pos, 1)).xyz * vec3(textureSize(cloud_tex, 0)) - 0.5;
+}
+
+// distance along rd to leave the occupancy brick around pos, no fetch
+// requires: struct cloud
+float brick_exit(vec3 pos, vec3 rd) {
+    vec3  p    = to_voxel(pos);
+    vec3  dp   = mat3(cloud.world2tex) * rd * vec3(textureSize(cloud_tex, 0));
+    float size = float(cloud.brick);
+    vec3  b    = floor(p / size);
+
+    vec3 safe_dp = dp;
+    if (abs(safe_dp.x) < 1e-6) safe_dp.x = 1e-6;
+    if (abs(safe_dp.y) < 1e-6) safe_dp.y = 1e-6;
+    if (abs(safe_dp.z) < 1e-6) safe_dp.z = 1e-6;
+    vec3 t_exit = ((b + step(0., safe_dp)) * size - p) / safe_dp;
+    return min(min(t_exit.x, t_exit.y), t_exit.z) + 1e-2;
+}
+
+// empty-space skipping: distance along rd to leave the brick around pos if the brick is empty,
+// else 0. bricks are in voxel space, where texel centers are integers: a sample belongs to the
+// brick of its lower trilinear corner. the half voxel before the first corner is never skipped.
+// exact at lod 0, coarser levels may blur a little density into skipped bricks. for a brick
+// holding density returns minus the distance to its exit: the caller samples without fetching
+// the grid again until then, and steps at least t_step over empty ones
+// requires: struct cloud
+float skip_empty(vec3 pos, vec3 rd) {
+    vec3  b    = floor(to_voxel(pos) / float(cloud.brick));
+    ivec3 grid = textureSize(cloud_occupancy, 0);
+    if (any(lessThan(b, vec3(0))) || any(greaterThanEqual(ivec3(b), grid))) return 0.;
+
+    float exit = brick_exit(pos, rd);
+    return texelFetch(cloud_occupancy, ivec3(b), 0).r > 0. ? -exit : exit;
+}
+
+// mip level where a voxel covers the pixel footprint at distance dist
+// requires: struct cloud, fovy, gbuffer
+float cloud_lod(float dist) {
+    vec3 dims  = vec3(textureSize(cloud_tex, 0));
+    vec3 scale = abs(vec3(cloud.world2tex[0][0], cloud.world2tex[1][1], cloud.world2tex[2][2]));
+    vec3 voxel = 1. / (scale * dims);
 
-// query transmittance to light
+    float pixel = dist * 2. * tan(fovy * .5) / float(textureSize(gbuffer.t_pos, 0).y);
+    return clamp(log2(pixel / min(min(voxel.x, voxel.y), voxel.z)), 0., cloud.max_lod);
+}
+
+// query transmittance to light. pos holds density, so its brick is known to be occupied and is
+// marched without a fetch
 float query_transmittance(vec3 pos) {
     vec3 ro = pos;
     vec3 rd = normalize(light_pos - pos);
@@ -145,9 +181,19 @@ float query_transmittance(vec3 pos) {
     t_step = max((t_exit - t_enter) / (nb_iter2 - 1), 0.1);
     if (t_exit < t_enter) return 1.;
 
-    float dist = 0;
-    float cur_step, density;
+    float dist       = 0;
+    float t_occupied = t_enter + brick_exit(ro + rd * t_enter, rd);
+    float cur_step = t_step, density;
     for (float t = t_enter; t <= t_exit; t += cur_step) {
+        if (t >= t_occupied) {
+            cur_step = skip_empty(ro + rd * t, rd);
+            if (cur_step > 0.) {
+                cur_step = max(cur_step, t_step);
+                continue;
+            }
+            t_occupied = t - cur_step;
+        }
+
         density  = sample_cloud(ro + rd * t);
         cur_step = density < 1e-2 ? t_step * 2 : t_step;
         dist += cur_step * density;
@@ -182,19 +228,42 @@ void draw_sky(vec2 uv, vec3 cur_bkdg, vec3 block_pos, bool test_block) {
 
     float radiance      = 0;
     float transmittance = 1.;
-    float cur_step, density;
+    float t_occupied    = -1.;
+    float cur_step = t_step, density;
+    // last light ray: where it started, in voxels, and its transmittance
+    vec3  light_at = vec3(-1e9);
+    float light_T  = 0.;
     for (float t = t_enter; t <= t_exit; t += cur_step) {
         vec3 sample_pos = ro + rd * t;
         if (length(sample_pos - view_pos) >= length(block_pos - view_pos) && test_block) {
             break;
         }
 
+        // step over empty bricks without sampling
+        if (t >= t_occupied) {
+            cur_step = skip_empty(sample_pos, rd);
+            if (cur_step > 0.) {
+                cur_step = max(cur_step, t_step);
+                continue;
+            }
+            t_occupied = t - cur_step;
+        }
+
         // sample and adapt step
-        density  = sample_cloud(sample_pos);
+        density  = sample_cloud(sample_pos, cloud_lod(t));
         cur_step = density < 1e-2 ? t_step * 2 : t_step;
-
-        // calc light
-        float luminance = query_transmittance(sample_pos) * s_light;
+        // nothing scatters here: no light ray
+        if (density <= occupancy_eps) continue;
+
+        // calc light. the transmittance varies over a voxel at most, as the density it
+        // integrates: samples within light_reuse of the last light ray take its result
+        vec3 voxel = to_voxel(sample_pos);
+        vec3 moved = abs(voxel - light_at);
+        if (max(max(moved.x, moved.y), moved.z) >= light_reuse) {
+            light_T  = query_transmittance(sample_pos);
+            light_at = voxel;
+        }
+        float luminance = light_T * s_light;
 
         float L_o = luminance *
                         phase_func( //
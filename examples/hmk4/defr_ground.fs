@@ -5,8 +5,8 @@ layout(location = 1) out vec4 g_norm;
 layout(location = 2) out vec4 g_diff;
 layout(location = 3) out vec4 g_spec;
 
-in vec2 tex_coord;
-in vec3 pos;
+in vec3  pos;
+in float mesh_h; // height of the displaced mesh at pos
 
 const vec3  c1         = vec3(0.54, 0.36, 0.23);
 const vec3  c2         = vec3(0.81, 0.54, 0.33);
@@ -15,59 +15,66 @@ const float s_diffuse  = .7;
 const float s_specular = 0.01;
 const vec3  BaseN      = vec3(0, 1, 0);
 
-uniform sampler2D height_map;
-uniform float     pix_per_m;
-uniform mat4      world2tex;
-uniform vec3      view_pos;
+uniform bool      tessellated; // pos is displaced at full detail: no parallax
+uniform sampler2D normal_map;  // terrain::gen_slope_map of the tile, (du, dv) as below
 
-float sample_height(vec2 uv) {
-    uv = mod(uv, 1);
-    return texture(height_map, uv).r;
-}
+#include "frame_uniforms.glsl"
+#include "ground_height.glsl"
+
+float frag_mip = 0.; // tile texels per pixel, log2, set in main
 
-// parallax mapping
-void remap_coord(
-    const vec2 coord, const vec3 projV, const vec3 pos, out vec3 pos2, out vec2 coord2
-) {
-    float last_h = 0.;
+float sample_height(vec3 p) { return ground_height(p.xz, frag_mip); }
+
+// parallax mapping, of the height left over from the displaced mesh
+vec3 remap_pos(const vec3 projV, const vec3 pos) {
+    float last_h = mesh_h;
     float h;
-    pos2   = pos;
-    coord2 = coord;
+    vec3  pos2 = pos;
     // converge 4 times
     for (int i = 0; i < 4; i++) {
-        h      = sample_height(coord2);
+        h      = sample_height(pos2);
         pos2   = pos2 + (h - last_h) * projV;
-        coord2 = (world2tex * vec4(pos2, 1)).xy;
         last_h = h;
     }
+    return pos2;
 }
 
 void main() {
-    //
-    // do parallax mapping
+    frag_mip = log2(max(fwidth(pos.x), fwidth(pos.z)) * pix_per_m);
 
-    vec3 V     = normalize(view_pos - pos);
-    vec3 projV = V - dot(BaseN, V) * BaseN;
+    vec3  pos2 = pos;
+    float h    = mesh_h;
+    if (!tessellated) {
+        //
+        // do parallax mapping
 
-    vec3 pos2;
-    vec2 tex_coord2;
-    remap_coord(tex_coord, projV, pos, pos2, tex_coord2);
-    float h = sample_height(tex_coord2);
+        vec3 V     = normalize(view_pos - pos);
+        vec3 projV = V - dot(BaseN, V) * BaseN;
 
-    // set realistic color by height
-    vec3 c = mix(c1, c2, exp(-1 - h));
+        pos2 = remap_pos(projV, pos);
+        h    = sample_height(pos2);
+    }
+
+    // set realistic color by height. clamped for the clipmap's hills
+    vec3 c = mix(c1, c2, min(exp(-1 - h), 1.));
 
     //
     // calc normal
 
-    float tex_dist = 1. / 1000. / pix_per_m;
+    float du, dv;
+    if (!clipmap) {
+        // one fetch, the map holds the differences below at every texel
+        vec2 s = texture(normal_map, (world2tex * vec4(pos2, 1)).xy).rg;
+        du     = s.x;
+        dv     = s.y;
+    } else {
+        // differences over 0.2m. the rings stream in, so they have no normal map
+        vec3 dx = vec3(0.4 / pix_per_m, 0, 0);
+        vec3 dz = vec3(0, 0, 0.4 / pix_per_m);
 
-    float du = (sample_height(tex_coord2 + vec2(tex_dist, 0)) -
-                sample_height(tex_coord2 - vec2(tex_dist, 0))) /
-               2 * pix_per_m;
-    float dv = (sample_height(tex_coord2 + vec2(0, tex_dist)) -
-                sample_height(tex_coord2 - vec2(0, tex_dist))) /
-               2 * pix_per_m;
+        du = (sample_height(pos2 + dx) - sample_height(pos2 - dx)) / 2 * pix_per_m;
+        dv = (sample_height(pos2 + dz) - sample_height(pos2 - dz)) / 2 * pix_per_m;
+    }
 
     // draw to gbuffer
     g_norm = vec4(normalize(vec3(-du, 1, -dv)), 1);
@@ -1,15 +1,49 @@
 #version 330 core
 
-layout(location = 0) in vec3 aPos;
+layout(location = 0) in vec2 aGrid;  // shared chunk mesh, [0,1]^2
+layout(location = 1) in vec4 aChunk; // per instance: chunk corner x, z, level
 
-out vec2 tex_coord;
-out vec3 pos;
+out vec3  pos;
+out float mesh_h;
 
-uniform mat4 model2clip;
-uniform mat4 world2tex;
+uniform mat4      model2clip;
+uniform float     chunk_width;
+uniform int       max_level;  // level l has 2^(max_level - l) cells per chunk side
+uniform float     lod_range;  // level l is used up to lod_range * 2^l
+uniform vec3      lod_center; // camera the levels are selected for
+uniform float     base_y;
+
+#include "ground_height.glsl"
+
+// continuous level wanted at a point of the base plane
+float lod_at(vec2 xz) {
+    return log2(max(distance(vec3(xz.x, base_y, xz.y), lod_center), 1.) / lod_range);
+}
 
 void main() {
-    pos         = aPos;
-    tex_coord   = (world2tex * vec4(aPos, 1)).xy;
-    gl_Position = model2clip * vec4(aPos, 1);
+    vec2 corner = aChunk.xy;
+    vec2 local  = aGrid * chunk_width;
+
+    // geomorphing: over the second half of level l's range, the vertices odd on level l slide onto
+    // their even neighbour, i.e. onto level l+1's grid. the chunk's level is the lowest any of its
+    // points asks for, and a coarser neighbour's points ask for at least one more, so the shared
+    // edge is fully morphed there and chunks of different levels meet without cracks
+    for (int l = int(aChunk.z); l < max_level; l++) {
+        float m = clamp(2. * (lod_at(corner + local) - float(l)) - 1., 0., 1.);
+        if (m == 0.) break;
+        float cell = chunk_width / float(1 << (max_level - l));
+        local -= fract(local / (2. * cell)) * 2. * cell * m;
+    }
+
+    vec3 p = vec3(corner.x + local.x, base_y, corner.y + local.y);
+
+    // heights as coarse as the vertex spacing; defr_ground.fs adds the rest by parallax. mip is in
+    // texels of the tile, which are those of clipmap ring 0
+    float cell0 = chunk_width / float(1 << max_level);
+    float mip   = log2(cell0 * pix_per_m) + clamp(lod_at(p.xz), 0., float(max_level));
+    mesh_h      = ground_height(p.xz, mip);
+    p.y += mesh_h;
+
+    pos         = p;
+    gl_Position = model2clip * vec4(p, 1);
 }
\ No newline at end of file
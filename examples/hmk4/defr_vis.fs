@@ -14,23 +14,13 @@ uniform sampler2D shadow_tex[8];
 uniform float     shadow_portions[8];
 uniform mat4      world2shadow[8];
 uniform int       nb_shadow_tex;
-uniform vec3      light_pos;
 
-uniform mat4 world2clip;
+#include "frame_uniforms.glsl"
 
 const float cursor = 16.; // control shadow depth smoothness
 
 const float sample_dist = 0.05;
 
-// cloud
-uniform struct CLOUD_T_ {
-    vec3      aabb_min;
-    vec3      aabb_max;
-    float     sigma_a;
-    float     sigma_s;
-    mat4      world2tex;
-    sampler3D tex;
-} cloud;
 const float nb_iter = 30;
 
 // utils
@@ -118,7 +108,7 @@ float query_vis_aa(vec3 pos, vec3 norm, float dist) {
 }
 float sample_cloud(vec3 pos) {
     vec3  cloud_uvw = (cloud.world2tex * vec4(pos, 1)).xyz;
-    float density   = texture(cloud.tex, cloud_uvw).r;
+    float density   = textureLod(cloud_tex, cloud_uvw, 0.).r * cloud.scale + cloud.bias;
 
     return abs(density);
 }
@@ -0,0 +1,30 @@
+// per-frame values of the hmk4 pipeline, for #include. one std140 buffer written once per frame by
+// render_scene_defr, whose FrameBlock mirrors this layout: keep the two in sync
+
+// the cloud's parameters, its samplers are cloud_tex and cloud_occupancy below
+struct CloudParams {
+    mat4  world2tex;
+    vec3  aabb_min;
+    float sigma_a;
+    vec3  aabb_max;
+    float sigma_s;
+    float scale; // density = tex * scale + bias
+    float bias;
+    int   brick; // voxels per brick of cloud_occupancy
+    float max_lod;
+};
+
+layout(std140) uniform Frame {
+    mat4        world2clip;
+    mat4        world2view;
+    vec3        view_pos;
+    float       fovy;
+    vec3        light_pos;
+    float       s_light;
+    vec3        light_color;
+    float       shininess;
+    CloudParams cloud;
+};
+
+uniform sampler3D cloud_tex;
+uniform sampler3D cloud_occupancy; // 1 where a brick has density
\ No newline at end of file
@@ -0,0 +1,63 @@
+// ground heights of the tile or of the clipmap, for #include in the ground shaders
+
+uniform sampler2D height_map; // tile, height = height_map * height_scale + height_bias
+uniform float     height_scale;
+uniform float     height_bias;
+uniform mat4      world2tex;
+uniform float     pix_per_m;
+
+// GroundClipmap rings: world texel t of ring k at texture coordinate (t + .5) / clip_size, wrapped
+// by GL_REPEAT
+const int   clip_rings = 8;
+const int   clip_size  = 256;
+const float clip_fade  = 16.; // texels before a ring's border blending into the next
+
+uniform bool      clipmap;
+uniform sampler2D clip_map[clip_rings];
+uniform vec2      clip_origin[clip_rings]; // uploaded window of each ring, min world texel
+uniform vec2      clip_base;               // world xz of texel 0
+uniform float     clip_spacing;            // meters per texel of ring 0
+
+// samplers can only be indexed by constants here
+float ring_height(int k, vec2 t) {
+    vec2 uv = (t + .5) / float(clip_size);
+    switch (k) {
+    case 0: return textureLod(clip_map[0], uv, 0.).r;
+    case 1: return textureLod(clip_map[1], uv, 0.).r;
+    case 2: return textureLod(clip_map[2], uv, 0.).r;
+    case 3: return textureLod(clip_map[3], uv, 0.).r;
+    case 4: return textureLod(clip_map[4], uv, 0.).r;
+    case 5: return textureLod(clip_map[5], uv, 0.).r;
+    case 6: return textureLod(clip_map[6], uv, 0.).r;
+    default: return textureLod(clip_map[7], uv, 0.).r;
+    }
+}
+
+// height at world xz, mip in ring 0 texels. rings blend like mipmap levels, and toward the next
+// ring near the border of their window
+float clip_height(vec2 xz, float mip) {
+    vec2  t0 = (xz - clip_base) / clip_spacing;
+    int   k  = clamp(int(floor(mip)), 0, clip_rings - 1);
+    float f  = mip > 0. ? fract(mip) : 0.;
+    for (; k < clip_rings - 1; k++) {
+        vec2  t  = t0 / float(1 << k);
+        vec2  d2 = min(t - clip_origin[k], clip_origin[k] + float(clip_size - 1) - t);
+        float d  = min(d2.x, d2.y) - 1.;
+        if (d > 0.) {
+            f = max(f, 1. - clamp(d / clip_fade, 0., 1.));
+            break;
+        }
+    }
+    if (k == clip_rings - 1) f = 0.;
+
+    float h = ring_height(k, t0 / float(1 << k));
+    if (f > 0.) h = mix(h, ring_height(k + 1, t0 / float(2 << k)), f);
+    return h * height_scale + height_bias;
+}
+
+// height at world xz, mip in texels of the tile, which are those of clipmap ring 0
+float ground_height(vec2 xz, float mip) {
+    if (clipmap) return clip_height(xz, mip);
+    vec2 uv = (world2tex * vec4(xz.x, 0, xz.y, 1)).xy;
+    return textureLod(height_map, uv, mip).r * height_scale + height_bias;
+}
\ No newline at end of file
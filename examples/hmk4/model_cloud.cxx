@@ -1,8 +1,13 @@
 #include "model_cloud.hxx"
 #include "checkfail.hxx"
+#include "mapped_file.hxx"
 #include "types.hxx"
+#include "volume_cache.hxx"
 #include "volumetric_cloud.hxx"
 #include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
 #include <glm/geometric.hpp>
 
 using namespace hmk4_models;
@@ -21,25 +26,47 @@ Cloud::Cloud(vec3 aabb_min, vec3 aabb_max, float pix_per_m, int seed1, int seed2
     auto box     = (aabb_max_ - aabb_min_);
     auto tex_box = box * pix_per_m_;
 
-    auto noise_data =
-        terrain::Array3D<float>((int)tex_box.z + 1, (int)tex_box.y + 1, (int)tex_box.x + 1);
-    for (int i = 0; i < 4; i++) {
-        auto noise = terrain::gen_perlin_tex(
-            (int)tex_box.z + 1, (int)tex_box.y + 1, (int)tex_box.x + 1, glm::pow(2.f, -i) * 10,
-            seed1
+    // large volumes are generated in a temporary file mapping, paged by the OS, instead of the
+    // heap. the result is cached on disk and mapped back on the next launch
+    int    dimx  = (int)tex_box.z + 1, dimy = (int)tex_box.y + 1, dimz = (int)tex_box.x + 1;
+    size_t bytes = (size_t)dimx * dimy * dimz * sizeof(float);
+
+    auto key = terrain::CacheKey("hmk4_cloud")("pix_per_m", pix_per_m_)("seed", seed1)(
+        "box", fmt::format("{},{},{}", box.x, box.y, box.z)
+    );
+    auto noise_data = terrain::cached_array3d<float>(key, dimx, dimy, dimz, [&] {
+        terrain::Array3D<float> noise_data;
+        if (bytes > max_heap_bytes) {
+            auto path = std::filesystem::temp_directory_path() /
+                        fmt::format("hmk4_cloud_{}_{}.raw", seed1, (uintptr_t)this);
+            spdlog::info("Cloud: {} MB volume mapped to {}", bytes >> 20, path.string());
+            noise_data = terrain::mapped_array3d<float>(
+                path.string(), dimx, dimy, dimz, terrain::MAP_TEMPORARY
+            );
+        } else {
+            noise_data = terrain::Array3D<float>(dimx, dimy, dimz);
+        }
+
+        // octaves accumulate in place: no temporary volume. the shaping runs within the last
+        // octave, on each slab as soon as its noise is in
+        auto shaping = [&](float v, int i, int j, int k) {
+            float x = k / tex_box.x * 2 - 1, y = j / tex_box.y * 2 - 1, z = i / tex_box.z * 2 - 1;
+            v *= glm::pow(glm::max<float>(1 - x * x - z * z, 0), 1. / 8.);
+            v *= glm::min<float>(3 * (y - 1), 1);
+            v *= glm::min<float>(1 * (y + 1), 1);
+            v = glm::pow(glm::max<float>(v - 0.3, 0), 2);
+            v = v > 1.8 ? glm::mix<float>(2, 1.8, glm::exp(-v + 0.8)) : v;
+            v *= 0.05;
+            return (float)v;
+        };
+        for (int i = 0; i < 3; i++) {
+            terrain::add_perlin_tex(noise_data, glm::pow(2.f, -i) * 10, seed1, glm::pow(2.f, -i));
+        }
+        terrain::add_perlin_tex(
+            noise_data, glm::pow(2.f, -3) * 10, seed1, glm::pow(2.f, -3), false,
+            [&](int x0, int x1) { noise_data.assign(terrain::map(noise_data, shaping), x0, x1); }
         );
-        noise *= glm::pow(2.f, -i);
-        noise_data += noise;
-    }
-    noise_data.vectorize_inplace([&](float v, int i, int j, int k) {
-        float x = k / tex_box.x * 2 - 1, y = j / tex_box.y * 2 - 1, z = i / tex_box.z * 2 - 1;
-        v *= glm::pow(glm::max<float>(1 - x * x - z * z, 0), 1. / 8.);
-        v *= glm::min<float>(3 * (y - 1), 1);
-        v *= glm::min<float>(1 * (y + 1), 1);
-        v = glm::pow(glm::max<float>(v - 0.3, 0), 2);
-        v = v > 1.8 ? glm::mix<float>(2, 1.8, glm::exp(-v + 0.8)) : v;
-        v *= 0.05;
-        return (float)v;
+        return noise_data;
     });
 
     // cloud material
@@ -55,13 +82,39 @@ Cloud::Cloud(vec3 aabb_min, vec3 aabb_max, float pix_per_m, int seed1, int seed2
     );
 
     // gen tex
-    tex_ = std::make_shared<TextureObject>( //
-        "", 0, TextureParameter("smooth"), GL_R32F, GL_TEXTURE_3D
+    // mipmapped: distant samples read coarser levels
+    auto parms = TextureParameter(
+        GL_REPEAT, GL_REPEAT, GL_REPEAT, GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR, GL_TEXTURE_3D
     );
-    tex_->from_data(
-        (void *)noise_data.data(), (int)tex_box.x + 1, (int)tex_box.y + 1, (int)tex_box.z + 1,
-        GL_FLOAT
+    tex_ = std::make_shared<TextureObject>("", 0, parms, density_format, GL_TEXTURE_3D);
+    // quantized density, restored in the shader by cloud.scale/bias
+    auto quant     = terrain::quantize_params<density_t>(noise_data);
+    density_scale_ = quant.scale;
+    density_bias_  = quant.bias;
+    // upload by slabs of depth layers, so a mapped volume is only paged in piece by piece
+    std::vector<density_t> slab_q;
+    tex_->from_data(nullptr, dimz, dimy, dimx);
+    noise_data.visit_slabs(upload_slab_depth, [&](int x0, int x1, const float *slab) {
+        slab_q.resize((size_t)(x1 - x0) * dimy * dimz);
+        terrain::quantize(slab, slab_q.data(), slab_q.size(), quant);
+        tex_->sub_data(slab_q.data(), 0, 0, x0, dimz, dimy, x1 - x0);
+    });
+    tex_->generate_mipmap();
+    // stop while the thinnest dimension still has 2 voxels
+    int min_dim = glm::min(dimx, glm::min(dimy, dimz));
+    max_lod_    = glm::max(glm::floor(glm::log2((float)min_dim)) - 1, 0.f);
+    MY_CHECK_FAIL
+
+    // occupancy grid, sampled with texelFetch. the shader only tests for empty bricks, so they
+    // are one byte flags. quantization keeps zeros: bias is the minimum, 0 for any volume with
+    // empty space
+    brick_     = occupancy_brick;
+    auto flags = terrain::gen_occupancy_grid(noise_data, brick_);
+    auto shape = flags.shape();
+    occupancy_ = std::make_shared<TextureObject>(
+        "", 0, TextureParameter("discrete"), GL_R8, GL_TEXTURE_3D
     );
+    occupancy_->from_data(flags.data(), shape[2], shape[1], shape[0]);
     MY_CHECK_FAIL
     // spdlog::debug("Cloud: cloud data:");
     // noise_data.repr();
@@ -69,12 +122,9 @@ Cloud::Cloud(vec3 aabb_min, vec3 aabb_max, float pix_per_m, int seed1, int seed2
 }
 
 void Cloud::activate_cloud_sampler(std::shared_ptr<ShaderProgram> prog, int at) {
-    // spdlog::debug("Cloud::activate_cloud_sampler");
-    prog->set_value("cloud.aabb_min", aabb_min_);
-    prog->set_value("cloud.aabb_max", aabb_max_);
-    prog->set_value("cloud.sigma_a", sigma_a_);
-    prog->set_value("cloud.sigma_s", sigma_s_);
-    prog->set_value("cloud.world2tex", world2tex_);
-    tex_->activate_sampler(prog, "cloud.tex", at);
-    // exit(0);
+    // the parameters are in the Frame block, see render_scene_defr
+    tex_->activate_sampler(prog, "cloud_tex", at);
+    // not every pass skips empty space
+    occupancy_->activate(at + 1);
+    prog->set_value("cloud_occupancy", at + 1, true);
 }
@@ -7,6 +7,20 @@ namespace hmk4_models {
         float pix_per_m_;
 
         public:
+        // volumes above this are generated into a file mapping
+        static constexpr size_t max_heap_bytes    = (size_t)512 << 20;
+        static constexpr int    upload_slab_depth = 16;
+        // wider than a march step: the march fetches the grid once per brick, crosses an empty
+        // one in a single step, and a light ray starts in an occupied one without a fetch. with
+        // the light ray reuse of defr_draw.fs, about 2-3x fewer fetches per pixel for the default
+        // cloud (examples/ray_marching/bench_empty_space)
+        static constexpr int occupancy_brick = 16;
+
+        // density texture: 16-bit normalized, half the VRAM and sampling bandwidth of R32F. the
+        // pairs GL_R8/uint8_t and GL_R16F/terrain::half also work
+        typedef uint16_t        density_t;
+        static constexpr GLenum density_format = GL_R16;
+
         Cloud(
             vec3 aabb_min = vec3(-16000, 1000, -16000), vec3 aabb_max = vec3(16000, 1400, 16000),
             float pix_per_m = 1. / 80., int seed1 = 11, int seed2 = 1145
@@ -2,12 +2,17 @@
 
 #include "buffer_objects.hxx"
 #include "model_ground.hxx"
+#include "perlin_noise.hxx"
 #include "scene_pipeline.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
 #include "types.hxx"
+#include "volume_cache.hxx"
 #include "volumetric_cloud.hxx"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <glm/matrix.hpp>
 #include <memory>
 
@@ -16,85 +21,418 @@
 
 using namespace hmk4_models;
 
-Ground::Ground(vec3 offs) {
+// frustum planes (a, b, c, d), inside where a x + b y + c z + d >= 0
+static void frustum_planes(glm::mat4 world2clip, glm::vec4 planes[6]) {
+    auto row = [&](int i) {
+        return glm::vec4(world2clip[0][i], world2clip[1][i], world2clip[2][i], world2clip[3][i]);
+    };
+    for (int i = 0; i < 3; i++) {
+        planes[2 * i]     = row(3) + row(i);
+        planes[2 * i + 1] = row(3) - row(i);
+    }
+}
+
+// false if the box is entirely outside one of the planes
+static bool box_visible(const glm::vec4 planes[6], vec3 lo, vec3 hi) {
+    for (int i = 0; i < 6; i++) {
+        auto &p = planes[i];
+        vec3  v = vec3(p.x > 0 ? hi.x : lo.x, p.y > 0 ? hi.y : lo.y, p.z > 0 ? hi.z : lo.z);
+        if (glm::dot(vec3(p), v) + p.w < 0) return false;
+    }
+    return true;
+}
+
+static int floor_mod(int a, int n) { return (a % n + n) % n; }
+
+GroundClipmap::GroundClipmap(
+    vec2 base, float spacing0, Generator_t gen, terrain::QuantizeParams quant, int nb_threads
+) :
+    base_(base),
+    spacing0_(spacing0), gen_(gen), quant_(quant), pool_(nb_threads) {
+    for (auto &ring : rings_) {
+        ring.tex = std::make_shared<TextureObject>(
+            "", 0, TextureParameter("smooth"), GL_R16, GL_TEXTURE_2D
+        );
+        ring.tex->from_data(nullptr, clip_size, clip_size);
+    }
+}
+
+std::future<std::vector<GroundClipmap::Piece>>
+GroundClipmap::start_job(int k, glm::ivec2 target) {
+    auto      &ring = rings_[k];
+    const int  n    = clip_size;
+    glm::ivec2 o = ring.origin, t = target, d = glm::abs(target - ring.origin);
+
+    // world texel rects (u0, v0, w, h) the window exposes moving from o to t
+    std::vector<glm::ivec4> rects;
+    if (!ring.valid || d.x >= n || d.y >= n) {
+        rects.push_back(glm::ivec4(t.x, t.y, n, n));
+    } else {
+        if (d.x > 0) rects.push_back(glm::ivec4(t.x > o.x ? o.x + n : t.x, t.y, d.x, n));
+        if (d.y > 0) {
+            int v0 = t.y > o.y ? o.y + n : t.y;
+            rects.push_back(glm::ivec4(std::max(t.x, o.x), v0, n - d.x, d.y));
+        }
+    }
+    ring.target = t;
+
+    float spacing = this->spacing(k);
+    auto  gen     = gen_;
+    auto  quant   = quant_;
+    return pool_.submit([rects, spacing, gen, quant] {
+        std::vector<Piece> pieces;
+        std::vector<float> heights;
+        for (auto &r : rects) {
+            // split at the wrap, one glTexSubImage2D per piece
+            for (int u = r.x, w; u < r.x + r.z; u += w) {
+                int tx = floor_mod(u, clip_size);
+                w      = std::min(r.x + r.z - u, clip_size - tx);
+                for (int v = r.y, h; v < r.y + r.w; v += h) {
+                    int ty = floor_mod(v, clip_size);
+                    h      = std::min(r.y + r.w - v, clip_size - ty);
+
+                    heights.resize((size_t)w * h);
+                    gen(u, v, w, h, spacing, heights.data());
+                    Piece p{tx, ty, w, h, std::vector<uint16_t>(heights.size())};
+                    terrain::quantize(heights.data(), p.data.data(), heights.size(), quant);
+                    pieces.push_back(std::move(p));
+                }
+            }
+        }
+        return pieces;
+    });
+}
+
+void GroundClipmap::update(vec2 center) {
+    auto target = [&](int k) {
+        return glm::ivec2(glm::floor((center - base_) / spacing(k))) - clip_size / 2;
+    };
+
+    // first call: all rings at once, side by side on the workers
+    if (!rings_[0].valid && !rings_[0].pending.valid()) {
+        for (int k = 0; k < nb_rings; k++) {
+            rings_[k].pending = start_job(k, target(k));
+        }
+    }
+
+    for (int k = 0; k < nb_rings; k++) {
+        auto &ring = rings_[k];
+        if (ring.pending.valid()) {
+            if (ring.valid &&
+                ring.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                continue;
+            }
+            for (auto &p : ring.pending.get()) {
+                ring.tex->sub_data(p.data.data(), p.tx, p.ty, 0, p.w, p.h, 1);
+            }
+            ring.origin = ring.target;
+            ring.valid  = true;
+        }
+        if (target(k) != ring.origin) ring.pending = start_job(k, target(k));
+    }
+}
+
+void GroundClipmap::activate(std::shared_ptr<ShaderProgram> prog, int first) {
+    // programs only we still hold were rebuilt or dropped by their owner
+    uniforms_.erase(
+        std::remove_if(
+            uniforms_.begin(), uniforms_.end(),
+            [](const RingUniforms &u) { return u.prog.use_count() == 1; }
+        ),
+        uniforms_.end()
+    );
+    auto u = std::find_if(uniforms_.begin(), uniforms_.end(), [&](const RingUniforms &u) {
+        return u.prog == prog;
+    });
+    if (u == uniforms_.end()) {
+        RingUniforms r{prog};
+        for (int k = 0; k < nb_rings; k++) {
+            r.clip_map[k]    = prog->uniform<int>("clip_map", k, true);
+            r.clip_origin[k] = prog->uniform<vec2>("clip_origin", k, true);
+        }
+        u = uniforms_.insert(uniforms_.end(), r);
+    }
+
+    for (int k = 0; k < nb_rings; k++) {
+        rings_[k].tex->activate(first + k);
+        prog->set(u->clip_map[k], first + k);
+        prog->set(u->clip_origin[k], vec2(rings_[k].origin));
+    }
+    prog->set_value("clip_base", base_, true);
+    prog->set_value("clip_spacing", spacing0_, true);
+}
+
+Ground::Ground(vec3 offs) : ebo(GL_ELEMENT_ARRAY_BUFFER) {
 
     // init
     prog_defr_ground = std::make_shared<ShaderProgram>("defr_ground.vs", "defr_ground.fs");
+    prog_shadow      = std::make_shared<ShaderProgram>("defr_ground.vs", "shadow_mapping.fs");
     height_map       = std::make_shared<TextureObject>(
-        "", 0, TextureParameter("smooth"), GL_R32F, GL_TEXTURE_2D, true
+        "", 0, TextureParameter("smooth"), GL_R16, GL_TEXTURE_2D, true
     );
 
-    std::vector<float> verts;
-    nb_verts = 0;
+    base_y     = offs.y;
+    chunk_base = glm::vec2(offs.x - chunk_width / 2, offs.z - chunk_height / 2);
     for (float i = -radius; i <= radius; i += chunk_width) {
         for (float j = -radius; j <= radius; j += chunk_height) {
             if (i * i + j * j > radius * radius) continue;
+            chunks.push_back(chunk_base + glm::vec2(i, j));
+        }
+    }
+    spdlog::info("Ground::Ground: chunks: {}", chunks.size());
 
-            verts.insert(
-                verts.end(),
-                {
-                    i - chunk_width / 2 + offs.x, offs.y, j - chunk_height / 2 + offs.z, //
-                    i - chunk_width / 2 + offs.x, offs.y, j + chunk_height / 2 + offs.z, //
-                    i + chunk_width / 2 + offs.x, offs.y, j + chunk_height / 2 + offs.z, //
-                    i + chunk_width / 2 + offs.x, offs.y, j + chunk_height / 2 + offs.z, //
-                    i + chunk_width / 2 + offs.x, offs.y, j - chunk_height / 2 + offs.z, //
-                    i - chunk_width / 2 + offs.x, offs.y, j - chunk_height / 2 + offs.z, //
-                }
-            );
-            nb_verts += 6;
+    // the shared chunk mesh. vertex (i, j) of the finest grid is at index i * (n + 1) + j
+    const int          n = 1 << max_level;
+    std::vector<float> verts;
+    for (int i = 0; i <= n; i++) {
+        for (int j = 0; j <= n; j++) {
+            verts.insert(verts.end(), {(float)i / n, (float)j / n});
         }
     }
-    spdlog::info("Ground::Ground: verts: {}", nb_verts);
-    // exit(0);
+    std::vector<unsigned> indices;
+    for (int l = 0; l <= max_level; l++) {
+        const int s    = 1 << l;
+        index_first[l] = indices.size();
+        for (int i = 0; i < n; i += s) {
+            for (int j = 0; j < n; j += s) {
+                unsigned a = i * (n + 1) + j, b = a + s, c = a + s * (n + 1), d = c + s;
+                indices.insert(indices.end(), {a, b, d, d, c, a});
+            }
+        }
+        index_count[l] = indices.size() - index_first[l];
+    }
+
     vao.bind();
     {
         vbo.bind();
         vbo.SetBufferData(verts.size() * sizeof(float), verts.data());
-        vbo.SetAttribPointer(0, 3, GL_FLOAT);
+        vbo.SetAttribPointer(0, 2, GL_FLOAT);
+        ebo.bind();
+        ebo.SetBufferData(indices.size() * sizeof(unsigned), indices.data());
+        instance_vbo.SetBufferData(0, nullptr, GL_STREAM_DRAW);
+        instance_vbo.SetAttribPointer(1, 4, GL_FLOAT);
+        glVertexAttribDivisor(1, 1);
     }
     vao.unbind();
 
-    // gen height map
-    auto tex_data = terrain::gen_perlin_tex(
-        chunk_height * pix_per_m, chunk_width * pix_per_m, 1, noise_scale, 1145
-    );
-    tex_data += terrain::gen_perlin_tex(
-        chunk_height * pix_per_m, chunk_width * pix_per_m, 1, noise_scale / 4, 114
-    );
-    tex_data.vectorize_inplace([&](float t) {
-        t *= hscale;
-        return (glm::exp(t) - glm::exp(-t)) / (glm::exp(t) + glm::exp(-t)) * hscale;
-    });
-    height_map->from_data(
-        tex_data.data(), chunk_width * pix_per_m, chunk_height * pix_per_m, (GLenum)GL_FLOAT
+    // the tile is periodic, so it repeats over the chunks without seams
+    int                     dimx = tile_size, dimy = tile_size;
+    auto                    tex_data = gen_tile();
+    terrain::QuantizeParams quant;
+    auto                    tex_q = terrain::quantize<uint16_t>(tex_data, quant);
+    height_scale                  = quant.scale;
+    height_bias                   = quant.bias;
+    height_map->from_data(tex_q.data(), dimx, dimy);
+
+    heightfield = terrain::Heightfield(tex_data, chunk_base, 1 / pix_per_m, base_y);
+
+    // normals are fetched once per fragment instead of differenced from 4 more height samples.
+    // wrapping like the tile
+    auto slopes = terrain::gen_slope_map(tex_data, slope_scale);
+    normal_map  = std::make_shared<TextureObject>(
+        "", 0, TextureParameter("smooth"), GL_RG16F, GL_TEXTURE_2D, true
     );
+    normal_map->from_data(slopes.data(), dimx, dimy, (GLenum)GL_FLOAT, (GLenum)GL_RG);
 
-    // get world2tex
-    auto u    = glm::vec4(chunk_width, 0, 0, 0);
-    auto v    = glm::vec4(0, 0, chunk_height, 0);
+    // get world2tex, one tile per tile_size / pix_per_m meters
+    auto u    = glm::vec4(tile_size / pix_per_m, 0, 0, 0);
+    auto v    = glm::vec4(0, 0, tile_size / pix_per_m, 0);
     auto w    = glm::vec4(0, 1, 0, 0);
     world2tex = glm::inverse(
         glm::mat4(u, v, w, glm::vec4(offs - vec3(chunk_width / 2, 0, chunk_height / 2), 1))
     );
 }
 
+terrain::Array3D<float> Ground::gen_tile() {
+    int  dimx = tile_size, dimy = tile_size;
+    auto key  = terrain::CacheKey("hmk4_ground", 2)("noise_scale", noise_scale)("hscale", hscale);
+    key("seeds", "1145,114")("tileable", 1);
+
+    return terrain::cached_array3d<float>(key, dimx, dimy, 1, [&] {
+        auto data = terrain::gen_perlin_tex(dimx, dimy, 1, noise_scale, 1145, true);
+        terrain::add_perlin_tex(data, noise_scale / 4, 114, 1, true);
+        data = terrain::map(data, [&](float t) {
+            t *= hscale;
+            return (glm::exp(t) - glm::exp(-t)) / (glm::exp(t) + glm::exp(-t)) * hscale;
+        });
+        return data;
+    });
+}
+
+void Ground::clip_heights(int u0, int v0, int w, int h, float spacing, float *out) {
+    struct Octave {
+        float lattice; // meters per lattice cell
+        int   seed;
+    };
+    // the tile's octaves, noise_scale and noise_scale / 4 texels per cell
+    const Octave detail[] = {{noise_scale / pix_per_m, 1145}, {noise_scale / 4 / pix_per_m, 114}};
+
+    std::vector<float> x(w), y(w, .5f), z(w), n(w);
+    auto               octave = [&](float lattice, int seed, int j) {
+        for (int i = 0; i < w; i++) {
+            x[i] = (u0 + i) * (spacing / lattice);
+            z[i] = (v0 + j) * (spacing / lattice);
+        }
+        terrain::perlin_noise3_batch(x.data(), y.data(), z.data(), n.data(), w, seed);
+    };
+
+    for (int j = 0; j < h; j++) {
+        float *row = out + (size_t)j * w;
+        std::fill(row, row + w, 0.f);
+        for (auto &o : detail) {
+            if (o.lattice < spacing) continue; // finer than the texels, would only alias
+            octave(o.lattice, o.seed, j);
+            for (int i = 0; i < w; i++) {
+                row[i] += n[i];
+            }
+        }
+        octave(hills_scale, 19, j);
+        for (int i = 0; i < w; i++) {
+            row[i] = std::tanh(row[i] * hscale) * hscale + n[i] * hills_amp;
+        }
+    }
+}
+
+bool Ground::tessellation_active() {
+    if (!use_tessellation) return false;
+    if (!prog_tess && GLAD_GL_VERSION_4_0) {
+        prog_tess = ShaderProgram::tessellation(
+            "defr_ground.vs", "defr_ground.tcs", "defr_ground.tes", "defr_ground.fs"
+        );
+        prog_tess_shadow = ShaderProgram::tessellation(
+            "defr_ground.vs", "defr_ground.tcs", "defr_ground.tes", "shadow_mapping.fs"
+        );
+    }
+    if (!prog_tess) {
+        static bool warned = false;
+        if (!warned) spdlog::warn("Ground: tessellation needs GL 4.0, parallax path used");
+        warned = true;
+    }
+    return (bool)prog_tess;
+}
+
+void Ground::draw_gbuffer(glm::mat4 world2clip, glm::mat4 world2view) {
+    lod_center = vec3(glm::inverse(world2view) * glm::vec4(0, 0, 0, 1));
+
+    // view angle per pixel, from the projection and the gbuffer viewport
+    auto viewport  = GLState::current().viewport();
+    auto view2clip = world2clip * glm::inverse(world2view);
+    lod_pix_angle  = 2 / (view2clip[1][1] * std::max(viewport[3], 1));
+
+    if (use_clipmap) {
+        if (!clipmap) {
+            const float range = hscale + hills_amp;
+            clipmap           = std::make_shared<GroundClipmap>(
+                chunk_base, 1 / pix_per_m, clip_heights,
+                terrain::QuantizeParams{2 * range, -range}
+            );
+        }
+        auto center = glm::vec2(lod_center.x, lod_center.z);
+        clipmap->update(center);
+
+        // the chunks of the fixed grid around the camera, inside the coarsest ring
+        float r     = std::min(radius, clipmap->extent() - 2 * chunk_width);
+        int   nr    = (int)glm::ceil(r / chunk_width);
+        auto  cell0 = glm::floor((center - chunk_base) / chunk_width);
+        clip_chunks.clear();
+        for (int i = -nr; i <= nr; i++) {
+            for (int j = -nr; j <= nr; j++) {
+                auto c = chunk_base + (cell0 + glm::vec2(i, j)) * chunk_width;
+                if (glm::distance(c + chunk_width / 2, center) > r) continue;
+                clip_chunks.push_back(c);
+            }
+        }
+    }
+
+    draw(
+        std::vector{tessellation_active() ? prog_tess : prog_defr_ground}, //
+        world2clip, world2view, true
+    );
+}
+
 void Ground::draw(
     std::vector<std::shared_ptr<ShaderProgram>> progs, glm::mat4 world2clip, glm::mat4 world2view,
     bool require_sampler
 ) {
     spdlog::debug("Ground::draw");
     auto prog = progs[0];
+    bool tess = prog && (prog == prog_tess || prog == prog_tess_shadow);
+
+    //
+    // cull the chunks against world2clip, and pick each one's level by its nearest point to
+    // lod_center. the level is the lowest that any of its vertices would ask for, so vertex
+    // morphing in defr_ground.vs only ever goes to coarser grids
+
+    const bool              clip  = use_clipmap && clipmap;
+    terrain::QuantizeParams quant = clip ? clipmap->quant()
+                                         : terrain::QuantizeParams{height_scale, height_bias};
+
+    glm::vec4 planes[6];
+    frustum_planes(world2clip, planes);
+    const float h_lo = quant.bias, h_hi = quant.bias + quant.scale;
+
+    std::vector<glm::vec4> by_level[max_level + 1];
+    for (auto &c : clip ? clip_chunks : chunks) {
+        vec3 lo = vec3(c.x, base_y + h_lo, c.y);
+        vec3 hi = vec3(c.x + chunk_width, base_y + h_hi, c.y + chunk_height);
+        if (!box_visible(planes, lo, hi)) continue;
+
+        vec3  nearest = glm::clamp(lod_center, vec3(lo.x, base_y, lo.z), vec3(hi.x, base_y, hi.z));
+        float lod     = glm::log2(glm::max(glm::distance(nearest, lod_center), 1.f) / lod_range);
+        int   level   = glm::clamp((int)glm::floor(lod), 0, max_level);
+        by_level[level].push_back(glm::vec4(c.x, c.y, level, 0));
+    }
+
+    std::vector<glm::vec4> instances;
+    int                    instance_first[max_level + 1];
+    for (int l = 0; l <= max_level; l++) {
+        instance_first[l] = instances.size();
+        instances.insert(instances.end(), by_level[l].begin(), by_level[l].end());
+    }
+    spdlog::debug("Ground::draw: {} chunks", instances.size());
+    if (instances.empty()) return;
+
+    instance_vbo.SetBufferData(
+        instances.size() * sizeof(glm::vec4), instances.data(), GL_STREAM_DRAW
+    );
 
     prog->use();
     vao.bind();
 
-    // in : model2clip; world2tex
+    // in : model2clip; world2tex. view_pos is in the Frame block
     prog->set_value("model2clip", world2clip);
     prog->set_value("world2tex", world2tex, true);
-    prog->set_value("view_pos", vec3(glm::inverse(world2view) * glm::vec4(0, 0, 0, 1)), true);
     prog->set_value("pix_per_m", pix_per_m, true);
     height_map->activate(0);
     prog->set_value("height_map", (int)0, true);
+    prog->set_value("height_scale", quant.scale, true);
+    prog->set_value("height_bias", quant.bias, true);
+    prog->set_value("clipmap", (int)clip, true);
+    if (clip) clipmap->activate(prog, 1);
+    normal_map->activate(1 + GroundClipmap::nb_rings);
+    prog->set_value("normal_map", 1 + GroundClipmap::nb_rings, true);
+    // chunk mesh and levels
+    prog->set_value("chunk_width", chunk_width, true);
+    prog->set_value("max_level", max_level, true);
+    prog->set_value("lod_range", lod_range, true);
+    prog->set_value("lod_center", lod_center, true);
+    prog->set_value("base_y", base_y, true);
+    // tessellation
+    prog->set_value("tessellated", (int)tess, true);
+    if (tess) {
+        prog->set_value("pix_angle", lod_pix_angle, true);
+        prog->set_value("tess_px", tess_px, true);
+        glPatchParameteri(GL_PATCH_VERTICES, 3);
+    }
 
-    glDrawArrays(GL_TRIANGLES, 0, nb_verts);
+    for (int l = 0; l <= max_level; l++) {
+        if (by_level[l].empty()) continue;
+        instance_vbo.SetAttribPointer(
+            1, 4, GL_FLOAT, false, 0, (void *)(instance_first[l] * sizeof(glm::vec4))
+        );
+        glDrawElementsInstanced(
+            tess ? GL_PATCHES : GL_TRIANGLES, index_count[l], GL_UNSIGNED_INT,
+            (void *)(index_first[l] * sizeof(unsigned)), by_level[l].size()
+        );
+    }
 }
@@ -3,12 +3,18 @@
 #include "hmk4_config.hxx"
 
 #include "buffer_objects.hxx"
+#include "heightfield.hxx"
 #include "model.hxx"
 #include "scene_pipeline.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
+#include "thread_pool.hxx"
+#include "types.hxx"
 
+#include <functional>
+#include <future>
 #include <memory>
+#include <vector>
 
 #include <glm/fwd.hpp>
 #include <glm/glm.hpp>
@@ -16,45 +22,164 @@
 namespace hmk4_models {
     using namespace glwrapper;
     // constexpr float pi = glm::pi<float>();
+
+    /// @brief nested heightmap rings following a moving center, for unbounded terrain. ring k has
+    /// texels of spacing0 * 2^k meters in a clip_size^2 GL_R16 texture addressed toroidally: world
+    /// texel (u, v) is stored at (u mod clip_size, v mod clip_size). GL_REPEAT does the wrapping,
+    /// and a ring that moves only generates and uploads the rows and columns it exposes
+    class GroundClipmap {
+        public:
+        constexpr static int nb_rings  = 8;
+        constexpr static int clip_size = 256;
+
+        /// @brief fill out[j * w + i] with the height at world xz base + (u0 + i, v0 + j) *
+        /// spacing. runs on the worker threads
+        typedef std::function<void(int u0, int v0, int w, int h, float spacing, float *out)>
+            Generator_t;
+
+        /// @param base world xz of texel (0, 0) of every ring
+        /// @param quant heights are stored as (height - bias) / scale, clamped to [0, 1]
+        GroundClipmap(
+            vec2 base, float spacing0, Generator_t gen, terrain::QuantizeParams quant,
+            int nb_threads = 2
+        );
+        GroundClipmap(const GroundClipmap &) = delete;
+
+        /// @brief move the rings toward center (world xz): upload what the workers finished and
+        /// start jobs for the rings lagging behind. a ring's window switches only once all of its
+        /// new texels are uploaded. blocks on the first call only
+        void update(vec2 center);
+
+        /// @brief bind ring k to unit first + k, set clip_map[], clip_origin[], clip_base and
+        /// clip_spacing
+        void activate(std::shared_ptr<ShaderProgram> prog, int first);
+
+        inline float spacing(int k) const { return spacing0_ * (1 << k); }
+        /// @brief half width of the coarsest ring, in meters
+        inline float extent() const { return spacing(nb_rings - 1) * clip_size / 2; }
+        inline const terrain::QuantizeParams &quant() const { return quant_; }
+
+        protected:
+        // a block of texels at texel (tx, ty) of a ring's texture, not crossing the wrap
+        struct Piece {
+            int                   tx, ty, w, h;
+            std::vector<uint16_t> data;
+        };
+        struct Ring {
+            std::shared_ptr<TextureObject>  tex;
+            glm::ivec2                      origin; // min world texel of the uploaded window
+            bool                            valid = false;
+            glm::ivec2                      target; // window being generated
+            std::future<std::vector<Piece>> pending;
+        };
+
+        vec2                    base_;
+        float                   spacing0_;
+        Generator_t             gen_;
+        terrain::QuantizeParams quant_;
+        Ring                    rings_[nb_rings];
+        // clip_map[] and clip_origin[] handles per program activate() was called with (the
+        // gbuffer and shadow programs), resolved once instead of per draw
+        struct RingUniforms {
+            std::shared_ptr<ShaderProgram> prog;
+            Uniform<int>                   clip_map[nb_rings];
+            Uniform<vec2>                  clip_origin[nb_rings];
+        };
+        std::vector<RingUniforms> uniforms_;
+        mf::ThreadPool          pool_; // last: joined before the rings go
+
+        std::future<std::vector<Piece>> start_job(int k, glm::ivec2 target);
+    };
+
     class Ground : public ModelBase {
         public:
+        // one chunk mesh shared by all chunks: the finest grid over [0,1]^2 in vbo, and per level
+        // l a range of ebo using every 2^l-th vertex. chunks are drawn instanced per level
+        constexpr static int max_level = 5; // 2^max_level cells per chunk side at level 0
+
         VertexArrayObject  vao;
         VertexBufferObject vbo;
-        int                nb_verts;
+        BufferObject       ebo;
+        VertexBufferObject instance_vbo; // per visible chunk: corner x, z, level. rebuilt per draw
+        int                index_first[max_level + 1];
+        int                index_count[max_level + 1];
+
+        std::vector<glm::vec2> chunks;     // chunk corners (min x, min z)
+        glm::vec2              chunk_base; // corner of the chunk grid, also texel 0 of the clipmap
+        float                  base_y;
 
         std::shared_ptr<ShaderProgram> prog_defr_ground;
+        std::shared_ptr<ShaderProgram> prog_shadow; // defr_ground.vs, depth only
         std::shared_ptr<TextureObject> height_map;
+        std::shared_ptr<TextureObject> normal_map; // gen_slope_map of the tile, GL_RG16F
 
         constexpr static float chunk_width  = 400;
         constexpr static float chunk_height = 400;
         constexpr static float pix_per_m    = 2;
+        constexpr static int   tile_size    = 256; // heightmap texels, tileable and repeated
         constexpr static float radius       = 16000;
         constexpr static float noise_scale  = 5;
         constexpr static float hscale       = 1.2;
+        constexpr static float lod_range    = 400; // level l is used up to lod_range * 2^l
+        constexpr static float hills_scale  = 200; // clipmap only, meters per lattice cell
+        constexpr static float hills_amp    = 6;
+        // normal_map slopes on the scale of defr_ground.fs's differences over 0.2m
+        constexpr static float slope_scale = pix_per_m / 2 * (0.2f * pix_per_m);
 
         glm::mat4 world2tex;
+        // height = height_map * height_scale + height_bias, stored as 16-bit normalized
+        float height_scale = 1, height_bias = 0;
+        // camera the levels are selected for. kept from draw_gbuffer, so the shadow passes draw the
+        // same geometry
+        vec3 lod_center = vec3(0);
+
+        // clipmap mode: heights stream into a GroundClipmap around the camera, and the chunks
+        // follow it. created on the first draw_gbuffer in this mode
+        bool                           use_clipmap = false;
+        std::shared_ptr<GroundClipmap> clipmap;
+        std::vector<glm::vec2>         clip_chunks;
+
+        // tessellation mode (GL 4.0): the chunk triangles are patches, split by their length on
+        // screen and displaced at full detail; no parallax. programs are made on first use
+        bool                           use_tessellation = false;
+        float                          tess_px          = 8; // target edge length in pixels
+        float                          lod_pix_angle    = 1; // camera view angle per pixel
+        std::shared_ptr<ShaderProgram> prog_tess;
+        std::shared_ptr<ShaderProgram> prog_tess_shadow;
 
         public:
+        // the tile on the CPU, in world coordinates: props are placed on it without reading the
+        // GPU back. the clipmap mode's hills are not in it
+        terrain::Heightfield heightfield;
+
         Ground(vec3 offs = vec3(0, -66, 0));
         virtual ~Ground() = default;
 
-        inline void draw_gbuffer(glm::mat4 world2clip, glm::mat4 world2view) override {
-            draw(
-                std::vector{prog_defr_ground}, //
-                world2clip, world2view, true
-            );
-        }
-        // unused
+        void draw_gbuffer(glm::mat4 world2clip, glm::mat4 world2view) override;
+        // shadow passes. prog is the shared depth program, which knows no instancing: prog_shadow
+        // or prog_tess_shadow draws instead, culled against this light's world2clip
         inline void draw(
             std::shared_ptr<ShaderProgram> prog, glm::mat4 world2clip, glm::mat4 world2view,
             bool require_sampler
         ) override {
-            draw(std::vector{prog}, world2clip, world2view, require_sampler);
+            auto shadow = tessellation_active() ? prog_tess_shadow : prog_shadow;
+            draw(std::vector{shadow}, world2clip, world2view, require_sampler);
         }
 
         void draw(
             std::vector<std::shared_ptr<ShaderProgram>> progs, glm::mat4 world2clip,
             glm::mat4 world2view, bool require_sampler
         ) override;
+
+        /// @brief GroundClipmap::Generator_t of the clipmap mode: the tile's two octaves, left out
+        /// where finer than the texels, plus hills of hills_scale
+        static void clip_heights(int u0, int v0, int w, int h, float spacing, float *out);
+        /// @brief heights of the tile, (tile_size, tile_size, 1) texel (t, s), from the cache
+        /// when present. no GL
+        static terrain::Array3D<float> gen_tile();
+
+        protected:
+        // use_tessellation and the context supports it
+        bool tessellation_active();
     };
 } // namespace hmk4_models
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "hmk4_config.hxx"
 #include "model.hxx"
 #include "shader_program.hxx"
@@ -12,6 +13,42 @@
 
 using namespace hmk4_models;
 
+namespace {
+    // offsets in the Frame block of frame_uniforms.glsl, declared in the same order
+    struct FrameBlock {
+        size_t world2clip, world2view, view_pos, fovy, light_pos, s_light, light_color, shininess;
+        // CloudParams, relative to cloud
+        size_t cloud, world2tex, aabb_min, sigma_a, aabb_max, sigma_s, scale, bias, brick, max_lod;
+        size_t size;
+
+        FrameBlock() {
+            Std140Layout c;
+            world2tex = c.add<mat4>();
+            aabb_min  = c.add<vec3>();
+            sigma_a   = c.add<float>();
+            aabb_max  = c.add<vec3>();
+            sigma_s   = c.add<float>();
+            scale     = c.add<float>();
+            bias      = c.add<float>();
+            brick     = c.add<int>();
+            max_lod   = c.add<float>();
+
+            Std140Layout l;
+            world2clip  = l.add<mat4>();
+            world2view  = l.add<mat4>();
+            view_pos    = l.add<vec3>();
+            fovy        = l.add<float>();
+            light_pos   = l.add<vec3>();
+            s_light     = l.add<float>();
+            light_color = l.add<vec3>();
+            shininess   = l.add<float>();
+            cloud       = l.add_struct(c);
+            size        = l.size();
+        }
+    };
+    const FrameBlock frame_block;
+} // namespace
+
 void ModelBase::draw_gbuffer(glm::mat4 world2clip, glm::mat4 world2view) { assert(false); }
 void ModelBase::draw(
     std::vector<std::shared_ptr<ShaderProgram>> progs, glm::mat4 world2clip, glm::mat4 world2view,
@@ -45,6 +82,7 @@ void hmk4_models::render_scene_defr(                                //
 ) {
 
     // suppose fbo is cleared
+    auto &state = GLState::current();
 
     //
     //
@@ -72,6 +110,34 @@ void hmk4_models::render_scene_defr(                                //
         }
         vao->unbind();
     }
+    if (!frame_ubo) {
+        frame_ubo = std::make_shared<UniformBufferObject>("Frame", 0, frame_block.size);
+    }
+
+    //
+    //
+    // per-frame uniforms, read by every pass below
+    spdlog::trace("render_scene_defr: frame uniforms");
+
+    const auto &fb = frame_block;
+    frame_ubo->set(fb.world2clip, world2clip);
+    frame_ubo->set(fb.world2view, world2view);
+    frame_ubo->set(fb.view_pos, view_pos);
+    frame_ubo->set(fb.fovy, fovy);
+    frame_ubo->set(fb.light_pos, arguments.get("light.x", "light.y", "light.z"));
+    frame_ubo->set(fb.s_light, (float)arguments.get<double>("s_light"));
+    frame_ubo->set(fb.light_color, arguments.get("light.r", "light.g", "light.b"));
+    frame_ubo->set(fb.shininess, (float)arguments.get<double>("shininess"));
+    frame_ubo->set(fb.cloud + fb.world2tex, cloud->world2tex_);
+    frame_ubo->set(fb.cloud + fb.aabb_min, cloud->aabb_min_);
+    frame_ubo->set(fb.cloud + fb.sigma_a, cloud->sigma_a_);
+    frame_ubo->set(fb.cloud + fb.aabb_max, cloud->aabb_max_);
+    frame_ubo->set(fb.cloud + fb.sigma_s, cloud->sigma_s_);
+    frame_ubo->set(fb.cloud + fb.scale, cloud->density_scale_);
+    frame_ubo->set(fb.cloud + fb.bias, cloud->density_bias_);
+    frame_ubo->set(fb.cloud + fb.brick, cloud->brick_);
+    frame_ubo->set(fb.cloud + fb.max_lod, cloud->max_lod_);
+    frame_ubo->upload();
 
     //
     //
@@ -90,12 +156,12 @@ void hmk4_models::render_scene_defr(                                //
     const GLenum draw_targ[]{
         GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3
     };
-    glDrawBuffers(4, draw_targ);
+    state.draw_buffers(4, draw_targ);
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, gbuffer.width(), gbuffer.height());
+    state.viewport(0, 0, gbuffer.width(), gbuffer.height());
 
-    glEnable(GL_DEPTH_TEST);
+    state.set_enabled(GL_DEPTH_TEST, true);
     MY_CHECK_FAIL
 
     for (auto &model : models) {
@@ -110,7 +176,7 @@ void hmk4_models::render_scene_defr(                                //
     assert(shadow_buffers.size() <= world2shadow.size());
     for (int i = 0; i < shadow_buffers.size(); i++) {
         shadow_buffers[i]->bind();
-        glViewport(0, 0, shadow_buffers[i]->width(), shadow_buffers[i]->height());
+        state.viewport(0, 0, shadow_buffers[i]->width(), shadow_buffers[i]->height());
         glClear(GL_DEPTH_BUFFER_BIT);
 
         for (auto &model : models) {
@@ -118,7 +184,7 @@ void hmk4_models::render_scene_defr(                                //
         }
 
         shadow_buffers[i]->unbind();
-        glDrawBuffer(GL_BACK);
+        state.draw_buffer(GL_BACK);
     }
 
     //
@@ -131,24 +197,29 @@ void hmk4_models::render_scene_defr(                                //
     prog_vis->use();
     vao->bind();
 
-    glDrawBuffer(GL_COLOR_ATTACHMENT4);
+    state.draw_buffer(GL_COLOR_ATTACHMENT4);
     glClear(GL_COLOR_BUFFER_BIT);
-    glViewport(0, 0, gbuffer.width(), gbuffer.height());
+    state.viewport(0, 0, gbuffer.width(), gbuffer.height());
     MY_CHECK_FAIL
 
-    glDisable(GL_DEPTH_TEST);
+    state.set_enabled(GL_DEPTH_TEST, false);
 
-    prog_vis->set_value("world2clip", world2clip);
-    prog_vis->set_value("light_pos", arguments.get("light.x", "light.y", "light.z"));
+    auto &u = vis_uniforms;
+    if (u.prog != prog_vis) u = {prog_vis};
+    while (u.shadow_tex.size() < shadow_buffers.size()) {
+        int i = u.shadow_tex.size();
+        u.shadow_tex.push_back(prog_vis->uniform<int>("shadow_tex", i));
+        u.world2shadow.push_back(prog_vis->uniform<mat4>("world2shadow", i));
+        u.shadow_portions.push_back(prog_vis->uniform<float>("shadow_portions", i));
+    }
 
     int tex_id = 0;
     assert(shadow_buffers.size() <= portions.size());
     for (auto &shadow_buffer : shadow_buffers) {
-        shadow_buffer->tex_depth()->activate_sampler(
-            prog_vis, fmt::format("shadow_tex[{}]", tex_id), tex_id
-        );
-        prog_vis->set_value(fmt::format("world2shadow[{}]", tex_id), world2shadow[tex_id]);
-        prog_vis->set_value(fmt::format("shadow_portions[{}]", tex_id), portions[tex_id]);
+        shadow_buffer->tex_depth()->activate(tex_id);
+        prog_vis->set(u.shadow_tex[tex_id], tex_id);
+        prog_vis->set(u.world2shadow[tex_id], world2shadow[tex_id]);
+        prog_vis->set(u.shadow_portions[tex_id], portions[tex_id]);
         tex_id++;
     }
     prog_vis->set_value("nb_shadow_tex", tex_id);
@@ -172,20 +243,12 @@ void hmk4_models::render_scene_defr(                                //
     vao->bind();
 
     MY_CHECK_FAIL
-    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    state.draw_buffer(GL_COLOR_ATTACHMENT0);
     MY_CHECK_FAIL
 
-    glDisable(GL_DEPTH_TEST);
-
-    prog_draw->set_value("view_pos", view_pos);
-    prog_draw->set_value("light_pos", arguments.get("light.x", "light.y", "light.z"));
-    prog_draw->set_value("light_color", arguments.get("light.r", "light.g", "light.b"));
-    prog_draw->set_value("s_light", (float)arguments.get<double>("s_light"));
-    prog_draw->set_value("shininess", (float)arguments.get<double>("shininess"));
+    state.set_enabled(GL_DEPTH_TEST, false);
 
     cloud->activate_cloud_sampler(prog_draw, 6);
-    prog_draw->set_value("world2view", world2view);
-    prog_draw->set_value("fovy", (float)fovy);
 
     gbuffer.tex(0)->activate_sampler(prog_draw, "gbuffer.t_pos", 1);
     gbuffer.tex(1)->activate_sampler(prog_draw, "gbuffer.t_norm", 2);
@@ -197,5 +260,5 @@ void hmk4_models::render_scene_defr(                                //
     MY_CHECK_FAIL
     vao->unbind();
 
-    glDisable(GL_DEPTH_TEST);
+    state.set_enabled(GL_DEPTH_TEST, false);
 }
\ No newline at end of file
@@ -36,9 +36,18 @@ namespace hmk4_models {
         mat4  world2tex_;
 
         std::shared_ptr<TextureObject> tex_;
+        // density = tex_ * density_scale_ + density_bias_
+        float density_scale_ = 1, density_bias_ = 0;
+
+        // empty-space skipping: 255 for the bricks of brick_^3 voxels of tex_ holding density
+        std::shared_ptr<TextureObject> occupancy_;
+        int                            brick_   = 0;
+        float                          max_lod_ = 0;
 
         public:
         virtual ~CloudModelBase() = default;
+        /// @brief bind cloud_tex and cloud_occupancy of prog at units at and at + 1. the
+        /// parameters above reach the shaders through the Frame block
         virtual void activate_cloud_sampler(std::shared_ptr<ShaderProgram> prog, int at);
     };
 
@@ -62,4 +71,17 @@ namespace hmk4_models {
     static std::shared_ptr<ShaderProgram>      prog_vis;
     static std::shared_ptr<VertexArrayObject>  vao;
     static std::shared_ptr<VertexBufferObject> vbo;
+
+    // the Frame block of frame_uniforms.glsl, written once per frame
+    static std::shared_ptr<UniformBufferObject> frame_ubo;
+
+    // handles of the per-shadow array elements of prog, resolved on first use instead of
+    // formatted each frame, and again once prog_vis is rebuilt
+    struct ShadowUniforms {
+        std::shared_ptr<ShaderProgram> prog;
+        std::vector<Uniform<int>>      shadow_tex;
+        std::vector<Uniform<mat4>>     world2shadow;
+        std::vector<Uniform<float>>    shadow_portions;
+    };
+    static ShadowUniforms vis_uniforms;
 } // namespace hmk4_models
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "button.hxx"
 #include "config.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "model_cloud.hxx"
 #include "model_ground.hxx"
 #include "model_windgen.hxx"
@@ -33,7 +34,8 @@ class MyWorld : public WorldViewBase {
     std::vector<std::shared_ptr<ModelBase>> models;
     std::shared_ptr<CloudModelBase>         cloud;
 
-    std::vector<glm::vec3> windgen_pos;
+    std::vector<glm::vec3>  windgen_pos;
+    std::shared_ptr<Ground> ground;
 
     public:
     MyWorld(std::shared_ptr<ParameterDict> arguments) :
@@ -49,29 +51,31 @@ class MyWorld : public WorldViewBase {
 
         //
         // init model
-        std::shared_ptr<ModelBase> model;
-        model = std::make_shared<Ground>();
-        models.push_back(model);
-        model = std::make_shared<Windgen>(vec3(0, 0, 0), pi / 4, 0.1);
-        models.push_back(model);
-        windgen_pos.push_back(vec3(0, 0, 0));
+        ground = std::make_shared<Ground>();
+        models.push_back(ground);
 
         //
-        // init random windgen positions
+        // init random windgen positions, on the ground
+        std::vector<float> xs = {0}, zs = {0}, yaws = {pi / 4}, speeds = {0.1};
         for (int i = -3; i < 3; i++) {
             for (int j = i == 0; j < 3; j++) {
                 float dx =
                     stb_perlin_noise3_seed(2 * i + 0.5, 2 * j + 0.5, 2 * j + 0.5, 0, 0, 0, 1145);
                 float dy =
                     stb_perlin_noise3_seed(2 * i + 0.5, 2 * j + 0.5, 2 * i + 0.5, 0, 0, 0, 11451);
-                auto pos    = glm::vec3(i * 300 + dx * 200, 0, j * 300 + dy * 200);
-                auto model2 = std::make_shared<Windgen>(
-                    pos, pi / 4 + (dx - dy) * 0.1, glm::abs(dx + dy) * 0.4 + 0.2
-                );
-                models.push_back(model2);
-                windgen_pos.push_back(pos);
+                xs.push_back(i * 300 + dx * 200);
+                zs.push_back(j * 300 + dy * 200);
+                yaws.push_back(pi / 4 + (dx - dy) * 0.1);
+                speeds.push_back(glm::abs(dx + dy) * 0.4 + 0.2);
             }
         }
+        std::vector<float> ys(xs.size());
+        ground->heightfield.sample(xs.data(), zs.data(), ys.data(), nullptr, xs.size());
+        for (int i = 0; i < xs.size(); i++) {
+            auto pos = glm::vec3(xs[i], ys[i], zs[i]);
+            models.push_back(std::make_shared<Windgen>(pos, yaws[i], speeds[i]));
+            windgen_pos.push_back(pos);
+        }
 
         //
         // init cloud
@@ -79,13 +83,15 @@ class MyWorld : public WorldViewBase {
 
         //
         // camera type
-        camera                    = mf::WorldCamera(vec3(0, 0, 0), vec3(0, 20, 20));
+        camera                    = mf::WorldCamera(windgen_pos[0], windgen_pos[0] + vec3(0, 20, 20));
         camera.spin_at_viewpoint_ = false;
     }
 
     bool draw(DrawableFrame &fbo) override {
 
         spdlog::debug("MyWorld::draw");
+        ground->use_clipmap      = arguments_->get<double>("ground.clipmap") > .5;
+        ground->use_tessellation = arguments_->get<double>("ground.tessellation") > .5;
 
         //
         // prepare shadow mapping
@@ -152,6 +158,14 @@ class MyWorld : public WorldViewBase {
             *arguments_
         );
 
+        // state changes of this frame
+        auto &state = GLState::current();
+        auto  calls = state.total();
+        spdlog::debug(
+            "MyWorld::draw: GL state calls: {} issued, {} elided", calls.issued, calls.elided
+        );
+        state.reset_counters();
+
         return false;
     }
 
@@ -187,6 +201,8 @@ int main() {
             {"shininess", 32.},              //
             {"s_light", 1.5},                //
             {"fov", glm::pi<double>() / 4.}, //
+            {"ground.clipmap", 0.},          //
+            {"ground.tessellation", 0.},     //
         }
     );
 
@@ -0,0 +1,77 @@
+// trilinear ray marching through a large volume stored in each terrain::Array3D layout
+
+#include "types.hxx"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace glm;
+
+// march nb_rays random rays of nb_steps trilinear samples, voxel units
+template<typename L>
+static float march(const terrain::Array3D<float, L> &a, int nb_rays, int nb_steps, int seed) {
+    auto shape = a.shape();
+    vec3 hi    = vec3(shape[0], shape[1], shape[2]) - 1.001f;
+
+    std::mt19937                          rng(seed);
+    std::uniform_real_distribution<float> uni(0, 1);
+
+    float acc = 0;
+    for (int r = 0; r < nb_rays; r++) {
+        vec3 ro = vec3(uni(rng), uni(rng), uni(rng)) * hi;
+        vec3 rd = normalize(vec3(uni(rng), uni(rng), uni(rng)) * 2.f - 1.f);
+        for (int s = 0; s < nb_steps; s++) {
+            vec3 p = clamp(ro + rd * (float)s, vec3(0), hi);
+            int  x = (int)p.x, y = (int)p.y, z = (int)p.z;
+            vec3 d = p - vec3(x, y, z);
+
+            float c00 = mix(a.at(x, y, z), a.at(x + 1, y, z), d.x);
+            float c01 = mix(a.at(x, y, z + 1), a.at(x + 1, y, z + 1), d.x);
+            float c10 = mix(a.at(x, y + 1, z), a.at(x + 1, y + 1, z), d.x);
+            float c11 = mix(a.at(x, y + 1, z + 1), a.at(x + 1, y + 1, z + 1), d.x);
+            acc += mix(mix(c00, c10, d.y), mix(c01, c11, d.y), d.z);
+        }
+    }
+    return acc;
+}
+
+template<typename L> static void run(const char *name, terrain::Array3D<float> &src, float ref) {
+    terrain::Array3D<float, L> a(src);
+
+    const int nb_rays = 20000, nb_steps = 256;
+
+    auto  t0  = std::chrono::steady_clock::now();
+    float acc = march(a, nb_rays, nb_steps, 7);
+    auto  t1  = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    auto lin = a.to_linear();
+    bool eq  = memcmp(lin.data(), src.data(), lin.size() * sizeof(float)) == 0;
+
+    spdlog::info(
+        "{:8}: {:.1f}ms, {:.2f}ns/sample, same result: {}, to_linear exact: {}", name, ms,
+        ms * 1e6 / ((double)nb_rays * nb_steps), acc == ref, eq
+    );
+}
+
+int main() {
+    const int dim = 256;
+
+    terrain::Array3D<float> src(dim, dim, dim);
+    src.vectorize_inplace([](float, int i, int j, int k) {
+        return (float)((i * 7 + j * 13 + k * 31) % 101) / 101.f;
+    });
+
+    float ref = march(src, 20000, 256, 7);
+
+    run<terrain::LinearLayout>("linear", src, ref);
+    run<terrain::BrickedLayout>("bricked", src, ref);
+    run<terrain::MortonLayout>("morton", src, ref);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,255 @@
+// texture fetches per pixel of the hmk4 cloud march (examples/hmk4/defr_draw.fs), view and light
+// rays, with and without empty-space skipping over terrain::gen_occupancy_grid and light ray
+// reuse, replayed on the CPU. density samples and occupancy lookups both count
+
+#include "types.hxx"
+#include "volumetric_cloud.hxx"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/trigonometric.hpp>
+
+#include <spdlog/spdlog.h>
+
+using namespace glm;
+
+// hmk4_models::Cloud with its default arguments
+static const vec3  aabb_min = vec3(-16000, 1000, -16000), aabb_max = vec3(16000, 1400, 16000);
+static const float pix_per_m = 1. / 80.;
+static const int   seed      = 11;
+
+// defr_draw.fs
+static const float nb_iter1 = 60, nb_iter2 = 7;
+static const float sigma_a = 0.002, sigma_s = 0.098;
+static const vec3  light_pos     = vec3(0.1, 4400, 270);
+static const float occupancy_eps = 1e-6;
+static const float light_reuse   = 0.5;
+
+struct Counts {
+    long samples = 0; // density samples, view and light rays
+    long fetches = 0; // occupancy lookups
+};
+
+struct Scene {
+    terrain::Array3D<float>     data;
+    terrain::Array3D<uint8_t>   grid;
+    ivec3                       dims; // texture order: x fastest, array order reversed
+    mat4                        world2tex;
+    int                         brick;
+    bool                        skip;
+
+    static int wrap(int i, int n) { return (i % n + n) % n; }
+
+    // GL_LINEAR, GL_REPEAT
+    float sample(vec3 pos, Counts &c) const {
+        c.samples++;
+        vec3 p  = vec3(world2tex * vec4(pos, 1)) * vec3(dims) - 0.5f;
+        vec3 f  = floor(p);
+        vec3 d  = p - f;
+        int  x0 = (int)f.x, y0 = (int)f.y, z0 = (int)f.z;
+
+        float v = 0;
+        for (int n = 0; n < 8; n++) {
+            int   dx = n & 1, dy = (n >> 1) & 1, dz = n >> 2;
+            float w = (dx ? d.x : 1 - d.x) * (dy ? d.y : 1 - d.y) * (dz ? d.z : 1 - d.z);
+            v += w * data.at(
+                         wrap(z0 + dz, dims.z), wrap(y0 + dy, dims.y), wrap(x0 + dx, dims.x)
+                     );
+        }
+        return glm::abs(v);
+    }
+
+    vec3 to_voxel(vec3 pos) const { return vec3(world2tex * vec4(pos, 1)) * vec3(dims) - 0.5f; }
+
+    // brick_exit
+    float brick_exit(vec3 pos, vec3 rd) const {
+        vec3  p    = to_voxel(pos);
+        vec3  dp   = mat3(world2tex) * rd * vec3(dims);
+        float size = (float)brick;
+        vec3  b    = floor(p / size);
+
+        vec3 t_exit;
+        for (int a = 0; a < 3; a++) {
+            float s   = glm::abs(dp[a]) < 1e-6f ? (dp[a] < 0 ? -1e-6f : 1e-6f) : dp[a];
+            t_exit[a] = ((b[a] + (s >= 0 ? 1 : 0)) * size - p[a]) / s;
+        }
+        return glm::min(t_exit.x, glm::min(t_exit.y, t_exit.z)) + 1e-2f;
+    }
+
+    // skip_empty: brick exit distance, negative for an occupied brick
+    float skip_empty(vec3 pos, vec3 rd, Counts &c) const {
+        if (!skip) return 0;
+        vec3 b  = floor(to_voxel(pos) / (float)brick);
+        auto gs = grid.shape();
+        int  bx = (int)b.x, by = (int)b.y, bz = (int)b.z;
+        if (b.x < 0 || b.y < 0 || b.z < 0 || bx >= gs[2] || by >= gs[1] || bz >= gs[0]) return 0;
+
+        c.fetches++;
+        float exit = brick_exit(pos, rd);
+        return grid.at(bz, by, bx) ? -exit : exit;
+    }
+
+    static void range(vec3 ro, vec3 rd, float &t_enter, float &t_exit) {
+        vec3 safe_rd = rd;
+        for (int a = 0; a < 3; a++) {
+            if (glm::abs(safe_rd[a]) < 1e-6f) safe_rd[a] = 1e-6f;
+        }
+        vec3 t0 = (aabb_min - ro) / safe_rd, t1 = (aabb_max - ro) / safe_rd;
+        vec3 tmin = min(t0, t1), tmax = max(t0, t1);
+        t_enter   = glm::max(glm::max(glm::max(tmin.x, tmin.y), tmin.z) + 1e-4f, 0.f);
+        t_exit    = glm::min(glm::min(tmax.x, tmax.y), tmax.z) - 1e-4f;
+    }
+
+    // query_transmittance
+    float transmittance(vec3 ro, Counts &c) const {
+        vec3  rd = normalize(light_pos - ro);
+        float t_enter, t_exit;
+        range(ro, rd, t_enter, t_exit);
+        float t_step = glm::max((t_exit - t_enter) / (nb_iter2 - 1), 0.1f);
+        if (t_exit < t_enter) return 1;
+
+        // ro holds density: its brick is occupied
+        float dist = 0, cur_step, t_occupied = t_enter + brick_exit(ro + rd * t_enter, rd);
+        for (float t = t_enter; t <= t_exit; t += cur_step) {
+            if (t >= t_occupied) {
+                cur_step = skip_empty(ro + rd * t, rd, c);
+                if (cur_step > 0) {
+                    cur_step = glm::max(cur_step, t_step);
+                    continue;
+                }
+                t_occupied = t - cur_step;
+            }
+
+            float density = sample(ro + rd * t, c);
+            cur_step      = density < 1e-2 ? t_step * 2 : t_step;
+            dist += cur_step * density;
+        }
+        float sigma_t = sigma_a + sigma_s;
+        return glm::exp(-sigma_t * dist) * (1 - glm::exp(-sigma_t * dist * 2));
+    }
+
+    // draw_sky without the occluder test and the lighting constants: (radiance, transmittance)
+    vec2 march(vec3 ro, vec3 rd, Counts &c) const {
+        float t_enter, t_exit;
+        range(ro, rd, t_enter, t_exit);
+        float t_step = glm::max((t_exit - t_enter) / (nb_iter1 - 1), 0.1f);
+
+        float sigma_t = sigma_a + sigma_s, radiance = 0, T = 1, cur_step, t_occupied = -1;
+        vec3  light_at = vec3(-1e9);
+        float light_T  = 0;
+        for (float t = t_enter; t <= t_exit; t += cur_step) {
+            vec3 pos = ro + rd * t;
+            if (t >= t_occupied) {
+                cur_step = skip_empty(pos, rd, c);
+                if (cur_step > 0) {
+                    cur_step = glm::max(cur_step, t_step);
+                    continue;
+                }
+                t_occupied = t - cur_step;
+            }
+
+            float density = sample(pos, c);
+            cur_step      = density < 1e-2 ? t_step * 2 : t_step;
+            if (skip && density <= occupancy_eps) continue;
+
+            vec3 voxel = to_voxel(pos), moved = abs(voxel - light_at);
+            if (!skip || glm::max(moved.x, glm::max(moved.y, moved.z)) >= light_reuse) {
+                light_T  = transmittance(pos, c);
+                light_at = voxel;
+            }
+            float L_o = light_T * sigma_s / sigma_t;
+            radiance += T * L_o * density * cur_step;
+            T *= glm::exp(-density * sigma_t * cur_step);
+            if (T < 5e-4) break;
+        }
+        return vec2(radiance, T);
+    }
+};
+
+int main() {
+    spdlog::set_level(spdlog::level::info);
+
+    // same generation as hmk4_models::Cloud
+    auto box     = aabb_max - aabb_min;
+    auto tex_box = box * pix_per_m;
+    int  dimx = (int)tex_box.z + 1, dimy = (int)tex_box.y + 1, dimz = (int)tex_box.x + 1;
+
+    terrain::Array3D<float> data(dimx, dimy, dimz);
+    auto                    shaping = [&](float v, int i, int j, int k) {
+        float x = k / tex_box.x * 2 - 1, y = j / tex_box.y * 2 - 1, z = i / tex_box.z * 2 - 1;
+        v *= glm::pow(glm::max<float>(1 - x * x - z * z, 0), 1. / 8.);
+        v *= glm::min<float>(3 * (y - 1), 1);
+        v *= glm::min<float>(1 * (y + 1), 1);
+        v = glm::pow(glm::max<float>(v - 0.3, 0), 2);
+        v = v > 1.8 ? glm::mix<float>(2, 1.8, glm::exp(-v + 0.8)) : v;
+        v *= 0.05;
+        return (float)v;
+    };
+    for (int i = 0; i < 3; i++) {
+        terrain::add_perlin_tex(data, glm::pow(2.f, -i) * 10, seed, glm::pow(2.f, -i));
+    }
+    terrain::add_perlin_tex(
+        data, glm::pow(2.f, -3) * 10, seed, glm::pow(2.f, -3), false,
+        [&](int x0, int x1) { data.assign(terrain::map(data, shaping), x0, x1); }
+    );
+
+    Scene scene;
+    scene.data      = data;
+    scene.dims      = ivec3(dimz, dimy, dimx);
+    scene.brick     = 16; // hmk4_models::Cloud::occupancy_brick
+    scene.grid      = terrain::gen_occupancy_grid(data, scene.brick, occupancy_eps);
+    scene.world2tex = mat4(         //
+        vec4(1 / (box.x), 0, 0, 0), //
+        vec4(0, 1 / (box.y), 0, 0), //
+        vec4(0, 0, 1 / (box.z), 0), //
+        vec4(-aabb_min / box, 1)
+    );
+
+    auto gs    = scene.grid.shape();
+    long empty = 0, n_bricks = (long)gs[0] * gs[1] * gs[2];
+    for (int i = 0; i < gs[0]; i++) {
+        for (int j = 0; j < gs[1]; j++) {
+            for (int k = 0; k < gs[2]; k++) {
+                empty += !scene.grid.at(i, j, k);
+            }
+        }
+    }
+    spdlog::info("{}x{}x{} voxels, {} of {} bricks empty", dimx, dimy, dimz, empty, n_bricks);
+
+    // hmk4 camera position, fovy pi/4, pitched up by 10, 30 and 60 degrees
+    const vec3  ro = vec3(0, 20, 20);
+    const int   w = 160, h = 120;
+    const float fovy = glm::pi<float>() / 4;
+
+    bool ok = true;
+    for (float pitch : {10.f, 30.f, 60.f}) {
+        Counts base, skip;
+        double max_err = 0, sum_dL = 0, sum_L = 0;
+        for (int py = 0; py < h; py++) {
+            for (int px = 0; px < w; px++) {
+                float u = (px + .5f) / w * 2 - 1, v = (py + .5f) / h * 2 - 1;
+                float a = glm::radians(pitch), f = 1 / glm::tan(fovy / 2);
+                float c = glm::cos(a), s = glm::sin(a);
+                vec3  d = normalize(vec3(u * w / h, v * c + f * s, v * s - f * c));
+
+                scene.skip = false;
+                vec2 r0    = scene.march(ro, d, base);
+                scene.skip = true;
+                vec2 r1    = scene.march(ro, d, skip);
+                max_err    = glm::max(max_err, (double)glm::abs(r0.y - r1.y));
+                sum_dL += glm::abs(r0.x - r1.x);
+                sum_L += r0.x;
+            }
+        }
+        double spp0 = (double)base.samples / (w * h), spp1 = (double)skip.samples / (w * h);
+        double fpp1 = (double)skip.fetches / (w * h);
+        spdlog::info(
+            "pitch {:2}: samples/pixel {:.1f} -> {:.1f} + {:.1f} occupancy fetches (x{:.2f}), max "
+            "|dT| {:.4f}, mean |dL| / L {:.4f}",
+            pitch, spp0, spp1, fpp1, spp0 / (spp1 + fpp1), max_err, sum_dL / sum_L
+        );
+        ok = ok && (spp1 + fpp1) * 2 <= spp0 && sum_dL <= 0.05 * sum_L;
+    }
+    if (!ok) spdlog::error("empty-space skipping saves less than half of the texture fetches");
+    return ok ? 0 : -1;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+// compare terrain::gen_light_cache (ray marched) with terrain::gen_light_cache_sweep
+
+#include "types.hxx"
+#include "volumetric_cloud.hxx"
+
+#include <chrono>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+using namespace glm;
+
+// run f, return wall time in ms
+template<typename F> static double timed(F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::info);
+
+    // one voxel per meter, density around 0~0.5 per meter like the hmk4 cloud
+    const int dimx = 96, dimy = 48, dimz = 96;
+
+    auto data = terrain::VolumetricCloudData(dimx, dimy, dimz);
+    data.vectorize_inplace([](float v) { return glm::max(v, 0.f) * 0.05f; });
+
+    vec3 box = vec3(dimx, dimy, dimz);
+    mat4 world2tex = mat4(        //
+        vec4(1 / box.x, 0, 0, 0), //
+        vec4(0, 1 / box.y, 0, 0), //
+        vec4(0, 0, 1 / box.z, 0), //
+        vec4(0, 0, 0, 1)
+    );
+
+    const float max_length = 100.;
+    const int   nb_iter    = 64;
+    const float extinction = 0.1;
+
+    // documented in volumetric_cloud.hxx
+    const double tol_max = 0.1, tol_mean = 0.02;
+    bool         ok      = true;
+
+    std::vector<vec3> light_dirs = {
+        {0., -1., 0.3}, {0.6, -1., -0.2}, {1., -0.1, 0.}, {-0.5, 0.5, 0.7}
+    };
+
+    for (auto light_dir : light_dirs) {
+        for (float sample_rate : {1.f, 2.f}) {
+            terrain::Array3D<float> marched, swept;
+
+            double t_march = timed([&] {
+                marched = terrain::gen_light_cache(
+                    data, world2tex, light_dir, max_length, nb_iter, extinction, sample_rate
+                );
+            });
+            double t_sweep = timed([&] {
+                swept = terrain::gen_light_cache_sweep(
+                    data, world2tex, light_dir, max_length, nb_iter, extinction, sample_rate
+                );
+            });
+
+            auto   shape = marched.shape();
+            int    n     = shape[0] * shape[1] * shape[2];
+            float *a     = (float *)marched.data();
+            float *b     = (float *)swept.data();
+
+            double max_err = 0, sum_err = 0;
+            for (int i = 0; i < n; i++) {
+                double err = glm::abs(a[i] - b[i]);
+                max_err    = glm::max(max_err, err);
+                sum_err += err;
+            }
+
+            spdlog::info(
+                "light ({},{},{}) sample_rate {}: march {:.1f}ms, sweep {:.1f}ms (x{:.1f}), "
+                "|dT| max {:.4f} mean {:.5f}",
+                light_dir.x, light_dir.y, light_dir.z, sample_rate, t_march, t_sweep,
+                t_march / t_sweep, max_err, sum_err / n
+            );
+            ok = ok && max_err < tol_max && sum_err / n <= tol_mean;
+        }
+    }
+    if (!ok) spdlog::error("gen_light_cache_sweep out of tolerance");
+    return ok ? 0 : -1;
+}
\ No newline at end of file
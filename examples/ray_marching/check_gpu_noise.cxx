@@ -0,0 +1,116 @@
+// compare terrain::GpuNoise (both backends, R32F and R16F targets) with add_perlin_tex on the
+// CPU. runs on a hidden window, e.g. on Mesa llvmpipe:
+//     LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./check_gpu_noise
+
+#include "glfw_inst.hxx"
+#include "gpu_noise.hxx"
+#include "texture_objects.hxx"
+#include "types.hxx"
+#include "volumetric_cloud.hxx"
+
+#include <chrono>
+#include <glm/common.hpp>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+using namespace glwrapper;
+
+// run f, return wall time in ms
+template<typename F> static double timed(F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    f();
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+int main() {
+    GlfwInst inst;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    auto window = glfwCreateWindow(64, 64, "check_gpu_noise", NULL, NULL);
+    if (!window) {
+        spdlog::error("check_gpu_noise: failed to create window");
+        return -1;
+    }
+    glfwMakeContextCurrent(window);
+    inst.load_proc();
+    spdlog::set_level(spdlog::level::info);
+    spdlog::info(
+        "{}, GL {}", (const char *)glGetString(GL_RENDERER),
+        (const char *)glGetString(GL_VERSION)
+    );
+
+    // the octaves of VolumetricCloudData's defaults, split in two generate calls
+    const int                         dimx = 64, dimy = 24, dimz = 96;
+    std::vector<terrain::NoiseOctave> octaves = {
+        {8, 114, 8}, {4, 1145, 4}, {2, 11451, 2}, {1, 1919, 1}
+    };
+    float amp_sum = 0;
+    for (auto &o : octaves) {
+        amp_sum += o.amp;
+    }
+
+    terrain::Array3D<float> ref(dimx, dimy, dimz);
+    double                  t_cpu = timed([&] {
+        for (auto &o : octaves) {
+            terrain::add_perlin_tex(ref, o.scale, o.seed, o.amp);
+        }
+    });
+
+    // GPU float ops are not required to round like the CPU; a coordinate off by an ulp moves the
+    // noise by about that much times its gradient. half adds its own rounding
+    const double tol_r32f = 1e-3 * amp_sum, tol_r16f = 1. / 1024;
+
+    bool ok = true;
+    for (auto backend : {terrain::GPU_NOISE_FRAGMENT, terrain::GPU_NOISE_COMPUTE}) {
+        if (backend == terrain::GPU_NOISE_COMPUTE && !terrain::GpuNoise::compute_supported()) {
+            spdlog::warn("check_gpu_noise: no GL 4.3, compute backend skipped");
+            continue;
+        }
+        terrain::GpuNoise noise(backend);
+
+        for (GLenum format : {GL_R32F, GL_R16F}) {
+            TextureObject tex("", 0, TextureParameter("smooth"), format, GL_TEXTURE_3D);
+            tex.from_data(nullptr, dimz, dimy, dimx);
+
+            double t_gpu = timed([&] {
+                noise.generate(tex, dimx, dimy, dimz, octaves, 0, dimx / 2);
+                noise.generate(tex, dimx, dimy, dimz, octaves, dimx / 2);
+                glFinish();
+            });
+
+            std::vector<float> out((size_t)dimx * dimy * dimz);
+            tex.bind();
+            glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, out.data());
+
+            double max_err = 0, mean_err = 0;
+            bool   within  = true;
+            for (int i = 0; i < dimx; i++) {
+                for (int j = 0; j < dimy; j++) {
+                    for (int k = 0; k < dimz; k++) {
+                        double v   = ref.at(i, j, k);
+                        double err = glm::abs(out[((size_t)i * dimy + j) * dimz + k] - v);
+                        double tol = format == GL_R32F
+                                         ? tol_r32f
+                                         : tol_r32f + tol_r16f * glm::max(glm::abs(v), 1.);
+                        max_err    = glm::max(max_err, err);
+                        mean_err += err;
+                        within = within && err <= tol;
+                    }
+                }
+            }
+            mean_err /= (double)dimx * dimy * dimz;
+
+            spdlog::info(
+                "{:8} {}: cpu {:.2f}ms, gpu {:.2f}ms, max |d| {:.3g}, mean |d| {:.3g}",
+                backend == terrain::GPU_NOISE_COMPUTE ? "compute" : "fragment",
+                format == GL_R32F ? "R32F" : "R16F", t_cpu, t_gpu, max_err, mean_err
+            );
+            ok = ok && within && glGetError() == GL_NO_ERROR;
+        }
+    }
+
+    glfwDestroyWindow(window);
+    if (!ok) spdlog::error("check_gpu_noise: GPU noise differs from the CPU generators");
+    return ok ? 0 : -1;
+}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "debug_struct.hxx"
+#include "gpu_noise.hxx"
 #include "parameter_dict.hxx"
 #include "shader_program.hxx"
 #include "sizer.hxx"
@@ -11,7 +12,9 @@
 #include "window.hxx"
 #include "world_view.hxx"
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <glm/fwd.hpp>
 #include <glm/geometric.hpp>
 #include <memory>
@@ -23,6 +26,8 @@
 #define X0 100.
 #define Y0 10.
 #define Z0 100.
+// per frame, for regenerating and uploading the noise volumes
+#define UPLOAD_BUDGET_MS 4.
 
 using namespace glwrapper;
 
@@ -36,12 +41,16 @@ class DrawACloud : public mf::WorldViewBase {
         prog = std::make_shared<ShaderProgram>("shader_vcloud.vs", "shader_vcloud.fs");
 
         for (auto &tex : perlin_noise_tex) {
-            tex = std::make_shared<TextureObject>(
-                "", 0, TextureParameter("smooth"), GL_R32F, GL_TEXTURE_3D
-            );
+            tex = std::make_shared<ProgressiveTexture3D>(TextureParameter("smooth"), GL_R32F);
         }
+        gpu_noise = std::make_shared<terrain::GpuNoise>();
 
+        // the first volume is waited for
         update_cloud_data();
+        for (auto &tex : perlin_noise_tex) {
+            if (tex->pending()) tex->finish();
+        }
+        apply_aabb();
 
         quadvert = std::vector<float>{-1, -1, 1, -1, //
                                       -1, 1,  1, 1};
@@ -64,24 +73,70 @@ class DrawACloud : public mf::WorldViewBase {
         return glm::vec4(get<double>(v1), get<double>(v2), get<double>(v3), get<double>(v4));
     }
 
+    // regenerate the noise: at once on the GPU, else in the background of the next frames, see
+    // upload_cloud_data
     void update_cloud_data() {
         spdlog::debug("MAIN: update_cloud_data");
-        lx   = get<double>("aabb.lx");
-        ly   = get<double>("aabb.ly");
-        lz   = get<double>("aabb.lz");
+        int nx = get<double>("aabb.lx"), ny = get<double>("aabb.ly"), nz = get<double>("aabb.lz");
+
+        if (get<double>("gpu_noise") > 0) {
+            for (int i = 0; i < 4; i++) {
+                float scale = get<double>(fmt::format("scale{}", i + 1));
+                if (!gpu_noise_tex[i] || gpu_noise_dims != std::array<int, 3>{nx, ny, nz}) {
+                    gpu_noise_tex[i] = std::make_shared<TextureObject>(
+                        "", 0, TextureParameter("smooth"), GL_R32F, GL_TEXTURE_3D
+                    );
+                    gpu_noise_tex[i]->from_data(nullptr, nx, ny, nz);
+                }
+                // same volume as gen_perlin_slab below
+                gpu_noise->generate(*gpu_noise_tex[i], nz, ny, nx, {{scale, 114 * i}});
+            }
+            gpu_noise_dims = pending_aabb = {nx, ny, nz};
+            apply_aabb();
+            MY_CHECK_FAIL
+            return;
+        }
+
+        for (int i = 0; i < 4; i++) {
+            float scale     = get<double>(fmt::format("scale{}", i + 1));
+            perlin_noise[i] = terrain::Array3D<float>(nz, ny, nx);
+            perlin_noise_tex[i]->start(nx, ny, nz, [this, i, scale](int z0, int z1) {
+                terrain::gen_perlin_slab(perlin_noise[i], z0, z1, scale, 114 * i);
+                return (const void *)&perlin_noise[i][{z0, 0, 0}];
+            });
+        }
+        pending_aabb = {nx, ny, nz};
+        MY_CHECK_FAIL
+    }
+
+    // generate and upload within the frame budget. the previous volumes are drawn until all four
+    // new ones are complete, then they switch over together
+    void upload_cloud_data() {
+        bool pending = false, ready = true;
+        auto t0      = std::chrono::steady_clock::now();
+        for (auto &tex : perlin_noise_tex) {
+            auto   t1      = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            if (tex->pending()) tex->step(std::max(UPLOAD_BUDGET_MS - elapsed, 0.));
+            pending = pending || tex->pending();
+            ready   = ready && tex->ready();
+        }
+        MY_CHECK_FAIL
+        if (pending || !ready) return;
+        for (auto &tex : perlin_noise_tex) {
+            tex->present();
+        }
+        apply_aabb();
+    }
+
+    void apply_aabb() {
+        lx   = pending_aabb[0];
+        ly   = pending_aabb[1];
+        lz   = pending_aabb[2];
         offs = vec3(-lx, -ly, -lz);
         x0   = vec3(lx, -ly, -lz);
         y0   = vec3(-lx, ly, -lz);
         z0   = vec3(-lx, -ly, lz);
-
-        for (int i = 0; i < 4; i++) {
-            perlin_noise[i] = terrain::gen_perlin_tex(
-                lz, ly, lx, get<double>(fmt::format("scale{}", i + 1)), 114 * i
-            );
-            MY_CHECK_FAIL
-            perlin_noise_tex[i]->from_data((void *)perlin_noise[i].data(), lx, ly, lz, GL_FLOAT);
-            MY_CHECK_FAIL
-        }
     }
 
     void update_args() {
@@ -95,6 +150,7 @@ class DrawACloud : public mf::WorldViewBase {
         spdlog::trace("MAIN: draw {},{},{},{}", cur_rect.x, cur_rect.y, cur_rect.w, cur_rect.h);
 
         update_args();
+        if (get<double>("gpu_noise") <= 0) upload_cloud_data();
 
         MY_CHECK_FAIL
         fbo.clear_color(cur_rect, GL_COLOR_BUFFER_BIT, {0, 0, 0, 0});
@@ -121,7 +177,7 @@ class DrawACloud : public mf::WorldViewBase {
 
         prog->set_value("cloud_world2tex", get_world2tex(offs, x0, y0, z0));
         for (int i = 0; i < 4; i++) {
-            perlin_noise_tex[i]->activate_sampler(prog, fmt::format("perlin_tex{}", i + 1), i);
+            noise_tex(i)->activate_sampler(prog, fmt::format("perlin_tex{}", i + 1), i);
             auto name = fmt::format("amp{}", i + 1);
             prog->set_value(name, (float)get<double>(name));
         }
@@ -149,6 +205,12 @@ class DrawACloud : public mf::WorldViewBase {
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         return false;
     }
+    // the CPU volume until the first one completes after switching from the GPU
+    std::shared_ptr<TextureObject> noise_tex(int i) {
+        auto cpu_tex = perlin_noise_tex[i]->front();
+        return get<double>("gpu_noise") > 0 || !cpu_tex ? gpu_noise_tex[i] : cpu_tex;
+    }
+
     static mat4 get_world2tex(vec3 offs, vec3 x0, vec3 y0, vec3 z0) {
         auto u = glm::vec4(x0 - offs, 0);
         auto v = glm::vec4(y0 - offs, 0);
@@ -157,8 +219,11 @@ class DrawACloud : public mf::WorldViewBase {
         return glm::inverse(M);
     }
 
-    std::array<terrain::Array3D<float>, 4>        perlin_noise;
-    std::array<std::shared_ptr<TextureObject>, 4> perlin_noise_tex;
+    std::array<terrain::Array3D<float>, 4>                perlin_noise;
+    std::array<std::shared_ptr<ProgressiveTexture3D>, 4> perlin_noise_tex;
+    std::shared_ptr<terrain::GpuNoise>                   gpu_noise;
+    std::array<std::shared_ptr<TextureObject>, 4>        gpu_noise_tex;
+    std::array<int, 3>                                   gpu_noise_dims;
 
     std::shared_ptr<ShaderProgram> prog;
 
@@ -166,7 +231,8 @@ class DrawACloud : public mf::WorldViewBase {
     VertexArrayObject  vao;
     VertexBufferObject vbo;
 
-    int  lx, ly, lz;
+    int                lx, ly, lz;
+    std::array<int, 3> pending_aabb;
     vec3 offs, x0, y0, z0, light_dir, light_color;
 
     glm::vec4 phase_parm;
@@ -211,6 +277,7 @@ int main() {
             {"aabb.lz", 100.},        //
             {"light_e", 6.},          //
             {"cursor", 8.},           //
+            {"gpu_noise", 1.},        //
             {"max_length", 20.},      //
         }
     );
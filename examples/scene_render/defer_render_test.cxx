@@ -1,6 +1,7 @@
 #include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "model.hxx"
 #include "parameter_dict.hxx"
 #include "shader_program.hxx"
@@ -57,15 +58,15 @@ class MyModel : public WorldViewBase {
         // pos, norm, color.diff, color.spec
         const GLenum draw_targ[]{
             GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
-        glDrawBuffers(4, draw_targ);
+        GLState::current().draw_buffers(4, draw_targ);
 
         // viewport+clear
-        glViewport(0, 0, 800, 600);
+        GLState::current().viewport(0, 0, 800, 600);
         // choose a diff bkgd
         glClearColor(0, 1, 0, 1);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glEnable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, true);
         MY_CHECK_FAIL
 
         for (const auto &mesh : model_.meshes) {
@@ -77,12 +78,12 @@ class MyModel : public WorldViewBase {
             glDrawElements(GL_TRIANGLES, mesh.indices_.size(), GL_UNSIGNED_INT, 0);
             MY_CHECK_FAIL
         }
-        glDisable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, false);
         MY_CHECK_FAIL
 
         MY_CHECK_FAIL
         g_buffer.unbind();
-        glDrawBuffer(GL_BACK);
+        GLState::current().draw_buffer(GL_BACK);
         MY_CHECK_FAIL
 
         // demonstrate normals of g_buffer
@@ -106,9 +107,9 @@ class MyModel : public WorldViewBase {
             glm::lookAt(light_pos, vec3(0), vec3(0, 1, 0));
 
         shadow_buffer.bind();
-        glViewport(0, 0, shadow_width, shadow_height);
+        GLState::current().viewport(0, 0, shadow_width, shadow_height);
         glClear(GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, true);
 
         for (const auto &mesh : model_.meshes) {
             prog_shade->use();
@@ -119,9 +120,9 @@ class MyModel : public WorldViewBase {
             glDrawElements(GL_TRIANGLES, mesh.indices_.size(), GL_UNSIGNED_INT, 0);
             MY_CHECK_FAIL
         }
-        glDisable(GL_DEPTH_TEST);
+        GLState::current().set_enabled(GL_DEPTH_TEST, false);
         shadow_buffer.unbind();
-        glDrawBuffer(GL_BACK);
+        GLState::current().draw_buffer(GL_BACK);
 
         // demo in log  tex depth
         //  shadow_buffer.tex_depth()->repr(1);
@@ -147,7 +148,7 @@ class MyModel : public WorldViewBase {
         fbo.bind();
 
         MY_CHECK_FAIL
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+        GLState::current().draw_buffer(GL_COLOR_ATTACHMENT0);
         MY_CHECK_FAIL
 
         prog_draw->use();
@@ -6,18 +6,23 @@
 #include "checkfail.hxx"
 #include "config.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
 #include "utils.hxx"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <memory>
+#include <thread>
 
 #include "stb_image_write.h"
 #include <spdlog/spdlog.h>
 
 using glwrapper::BufferObject;
+using glwrapper::GLState;
 using glwrapper::ShaderProgram;
 using glwrapper::TextureObject;
 using glwrapper::TextureParameter;
@@ -30,6 +35,7 @@ std::optional<VertexArrayObject>  DrawableFrame::cp_vao{};
 std::optional<VertexBufferObject> DrawableFrame::cp_vbo{};
 std::optional<BufferObject>       DrawableFrame::cp_ebo{};
 int                               DrawableFrame::nb_inst_ = 0;
+std::unique_ptr<mf::ThreadPool>   DrawableFrame::io_pool_{};
 
 float DrawableFrame::cp_vertices[16] = {
     // pos//tex_uv
@@ -118,6 +124,11 @@ DrawableFrame &DrawableFrame::operator=(DrawableFrame &&o) {
 
 void DrawableFrame::cleanup() {
     MY_CHECK_FAIL
+    // the worker may still read a mapped readback
+    while (!screenshots_.empty()) {
+        poll_screenshots();
+        std::this_thread::yield();
+    }
     nb_inst_--;
     if (nb_inst_ == 0) {
         cp_vao.reset();
@@ -128,6 +139,7 @@ void DrawableFrame::cleanup() {
 }
 
 void DrawableFrame::draw(bool to_frame) {
+    poll_screenshots();
 
     if (to_frame) {
         unbind(); // not necessary. suppose draw target is bound outside
@@ -156,7 +168,7 @@ mf::Rect DrawableFrame::viewport(mf::Rect rect) const {
     // spdlog::debug(log);
 
     validate_rect(rect);
-    glViewport(rect.x, height_ - rect.y - rect.h, rect.w, rect.h);
+    GLState::current().viewport(rect.x, height_ - rect.y - rect.h, rect.w, rect.h);
     MY_CHECK_FAIL
     return mf::Rect(rect.x, height_ - rect.y - rect.h, rect.w, rect.h);
 }
@@ -170,10 +182,11 @@ void DrawableFrame::clear_color(mf::Rect rect, GLenum bits, glm::u8vec4 color) c
     // scissor clear
     rect = get_draw_rect(rect);
 
-    glEnable(GL_SCISSOR_TEST);
-    glScissor(gl_rect.x, gl_rect.y, gl_rect.w, gl_rect.h);
+    auto &state = GLState::current();
+    state.set_enabled(GL_SCISSOR_TEST, true);
+    state.scissor(gl_rect.x, gl_rect.y, gl_rect.w, gl_rect.h);
     glClear(bits);
-    glDisable(GL_SCISSOR_TEST);
+    state.set_enabled(GL_SCISSOR_TEST, false);
     MY_CHECK_FAIL
 }
 
@@ -222,33 +235,55 @@ void DrawableFrame::do_screenshot(mf::Rect rect) {
     rect.w = glm::clamp<int>(rect.w, 0, width_ - rect.x);
     rect.h = glm::clamp<int>(rect.h, 0, height_ - rect.y);
     // spdlog::info("screenshot {},{} on {},{}", rect.w, rect.h, width_, height_);
+    if (rect.w == 0 || rect.h == 0) return;
 
-    // get tex data
-    int  w, h;
-    auto tex_data = color_attachments[0]->get_data(w, h);
-    assert(w == width_ && h == height_);
-    auto tex_data_flip = std::vector<GLubyte>(rect.w * rect.h * 4);
-    // flip
-    for (int i = rect.y; i < rect.h; i++) {
-        for (int j = rect.x; j < rect.w; j++) {
-            for (int k = 0; k < 4; k++) {
-                tex_data_flip[i * rect.w * 4 + j * 4 + k] =
-                    tex_data[(h - 1 - i) * w * 4 + j * 4 + k];
-            }
-        }
-    }
-    // create file
+    // create file, not one a pending screenshot writes either
     std::string fn;
     for (int i = 0; i < 255; i++) {
-        fn = fmt::format("screenshot{}.jpg", i);
-        if (!std::filesystem::exists(fn)) break;
+        fn           = fmt::format("screenshot{}.jpg", i);
+        bool pending = std::any_of(screenshots_.begin(), screenshots_.end(), [&](auto &s) {
+            return s.filename == fn;
+        });
+        if (!std::filesystem::exists(fn) && !pending) break;
+    }
+
+    // rect rows count from the top, gl's from the bottom
+    auto readback = read_async(0, rect.x, height_ - rect.y - rect.h, rect.w, rect.h);
+    screenshots_.push_back({readback, fn, nullptr});
+}
+
+void DrawableFrame::poll_screenshots() {
+    for (auto &s : screenshots_) {
+        if (s.written || !s.readback->ready()) continue;
+
+        auto pixels = static_cast<const GLubyte *>(s.readback->map());
+        int  w      = s.readback->width();
+        int  h      = s.readback->height();
+        auto row    = s.readback->row_size();
+        s.written   = std::make_shared<std::atomic<bool>>(false);
+        if (!io_pool_) io_pool_ = std::make_unique<ThreadPool>(1);
+        io_pool_->push([pixels, w, h, row, fn = s.filename, written = s.written] {
+            // flip, gl rows are bottom first
+            auto flipped = std::vector<GLubyte>(row * h);
+            for (int i = 0; i < h; i++) {
+                std::memcpy(flipped.data() + i * row, pixels + (h - 1 - i) * row, row);
+            }
+            // write image and open
+            if (stbi_write_jpg(fn.c_str(), w, h, 4, flipped.data(), 100)) {
+                std::system(fn.c_str());
+            } else {
+                spdlog::error("screenshot failed: can't write file {}", fn);
+            }
+            *written = true;
+        });
     }
 
-    // write image
-    if (!stbi_write_jpg(fn.c_str(), rect.w, rect.h, 4, tex_data_flip.data(), 100)) {
-        spdlog::error("screenshot failed: can't write file {}", fn);
-        return;
+    // unmapped once written
+    auto done = std::stable_partition(screenshots_.begin(), screenshots_.end(), [](auto &s) {
+        return !(s.written && *s.written);
+    });
+    for (auto it = done; it != screenshots_.end(); it++) {
+        it->readback->unmap();
     }
-    // open
-    std::system(fn.c_str());
+    screenshots_.erase(done, screenshots_.end());
 }
\ No newline at end of file
@@ -5,12 +5,20 @@
 #include "shader.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
+#include "thread_pool.hxx"
 #include "utils.hxx"
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace mf {
     using glwrapper::BufferObject;
     using glwrapper::FrameBufferObject;
+    using glwrapper::PixelReadback;
     using glwrapper::ShaderProgram;
+    using glwrapper::StreamingBuffer;
     using glwrapper::TextureObject;
     using glwrapper::VertexArrayObject;
     using glwrapper::VertexBufferObject;
@@ -54,9 +62,22 @@ namespace mf {
         void validate_rect(mf::Rect rect) const;
 
         // panel-like functions
+
+        /// @brief save rect to screenshot<i>.jpg and open it. the pixels are read back without
+        /// stalling and written by a worker thread, some frames later
         void do_screenshot(mf::Rect rect);
+        /// @brief hand screenshots read back to the worker, release the written ones. from draw()
+        void poll_screenshots();
 
         protected:
+        struct Screenshot {
+            std::shared_ptr<PixelReadback>     readback;
+            std::string                        filename;
+            std::shared_ptr<std::atomic<bool>> written; // set by the worker, null until handed
+        };
+        std::vector<Screenshot> screenshots_;
+
+
         // the output rect relative to screen
         mf::Rect cur_rect_;
 
@@ -65,7 +86,8 @@ namespace mf {
         static std::optional<VertexBufferObject> cp_vbo;
         static std::optional<BufferObject>       cp_ebo;
 
-        static int nb_inst_;
+        static int                         nb_inst_;
+        static std::unique_ptr<ThreadPool> io_pool_; // encodes screenshots
 
         static float                          cp_vertices[16];
         static GLuint                         cp_indices[6];
@@ -1,6 +1,8 @@
 #include "textedit.hxx"
+#include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "config.hxx"
+#include "gl_state.hxx"
 #include "shader_program.hxx"
 #include "stb_truetype.h"
 #include "utils.hxx"
@@ -9,6 +11,7 @@
 #include <algorithm>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <vector>
@@ -17,7 +20,9 @@
 #include <glm/fwd.hpp>
 #include <spdlog/spdlog.h>
 
+using glwrapper::GLState;
 using glwrapper::ShaderProgram;
+using glwrapper::StreamingBuffer;
 using mf::AsciiTex;
 using mf::StaticText;
 using mf::TextCtrl;
@@ -223,16 +228,19 @@ void TextEdit::delete_range() {
 
 TextCtrl::TextCtrl(std::string text, GLuint w, GLuint h, GLuint fontsize, mf::FLAGS style) :
     WidgetBase(w, std::max(h, fontsize), {}, style), fontsize_(fontsize), xtext(0), ytext(0),
-    ebo(GL_ELEMENT_ARRAY_BUFFER), colors{
-                                      DEFAULT_TC_BKGD, DEFAULT_TC_FRGD,        //
-                                      DEFAULT_TC_BKGD_INV, DEFAULT_TC_FRGD_INV //
-                                  } {
+    colors{
+        DEFAULT_TC_BKGD, DEFAULT_TC_FRGD,        //
+        DEFAULT_TC_BKGD_INV, DEFAULT_TC_FRGD_INV //
+    } {
     if (!tex_) {
         tex_ = std::make_shared<AsciiTex>(fontsize);
     }
     if (!prog) {
         prog = std::make_shared<ShaderProgram>(vshader, fshader);
     }
+    if (!stream_) {
+        stream_ = std::make_shared<StreamingBuffer>(stream_region_size);
+    }
     editor.on_insert(text);
 
     focus_ = false;
@@ -242,9 +250,10 @@ TextCtrl::TextCtrl(std::string text, GLuint w, GLuint h, GLuint fontsize, mf::FL
 TextCtrl::~TextCtrl() { spdlog::debug("TextCtrl::~TextCtrl()"); }
 
 // statics
-std::shared_ptr<AsciiTex>      TextCtrl::tex_{};
-std::shared_ptr<ShaderProgram> TextCtrl::prog{};
-std::string                    TextCtrl::vshader = "\
+std::shared_ptr<AsciiTex>        TextCtrl::tex_{};
+std::shared_ptr<ShaderProgram>   TextCtrl::prog{};
+std::shared_ptr<StreamingBuffer> TextCtrl::stream_{};
+std::string                      TextCtrl::vshader = "\
 #version 330 core \n\
 layout (location=0) in int x;\n\
 layout (location=1) in int y;\n\
@@ -273,7 +282,7 @@ void main(){\n\
     gl_Position=vec4(rx,ry,0,1);\n\
 }    \n\
 ";
-std::string                    TextCtrl::fshader = "\
+std::string                      TextCtrl::fshader = "\
 #version 330 core   \n\
 in vec2 tex_coord;\n\
 in vec4 frcolor;\n\
@@ -297,32 +306,36 @@ bool TextCtrl::draw(DrawableFrame &fbo) {
 
     if (!focus_) std::fill(mask.begin(), mask.end(), 0);
 
-    ebo_data.clear();
-    vbo_data.clear();
+    // 4 vertices and 6 indices a char, written into one range of the stream
+    size_t vbo_size = len * 4 * 6 * sizeof(int);
+    size_t ebo_size = len * 6 * sizeof(int);
+    auto   range    = stream_->alloc(vbo_size + ebo_size);
+    auto   vertices = static_cast<int *>(range.data);
+    auto   indices  = vertices + vbo_size / sizeof(int);
     for (int i = 0; i < len; i++) {
-        vbo_data.insert(vbo_data.end(), {i, 0, 0, 0, static_cast<int>(str[i]), mask[i]});
-        vbo_data.insert(vbo_data.end(), {i + 1, 0, 1, 0, static_cast<int>(str[i]), mask[i]});
-        vbo_data.insert(vbo_data.end(), {i, 1, 0, 1, static_cast<int>(str[i]), mask[i]});
-        vbo_data.insert(vbo_data.end(), {i + 1, 1, 1, 1, static_cast<int>(str[i]), mask[i]});
-        ebo_data.insert(
-            ebo_data.end(), {4 * i, 4 * i + 1, 4 * i + 2, 4 * i + 3, 4 * i + 2, 4 * i + 1}
-        );
+        int c        = static_cast<int>(str[i]);
+        int m        = mask[i];
+        int quad[24] = {
+            i, 0, 0, 0, c, m, i + 1, 0, 1, 0, c, m, //
+            i, 1, 0, 1, c, m, i + 1, 1, 1, 1, c, m  //
+        };
+        int tris[6]  = {4 * i, 4 * i + 1, 4 * i + 2, 4 * i + 3, 4 * i + 2, 4 * i + 1};
+        std::memcpy(vertices + 24 * i, quad, sizeof(quad));
+        std::memcpy(indices + 6 * i, tris, sizeof(tris));
     }
-    // exit(-1);
+    stream_->flush();
 
     // set attr
+    auto at = [&](size_t i) { return (void *)(range.offset + i * sizeof(int)); };
     vao.bind();
-    vbo.bind();
-    vbo.SetBufferData(vbo_data.size() * sizeof(int), vbo_data.data());
-    vbo.SetAttribIPointer(0, 1, GL_INT, 6 * sizeof(int), 0);
-    vbo.SetAttribIPointer(1, 1, GL_INT, 6 * sizeof(int), (void *)sizeof(int));
-    vbo.SetAttribIPointer(2, 1, GL_INT, 6 * sizeof(int), (void *)(sizeof(int) * 2));
-    vbo.SetAttribIPointer(3, 1, GL_INT, 6 * sizeof(int), (void *)(sizeof(int) * 3));
-    vbo.SetAttribIPointer(4, 1, GL_INT, 6 * sizeof(int), (void *)(sizeof(int) * 4));
-    vbo.SetAttribIPointer(5, 1, GL_INT, 6 * sizeof(int), (void *)(sizeof(int) * 5));
+    stream_->SetAttribIPointer(0, 1, GL_INT, 6 * sizeof(int), at(0));
+    stream_->SetAttribIPointer(1, 1, GL_INT, 6 * sizeof(int), at(1));
+    stream_->SetAttribIPointer(2, 1, GL_INT, 6 * sizeof(int), at(2));
+    stream_->SetAttribIPointer(3, 1, GL_INT, 6 * sizeof(int), at(3));
+    stream_->SetAttribIPointer(4, 1, GL_INT, 6 * sizeof(int), at(4));
+    stream_->SetAttribIPointer(5, 1, GL_INT, 6 * sizeof(int), at(5));
     MY_CHECK_FAIL
-    ebo.bind();
-    ebo.SetBufferData(ebo_data.size() * sizeof(int), ebo_data.data());
+    GLState::current().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, stream_->ID());
     MY_CHECK_FAIL
     // vao.unbind();
     prog->use();
@@ -345,7 +358,7 @@ bool TextCtrl::draw(DrawableFrame &fbo) {
     MY_CHECK_FAIL
     tex_->activate_sampler(prog, "texture0", 0);
     MY_CHECK_FAIL
-    glDrawElements(GL_TRIANGLES, ebo_data.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, 6 * len, GL_UNSIGNED_INT, at(vbo_size / sizeof(int)));
     MY_CHECK_FAIL
     vao.unbind();
     fbo.unbind();
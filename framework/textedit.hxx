@@ -83,12 +83,8 @@ namespace mf {
         bool draw(DrawableFrame &fbo) override;
         void event_at(EVENT evt, Pos at, EVENT_PARM parameter) override;
 
-        // buffer
+        // buffer, vertices (x,y,u,v,color_type,mask) and indices are streamed through stream_
         VertexArrayObject      vao;
-        VertexBufferObject     vbo;
-        std::vector<int>       vbo_data; //(x,y,u,v,color_type)
-        BufferObject           ebo;
-        std::vector<int>       ebo_data;
         std::vector<glm::vec4> colors; //[<bkgd>,<frgd>,]+
 
         // text infos and attrs
@@ -122,6 +118,9 @@ namespace mf {
         static std::string                    vshader;
         static std::string                    fshader;
         static std::shared_ptr<ShaderProgram> prog;
+        // shared by all text controls, regions grow for longer texts
+        static std::shared_ptr<StreamingBuffer> stream_;
+        constexpr static size_t                 stream_region_size = 1 << 16;
     };
 
     class StaticText : public TextCtrl {
@@ -2,7 +2,9 @@
 #include "buffer_objects.hxx"
 #include "checkfail.hxx"
 #include "drawable_frame.hxx"
+#include "gl_state.hxx"
 #include "glfw_inst.hxx"
+#include "texture_objects.hxx"
 #include "utils.hxx"
 #include "widget.hxx"
 
@@ -87,6 +89,7 @@ void Window::on_resize() {
 void Window::draw() {
     // spdlog::debug("Window::draw");
     MY_CHECK_FAIL
+    glwrapper::TextureLoader::shared().poll();
     if (root_) {
         // spdlog::debug("drawing root_...");
         fbo_->bind();
@@ -96,7 +99,7 @@ void Window::draw() {
         fbo_->unbind();
     }
 
-    glViewport(0, 0, width_, height_);
+    glwrapper::GLState::current().viewport(0, 0, width_, height_);
     fbo_->draw();
     MY_CHECK_FAIL
 
@@ -1,33 +1,50 @@
 #include "buffer_objects.hxx"
 
 #include "checkfail.hxx"
+#include "gl_state.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
+#include <utility>
 
 #include <spdlog/spdlog.h>
 
 using glwrapper::BufferObject;
+using glwrapper::GLState;
 using glwrapper::FrameBufferObject;
+using glwrapper::PixelReadback;
+using glwrapper::Std140Layout;
+using glwrapper::StreamingBuffer;
+using glwrapper::UniformBufferObject;
 using glwrapper::VertexArrayObject;
 using glwrapper::VertexBufferObject;
 
 BufferObject::BufferObject(GLenum buffer_type) : buffer_type_(buffer_type) {
-    glGenBuffers(1, &ID_);
+    if (GLState::current().dsa()) {
+        glCreateBuffers(1, &ID_);
+    } else {
+        glGenBuffers(1, &ID_);
+    }
     spdlog::debug("BufferObject::BufferObject(id={})", ID_);
 }
 
-BufferObject::BufferObject(BufferObject &&o) : buffer_type_(o.buffer_type_), ID_(o.ID_) {
+BufferObject::BufferObject(BufferObject &&o) :
+    buffer_type_(o.buffer_type_), ID_(o.ID_), size_(o.size_), usage_(o.usage_),
+    immutable_(o.immutable_) {
     o.ID_ = 0;
 }
 
 void BufferObject::operator=(BufferObject &&o) {
     if (this != &o) {
         cleanup();
-        ID_   = o.ID_;
-        o.ID_ = 0;
+        ID_        = o.ID_;
+        size_      = o.size_;
+        usage_     = o.usage_;
+        immutable_ = o.immutable_;
+        o.ID_      = 0;
     }
 }
 
@@ -37,13 +54,14 @@ void BufferObject::cleanup() {
 
     spdlog::debug("BufferObject::cleanup(type={},id={})", buffer_type_, ID_);
     validate();
+    GLState::current().forget_buffer(ID_);
     glDeleteBuffers(1, &ID_);
     MY_CHECK_FAIL
 }
 
 void BufferObject::bind() const {
     MY_CHECK_FAIL
-    glBindBuffer(buffer_type_, ID_);
+    GLState::current().bind_buffer(buffer_type_, ID_);
 }
 
 void BufferObject::validate() const {
@@ -54,8 +72,54 @@ void BufferObject::validate() const {
 }
 
 void BufferObject::SetBufferData(size_t size, const void *data, GLenum usage) {
+    // bound either way, callers rely on e.g. element arrays joining the bound vertex array
     bind();
-    glBufferData(buffer_type(), size, data, usage);
+    if (!GLState::current().dsa()) {
+        glBufferData(buffer_type(), size, data, usage);
+        return;
+    }
+
+    if (immutable_ || (size <= size_ && usage == usage_)) {
+        if (size > size_) {
+            spdlog::error("BufferObject::SetBufferData: {} bytes over storage of {}", size, size_);
+            exit(-1);
+        }
+        bool is_static = usage == GL_STATIC_DRAW || usage == GL_STATIC_READ ||
+                         usage == GL_STATIC_COPY;
+        // stream and dynamic stores may still be read by queued draws: orphan them first
+        if (!immutable_ && !is_static) glNamedBufferData(ID_, size_, nullptr, usage_);
+        if (data && size > 0) glNamedBufferSubData(ID_, 0, size, data);
+    } else {
+        glNamedBufferData(ID_, size, data, usage);
+        size_  = size;
+        usage_ = usage;
+    }
+    MY_CHECK_FAIL
+}
+
+void BufferObject::SetBufferStorage(size_t size, const void *data, GLbitfield flags) {
+    if (!GLState::current().dsa()) {
+        SetBufferData(size, data, GL_DYNAMIC_DRAW);
+        return;
+    }
+    if (immutable_ || size_ > 0) {
+        spdlog::error("BufferObject::SetBufferStorage: buffer(id={}) already allocated", ID_);
+        exit(-1);
+    }
+    glNamedBufferStorage(ID_, size, data, flags);
+    size_      = size;
+    immutable_ = true;
+    MY_CHECK_FAIL
+}
+
+void BufferObject::SetBufferSubData(size_t offset, size_t size, const void *data) {
+    if (GLState::current().dsa()) {
+        glNamedBufferSubData(ID_, offset, size, data);
+    } else {
+        bind();
+        glBufferSubData(buffer_type(), offset, size, data);
+    }
+    MY_CHECK_FAIL
 }
 
 // vertex buffer object
@@ -87,6 +151,225 @@ void VertexBufferObject::SetAttribIPointer(
     glEnableVertexAttribArray(index);
 }
 
+// uniform buffer object
+
+size_t Std140Layout::place(size_t alignment, size_t size) {
+    size_t offset = (size_ + alignment - 1) / alignment * alignment;
+    size_         = offset + size;
+    return offset;
+}
+
+size_t Std140Layout::add_struct(const Std140Layout &member, int count) {
+    // structs and array elements are padded to vec4, so the next member is too
+    size_t stride = (member.size() + 15) / 16 * 16;
+    return place(16, stride * std::max(count, 1));
+}
+
+UniformBufferObject::UniformBufferObject(std::string block, GLuint binding, size_t size) :
+    BufferObject(GL_UNIFORM_BUFFER), block_(std::move(block)), binding_(binding),
+    staging_((size + 15) / 16 * 16) {
+    SetBufferStorage(staging_.size(), nullptr);
+    GLState::current().bind_buffer_base(GL_UNIFORM_BUFFER, binding_, ID_);
+    ShaderProgram::bind_uniform_block(block_, binding_);
+    MY_CHECK_FAIL
+}
+
+void UniformBufferObject::upload() {
+    SetBufferSubData(0, staging_.size(), staging_.data());
+    GLState::current().bind_buffer_base(GL_UNIFORM_BUFFER, binding_, ID_);
+    MY_CHECK_FAIL
+}
+
+// streaming buffer
+
+StreamingBuffer::StreamingBuffer(size_t region_size, int nb_regions) :
+    region_size_(std::max<size_t>(region_size, 1)), nb_regions_(std::max(nb_regions, 1)),
+    fences_(nb_regions_) {
+    allocate();
+}
+
+void StreamingBuffer::allocate() {
+    size_t total = region_size_ * nb_regions_;
+    bind();
+    if (GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, total, nullptr, flags);
+        mapped_ = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, total, flags);
+        if (!mapped_) {
+            spdlog::error("StreamingBuffer: can't map buffer(id={})", ID_);
+            exit(-1);
+        }
+        immutable_ = true;
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, total, nullptr, GL_STREAM_DRAW);
+        staging_.resize(total);
+    }
+    size_ = total;
+    MY_CHECK_FAIL
+}
+
+StreamingBuffer::~StreamingBuffer() {
+    for (auto fence : fences_) {
+        if (fence) glDeleteSync(fence);
+    }
+    if (mapped_ && ID_ != 0) {
+        bind();
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+}
+
+StreamingBuffer::Range StreamingBuffer::alloc(size_t size, size_t alignment) {
+    if (size > region_size_) grow(size);
+    size_t start = (head_ + alignment - 1) / alignment * alignment;
+    if (start + size > region_size_) {
+        next_region();
+        start = 0;
+    }
+    head_         = start + size;
+    size_t offset = region_ * region_size_ + start;
+    return {(mapped_ ? mapped_ : staging_.data()) + offset, offset};
+}
+
+void StreamingBuffer::flush() {
+    // coherent mapping, nothing to do
+    size_t end = region_ * region_size_ + head_;
+    if (mapped_ || flushed_ >= end) return;
+    bind();
+    glBufferSubData(GL_ARRAY_BUFFER, flushed_, end - flushed_, staging_.data() + flushed_);
+    flushed_ = end;
+}
+
+void StreamingBuffer::next_region() {
+    flush();
+    if (mapped_) fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    region_ = (region_ + 1) % nb_regions_;
+    head_   = 0;
+    if (mapped_ && fences_[region_]) {
+        // still read by draws from the last time around
+        GLenum status = glClientWaitSync(fences_[region_], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            if (!stalled_) {
+                spdlog::warn(
+                    "StreamingBuffer: waiting for the GPU on region {} of buffer(id={}), "
+                    "consider more regions (logged once)",
+                    region_, ID_
+                );
+            }
+            stalled_ = true;
+            status   = glClientWaitSync(fences_[region_], 0, GL_TIMEOUT_IGNORED);
+        }
+        if (status == GL_WAIT_FAILED) {
+            spdlog::error("StreamingBuffer: wait on region {} failed", region_);
+            exit(-1);
+        }
+        glDeleteSync(fences_[region_]);
+        fences_[region_] = nullptr;
+    } else if (!mapped_ && region_ == 0) {
+        // new storage for the next round, the old one stays with the draws reading it
+        bind();
+        glBufferData(GL_ARRAY_BUFFER, size_, nullptr, GL_STREAM_DRAW);
+    }
+    flushed_ = region_ * region_size_;
+}
+
+void StreamingBuffer::grow(size_t size) {
+    size_t region_size = region_size_;
+    while (region_size < size) region_size *= 2;
+    spdlog::info(
+        "StreamingBuffer: {} bytes range, regions grow from {} to {} bytes", size, region_size_,
+        region_size
+    );
+
+    flush();
+    for (auto &fence : fences_) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (mapped_) {
+        bind();
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        mapped_ = nullptr;
+    }
+    // a new buffer: draws already queued keep reading the old storage until it is released
+    BufferObject::operator=(BufferObject(GL_ARRAY_BUFFER));
+    region_size_ = region_size;
+    region_      = 0;
+    head_        = 0;
+    flushed_     = 0;
+    allocate();
+}
+
+// pixel readback
+
+namespace {
+    size_t pixel_size(GLenum format, GLenum type) {
+        size_t nb_components = 4;
+        switch (format) {
+            case GL_RED:
+            case GL_DEPTH_COMPONENT: nb_components = 1; break;
+            case GL_RG: nb_components = 2; break;
+            case GL_RGB:
+            case GL_BGR: nb_components = 3; break;
+        }
+        switch (type) {
+            case GL_UNSIGNED_BYTE:
+            case GL_BYTE: return nb_components;
+            case GL_UNSIGNED_SHORT:
+            case GL_SHORT:
+            case GL_HALF_FLOAT: return nb_components * 2;
+            default: return nb_components * 4;
+        }
+    }
+} // namespace
+
+PixelReadback::PixelReadback(int x, int y, int w, int h, GLenum format, GLenum type) :
+    BufferObject(GL_PIXEL_PACK_BUFFER), w_(w), h_(h), row_size_(w * pixel_size(format, type)) {
+    bind();
+    glBufferData(GL_PIXEL_PACK_BUFFER, row_size_ * h_, nullptr, GL_STREAM_READ);
+    GLState::current().pixel_store(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(x, y, w, h, format, type, nullptr);
+    fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // client memory reads elsewhere must not land in the buffer
+    GLState::current().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    MY_CHECK_FAIL
+}
+
+PixelReadback::~PixelReadback() {
+    if (fence_) glDeleteSync(fence_);
+    // the buffer is unmapped with it
+}
+
+bool PixelReadback::ready() {
+    if (!fence_) return true;
+    if (glClientWaitSync(fence_, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+    glDeleteSync(fence_);
+    fence_ = nullptr;
+    return true;
+}
+
+const void *PixelReadback::map() {
+    if (mapped_) return mapped_;
+    while (fence_ && !ready()) {
+        glClientWaitSync(fence_, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+    bind();
+    mapped_ = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, row_size_ * h_, GL_MAP_READ_BIT);
+    GLState::current().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    MY_CHECK_FAIL
+    return mapped_;
+}
+
+void PixelReadback::unmap() {
+    if (!mapped_) return;
+    bind();
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    GLState::current().bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+    mapped_ = nullptr;
+}
+
 // vertex array object
 
 VertexArrayObject::VertexArrayObject() { glGenVertexArrays(1, &ID_); }
@@ -104,12 +387,13 @@ void VertexArrayObject::operator=(VertexArrayObject &&o) {
 void VertexArrayObject::cleanup() {
     MY_CHECK_FAIL
     if (ID_ == 0) return;
+    GLState::current().forget_vertex_array(ID_);
     glDeleteVertexArrays(1, &ID_);
 }
 
 void VertexArrayObject::bind() const {
     MY_CHECK_FAIL
-    glBindVertexArray(ID_);
+    GLState::current().bind_vertex_array(ID_);
 }
 
 // framebuffer
@@ -140,7 +424,7 @@ FrameBufferObject::FrameBufferObject(
             color_attachments.push_back(tex);
         }
     } else {
-        glDrawBuffer(GL_NONE);
+        GLState::current().draw_buffer(GL_NONE);
         glReadBuffer(GL_NONE);
     }
 
@@ -175,6 +459,7 @@ void FrameBufferObject::cleanup() {
     if (ID_ == 0) return;
 
     spdlog::info("FrameBufferObject::~FrameBufferObject (id={})", ID_);
+    GLState::current().forget_framebuffer(ID_);
     glDeleteFramebuffers(1, &ID_);
     MY_CHECK_FAIL
 
@@ -201,11 +486,13 @@ void FrameBufferObject::attach_textures() const {
     bind();
     for (int i = 0; i < color_attachments.size(); i++) {
         assert((bool)color_attachments[i]);
+        color_attachments[i]->attached_ = true;
         glFramebufferTexture2D(
             GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, color_attachments[i]->ID(), 0
         );
     }
     if (tex_depth_) {
+        tex_depth_->attached_ = true;
         glFramebufferTexture2D(
             GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex_depth_->ID(), 0
         );
@@ -213,6 +500,14 @@ void FrameBufferObject::attach_textures() const {
     validate();
 }
 
+std::shared_ptr<PixelReadback> FrameBufferObject::read_async(
+    int i, int x, int y, int w, int h, GLenum format, GLenum type
+) const {
+    bind();
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+    return std::make_shared<PixelReadback>(x, y, w, h, format, type);
+}
+
 void FrameBufferObject::validate() const {
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         spdlog::error("framebuffer incomplete");
@@ -222,5 +517,5 @@ void FrameBufferObject::validate() const {
 
 void FrameBufferObject::bind() const {
     MY_CHECK_FAIL
-    glBindFramebuffer(GL_FRAMEBUFFER, ID_);
+    GLState::current().bind_framebuffer(ID_);
 }
@@ -1,13 +1,16 @@
 #pragma once
 
 #include "config.hxx"
+#include "gl_state.hxx"
 #include "shader_program.hxx"
 #include "texture_objects.hxx"
 
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <string>
+#include <utility>
 
 #include <glm/glm.hpp>
 #include <spdlog/spdlog.h>
@@ -43,19 +46,34 @@ namespace glwrapper {
         ///@brief wrapper for glIsBuffer, abort if failed
         void validate() const;
 
-        ///@brief wrapper for glBufferData
+        ///@brief wrapper for glBufferData, binds the buffer. with GLState::dsa() data that fits
+        /// the store (of the same usage) is written in place, it is reallocated only to grow.
+        /// stream and dynamic stores are orphaned before the write
         ///@param size size of data in bytes
         ///@param data pointer to data
         ///@param usage buffer usage, default to GL_STATIC_DRAW
         void SetBufferData(size_t size, const void *data, GLenum usage = GL_STATIC_DRAW);
+        ///@brief wrapper for glNamedBufferStorage, a store of fixed size that SetBufferData and
+        /// SetBufferSubData then update. glBufferData without dsa
+        ///@param flags e.g. GL_DYNAMIC_STORAGE_BIT to allow updates
+        void SetBufferStorage(
+            size_t size, const void *data, GLbitfield flags = GL_DYNAMIC_STORAGE_BIT
+        );
+        ///@brief wrapper for glBufferSubData, within the allocated store
+        void SetBufferSubData(size_t offset, size_t size, const void *data);
 
         // readonly's
         inline auto buffer_type() { return buffer_type_; };
         inline auto ID() { return ID_; };
+        /// @brief allocated bytes
+        inline auto capacity() { return size_; };
 
         protected:
         GLenum buffer_type_;
         GLuint ID_;
+        size_t size_      = 0;
+        GLenum usage_     = GL_NONE;
+        bool   immutable_ = false;
     };
 
     class VertexBufferObject : public BufferObject {
@@ -79,6 +97,137 @@ namespace glwrapper {
         );
     };
 
+    /// @brief std140 offsets of a uniform block's members, added in declaration order, e.g.
+    /// add<mat4>(), add<vec3>(), add<float>() give 0, 64, 76
+    class Std140Layout {
+        public:
+        /// @brief offset of the next member of type T (int, float, vec2-4, mat2-4), of an array
+        /// of count T if count > 0
+        template<typename T> size_t add(int count = 0);
+        /// @brief offset of the next member of struct type, member being its own layout
+        size_t add_struct(const Std140Layout &member, int count = 0);
+
+        /// @brief block size so far, as GL_UNIFORM_BLOCK_DATA_SIZE reports it
+        inline size_t size() const { return size_; }
+
+        /// @brief std140 base alignment and size of T
+        template<typename T> static constexpr size_t alignment();
+        template<typename T> static constexpr size_t size_of();
+        template<typename T> static constexpr int    columns() {
+            return sizeof(T) / sizeof(std::declval<T>()[0]);
+        }
+
+        protected:
+        size_t size_ = 0;
+
+        size_t place(size_t alignment, size_t size);
+    };
+
+    /// @brief GL_UNIFORM_BUFFER holding one uniform block, staged on the CPU and uploaded at once.
+    /// every ShaderProgram declaring the block is bound to it by name, see
+    /// ShaderProgram::bind_uniform_block
+    class UniformBufferObject : public BufferObject {
+        public:
+        /// @param block name of the block in the shaders
+        /// @param binding uniform buffer binding point
+        /// @param size block size, e.g. Std140Layout::size()
+        UniformBufferObject(std::string block, GLuint binding, size_t size);
+
+        /// @brief stage value at offset, e.g. from Std140Layout::add<T>. matrices are written
+        /// column by column at the std140 stride
+        template<typename T> void set(size_t offset, const T &value);
+        /// @brief stage count elements of an array at offset
+        template<typename T> void set(size_t offset, const T *values, int count);
+
+        /// @brief glBufferSubData of the staged block, and glBindBufferBase to its binding point
+        void upload();
+
+        // readonly's
+        inline const auto &block() const { return block_; }
+        inline auto        binding() const { return binding_; }
+        inline auto        size() const { return staging_.size(); }
+
+        protected:
+        std::string                block_;
+        GLuint                     binding_;
+        std::vector<unsigned char> staging_;
+    };
+
+    /// @brief vertex (and index) data rewritten every frame, e.g. text quads, streamed through
+    /// one buffer split into nb_regions regions. alloc() hands out a range of the current region
+    /// that is written through its pointer, then drawn from at its offset after flush(). a full
+    /// region is fenced and the next one taken, waiting only if the GPU still reads it. with GL
+    /// 4.4 the buffer is mapped once, persistently; otherwise ranges are written to a staging
+    /// copy, uploaded by flush(), and the buffer is orphaned when the ring wraps around.
+    /// ranges are drawn right away, they are overwritten once the ring comes back around. a range
+    /// larger than a region grows the regions, on a new buffer: re-query ID() after alloc()
+    class StreamingBuffer : public VertexBufferObject {
+        public:
+        struct Range {
+            void  *data;
+            size_t offset; // in the buffer, for attribute pointers and index offsets
+        };
+
+        StreamingBuffer(size_t region_size, int nb_regions = 3);
+        StreamingBuffer(const StreamingBuffer &) = delete;
+        ~StreamingBuffer();
+
+        /// @brief size bytes at an offset aligned to alignment. over region_size, the regions
+        /// are regrown first, leaving the earlier ranges in the old buffer
+        Range alloc(size_t size, size_t alignment = 16);
+        /// @brief make the ranges written so far visible to GL, before drawing from them
+        void flush();
+        /// @brief fence the current region and move to the next one, e.g. once per frame
+        void next_region();
+
+        // readonly's
+        inline bool persistent() const { return mapped_ != nullptr; }
+
+        protected:
+        size_t                     region_size_;
+        int                        nb_regions_;
+        int                        region_  = 0;
+        size_t                     head_    = 0; // in the current region
+        size_t                     flushed_ = 0; // in the buffer, staging up to it is uploaded
+        unsigned char             *mapped_  = nullptr;
+        std::vector<unsigned char> staging_;
+        std::vector<GLsync>        fences_;
+        bool                       stalled_ = false; // waited on a fence, logged once
+
+        void allocate();
+        void grow(size_t size);
+    };
+
+    /// @brief glReadPixels into a GL_PIXEL_PACK_BUFFER behind a fence: queued without waiting for
+    /// the GPU, polled with ready() on later frames, then read in place through map()
+    class PixelReadback : public BufferObject {
+        public:
+        /// @brief queue the read of (x, y, w, h) of the bound read framebuffer, GL origin
+        PixelReadback(
+            int x, int y, int w, int h, GLenum format = GL_RGBA, GLenum type = GL_UNSIGNED_BYTE
+        );
+        PixelReadback(const PixelReadback &) = delete;
+        ~PixelReadback();
+
+        /// @brief the GPU has written the pixels, never waits
+        bool ready();
+        /// @brief the pixels, bottom row first and tightly packed. waits if not ready(); valid
+        /// until unmap(), also from other threads
+        const void *map();
+        void        unmap();
+
+        // readonly's
+        inline auto width() const { return w_; }
+        inline auto height() const { return h_; }
+        inline auto row_size() const { return row_size_; }
+
+        protected:
+        int    w_, h_;
+        size_t row_size_;
+        GLsync fence_  = nullptr;
+        void  *mapped_ = nullptr;
+    };
+
     class VertexArrayObject {
         public:
         VertexArrayObject();
@@ -89,7 +238,7 @@ namespace glwrapper {
         void cleanup();
 
         void bind() const;
-        void inline unbind() const { glBindVertexArray(0); }
+        void inline unbind() const { GLState::current().bind_vertex_array(0); }
 
         private:
         GLuint ID_;
@@ -113,7 +262,13 @@ namespace glwrapper {
         void validate() const;
 
         void bind() const;
-        void inline unbind() const { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+        void inline unbind() const { GLState::current().bind_framebuffer(0); }
+
+        /// @brief asynchronous glReadPixels of color attachment i, see PixelReadback
+        std::shared_ptr<PixelReadback> read_async(
+            int i, int x, int y, int w, int h, GLenum format = GL_RGBA,
+            GLenum type = GL_UNSIGNED_BYTE
+        ) const;
 
         // readonly's
         inline auto tex0() const { return color_attachments[0]; } // not necessary
@@ -133,6 +288,65 @@ namespace glwrapper {
         GLuint height_;
     };
 
+    template<typename T> constexpr size_t Std140Layout::alignment() {
+        if constexpr (is_same_v<T, int> || is_same_v<T, unsigned int> || is_same_v<T, float>) {
+            return 4;
+        } else if constexpr (is_same_v<T, vec2>) {
+            return 8;
+        } else if constexpr (is_same_v<T, vec3> || is_same_v<T, vec4>) {
+            return 16;
+        } else {
+            static_assert(
+                is_same_v<T, mat2> || is_same_v<T, mat3> || is_same_v<T, mat4>, "T not supported"
+            );
+            // columns are array elements: vec4 aligned
+            return 16;
+        }
+    }
+
+    template<typename T> constexpr size_t Std140Layout::size_of() {
+        if constexpr (is_same_v<T, vec3>) {
+            return 12;
+        } else if constexpr (is_same_v<T, mat2> || is_same_v<T, mat3> || is_same_v<T, mat4>) {
+            return columns<T>() * 16;
+        } else {
+            return sizeof(T);
+        }
+    }
+
+    template<typename T> size_t Std140Layout::add(int count) {
+        if (count <= 0) return place(alignment<T>(), size_of<T>());
+        // array elements are padded to vec4
+        size_t stride = (size_of<T>() + 15) / 16 * 16;
+        return place(16, stride * count);
+    }
+
+    template<typename T> void UniformBufferObject::set(size_t offset, const T &value) {
+        constexpr size_t size = Std140Layout::size_of<T>();
+        if (offset + size > staging_.size()) {
+            spdlog::error(
+                "uniform block {}: {} bytes at {} past its size {}", block_, size, offset,
+                staging_.size()
+            );
+            return;
+        }
+        if constexpr (is_same_v<T, mat2> || is_same_v<T, mat3>) {
+            for (int c = 0; c < Std140Layout::columns<T>(); c++) {
+                std::memcpy(&staging_[offset + 16 * c], &value[c], sizeof(value[c]));
+            }
+        } else {
+            std::memcpy(&staging_[offset], &value, sizeof(T));
+        }
+    }
+
+    template<typename T>
+    void UniformBufferObject::set(size_t offset, const T *values, int count) {
+        size_t stride = (Std140Layout::size_of<T>() + 15) / 16 * 16;
+        for (int i = 0; i < count; i++) {
+            set(offset + stride * i, values[i]);
+        }
+    }
+
 } // namespace glwrapper
 
 ///@}
@@ -0,0 +1,255 @@
+#include "gl_state.hxx"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#ifndef __gl_h_
+    #include <glad/glad.h>
+#endif
+#include <GLFW/glfw3.h>
+
+using glwrapper::GLState;
+
+GLState &GLState::current() {
+    // one per glfw context, looked up again only when the thread switches contexts
+    thread_local GLFWwindow *last_context = nullptr;
+    thread_local GLState    *last_state   = nullptr;
+
+    auto context = glfwGetCurrentContext();
+    if (last_state && context == last_context) return *last_state;
+
+    // never freed: static wrappers (e.g. shared programs) forget their names on exit
+    static auto *mutex  = new std::mutex;
+    static auto *states = new std::map<GLFWwindow *, std::unique_ptr<GLState>>;
+    std::lock_guard<std::mutex> lock(*mutex);
+
+    auto &state = (*states)[context];
+    if (!state) state.reset(new GLState());
+    last_context = context;
+    last_state   = state.get();
+    return *state;
+}
+
+GLState::GLState() { invalidate(); }
+
+void GLState::invalidate() {
+    program_      = unknown;
+    vertex_array_ = unknown;
+    framebuffer_  = unknown;
+    active_unit_  = unknown;
+    for (auto &unit : textures_) {
+        unit.fill(unknown);
+    }
+    buffers_.fill(unknown);
+    viewport_.fill(-1);
+    scissor_.fill(-1);
+    caps_.fill(unknown_bool);
+    bound_samplers_.fill(unknown);
+    alignments_.fill(-1);
+    draw_buffers_.clear();
+}
+
+int GLState::texture_slot(GLenum target) {
+    switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_3D: return 1;
+        case GL_TEXTURE_2D_ARRAY: return 2;
+        case GL_TEXTURE_CUBE_MAP: return 3;
+        default: return -1;
+    }
+}
+
+int GLState::buffer_slot(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_UNIFORM_BUFFER: return 1;
+        case GL_PIXEL_PACK_BUFFER: return 2;
+        case GL_PIXEL_UNPACK_BUFFER: return 3;
+        default: return -1;
+    }
+}
+
+int GLState::cap_slot(GLenum cap) {
+    switch (cap) {
+        case GL_DEPTH_TEST: return 0;
+        case GL_SCISSOR_TEST: return 1;
+        case GL_BLEND: return 2;
+        case GL_CULL_FACE: return 3;
+        default: return -1;
+    }
+}
+
+void GLState::use_program(GLuint id) {
+    if (!changed(PROGRAM, program_ != id)) return;
+    glUseProgram(id);
+    program_ = id;
+}
+
+void GLState::bind_vertex_array(GLuint id) {
+    if (!changed(VERTEX_ARRAY, vertex_array_ != id)) return;
+    glBindVertexArray(id);
+    vertex_array_ = id;
+}
+
+void GLState::bind_framebuffer(GLuint id) {
+    if (!changed(FRAMEBUFFER, framebuffer_ != id)) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, id);
+    framebuffer_ = id;
+}
+
+void GLState::bind_texture(GLenum target, GLuint id) {
+    int slot = texture_slot(target);
+    if (active_unit_ == unknown || slot < 0) {
+        changed(TEXTURE, true);
+        glBindTexture(target, id);
+        return;
+    }
+    auto &bound = textures_[active_unit_][slot];
+    if (!changed(TEXTURE, bound != id)) return;
+    glBindTexture(target, id);
+    bound = id;
+}
+
+void GLState::bind_texture(GLuint unit, GLenum target, GLuint id) {
+    int slot = texture_slot(target);
+    if (unit < nb_units && slot >= 0 && textures_[unit][slot] == id) {
+        changed(TEXTURE, false);
+        return;
+    }
+    if (active_unit_ != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        active_unit_ = unit < nb_units ? unit : unknown;
+    }
+    changed(TEXTURE, true);
+    glBindTexture(target, id);
+    if (active_unit_ != unknown && slot >= 0) textures_[active_unit_][slot] = id;
+}
+
+void GLState::bind_buffer(GLenum target, GLuint id) {
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        changed(BUFFER, true);
+        glBindBuffer(target, id);
+        return;
+    }
+    if (!changed(BUFFER, buffers_[slot] != id)) return;
+    glBindBuffer(target, id);
+    buffers_[slot] = id;
+}
+
+void GLState::bind_buffer_base(GLenum target, GLuint index, GLuint id) {
+    changed(BUFFER, true);
+    glBindBufferBase(target, index, id);
+    int slot = buffer_slot(target);
+    if (slot >= 0) buffers_[slot] = id;
+}
+
+void GLState::viewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+    std::array<GLint, 4> v{x, y, w, h};
+    if (!changed(VIEWPORT, viewport_ != v)) return;
+    glViewport(x, y, w, h);
+    viewport_ = v;
+}
+
+std::array<GLint, 4> GLState::viewport() {
+    if (viewport_[2] < 0) glGetIntegerv(GL_VIEWPORT, viewport_.data());
+    return viewport_;
+}
+
+void GLState::scissor(GLint x, GLint y, GLsizei w, GLsizei h) {
+    std::array<GLint, 4> v{x, y, w, h};
+    if (!changed(SCISSOR, scissor_ != v)) return;
+    glScissor(x, y, w, h);
+    scissor_ = v;
+}
+
+void GLState::set_enabled(GLenum cap, bool enabled) {
+    int slot = cap_slot(cap);
+    if (!changed(CAPABILITY, slot < 0 || caps_[slot] != (int)enabled)) return;
+    enabled ? glEnable(cap) : glDisable(cap);
+    if (slot >= 0) caps_[slot] = enabled;
+}
+
+GLuint GLState::sampler(const std::array<GLenum, 5> &parameters) {
+    auto it = samplers_.find(parameters);
+    if (it != samplers_.end()) return it->second;
+
+    GLuint id;
+    glCreateSamplers(1, &id);
+    glSamplerParameteri(id, GL_TEXTURE_WRAP_S, parameters[0]);
+    glSamplerParameteri(id, GL_TEXTURE_WRAP_T, parameters[1]);
+    glSamplerParameteri(id, GL_TEXTURE_WRAP_R, parameters[2]);
+    glSamplerParameteri(id, GL_TEXTURE_MAG_FILTER, parameters[3]);
+    glSamplerParameteri(id, GL_TEXTURE_MIN_FILTER, parameters[4]);
+    samplers_[parameters] = id;
+    return id;
+}
+
+void GLState::bind_sampler(GLuint unit, GLuint sampler) {
+    bool known = unit < nb_units;
+    if (!changed(SAMPLER, !known || bound_samplers_[unit] != sampler)) return;
+    glBindSampler(unit, sampler);
+    if (known) bound_samplers_[unit] = sampler;
+}
+
+void GLState::draw_buffers(int n, const GLenum *buffers) {
+    auto it  = draw_buffers_.find(framebuffer_);
+    bool set = it != draw_buffers_.end() && it->second.size() == n &&
+               std::equal(buffers, buffers + n, it->second.begin());
+    if (!changed(DRAW_BUFFERS, framebuffer_ == unknown || !set)) return;
+    glDrawBuffers(n, buffers);
+    if (framebuffer_ != unknown) draw_buffers_[framebuffer_].assign(buffers, buffers + n);
+}
+
+void GLState::draw_buffer(GLenum buffer) {
+    auto it  = draw_buffers_.find(framebuffer_);
+    bool set = it != draw_buffers_.end() && it->second == std::vector<GLenum>{buffer};
+    if (!changed(DRAW_BUFFERS, framebuffer_ == unknown || !set)) return;
+    // GL_BACK and the like are only accepted by glDrawBuffer
+    glDrawBuffer(buffer);
+    if (framebuffer_ != unknown) draw_buffers_[framebuffer_] = {buffer};
+}
+
+void GLState::pixel_store(GLenum pname, GLint value) {
+    int slot = pname == GL_UNPACK_ALIGNMENT ? 0 : pname == GL_PACK_ALIGNMENT ? 1 : -1;
+    if (!changed(PIXEL_STORE, slot < 0 || alignments_[slot] != value)) return;
+    glPixelStorei(pname, value);
+    if (slot >= 0) alignments_[slot] = value;
+}
+
+void GLState::forget_program(GLuint id) {
+    // stays in use until another program is
+    if (program_ == id) program_ = unknown;
+}
+
+// the others revert to 0 where they were bound
+
+void GLState::forget_vertex_array(GLuint id) {
+    if (vertex_array_ == id) vertex_array_ = 0;
+}
+
+void GLState::forget_framebuffer(GLuint id) {
+    if (framebuffer_ == id) framebuffer_ = 0;
+    draw_buffers_.erase(id);
+}
+
+void GLState::forget_texture(GLuint id) {
+    for (auto &unit : textures_) {
+        std::replace(unit.begin(), unit.end(), id, 0u);
+    }
+}
+
+void GLState::forget_buffer(GLuint id) { std::replace(buffers_.begin(), buffers_.end(), id, 0u); }
+
+GLState::Counter GLState::total() const {
+    Counter ret;
+    for (auto &c : counters_) {
+        ret.issued += c.issued;
+        ret.elided += c.elided;
+    }
+    return ret;
+}
+
+void GLState::reset_counters() { counters_.fill(Counter()); }
\ No newline at end of file
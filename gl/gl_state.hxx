@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#ifndef __gl_h_
+    #include <glad/glad.h>
+#endif
+
+/// @addtogroup gl_wrappers
+/// @{
+
+namespace glwrapper {
+
+    /// @brief shadow of the GL state the wrappers set, one per context: a call setting what is
+    /// already current is skipped. everything goes through it, raw calls behind its back must be
+    /// followed by invalidate(). state not known yet (e.g. at start) is always issued
+    class GLState {
+        public:
+        enum Kind {
+            PROGRAM,
+            VERTEX_ARRAY,
+            FRAMEBUFFER,
+            TEXTURE, // glActiveTexture and glBindTexture
+            BUFFER,
+            VIEWPORT,
+            SCISSOR,
+            CAPABILITY, // glEnable, glDisable
+            DRAW_BUFFERS,
+            SAMPLER,
+            PIXEL_STORE,
+            NB_KINDS
+        };
+        struct Counter {
+            size_t issued = 0;
+            size_t elided = 0;
+        };
+
+        /// @brief state of the context current on this thread
+        static GLState &current();
+
+        /// @brief GL 4.5 direct state access: immutable storage and edits without binding. on by
+        /// default where the context has it; choose before creating textures and buffers, which
+        /// are allocated one way or the other
+        inline bool dsa() const { return dsa_ && GLAD_GL_VERSION_4_5; }
+        inline void set_dsa(bool enabled) { dsa_ = enabled; }
+
+        void use_program(GLuint id);
+        void bind_vertex_array(GLuint id);
+        /// @brief GL_FRAMEBUFFER, i.e. draw and read
+        void bind_framebuffer(GLuint id);
+        /// @brief glBindTexture on the active unit
+        void bind_texture(GLenum target, GLuint id);
+        /// @brief glBindTexture on unit, with glActiveTexture only if the binding changes: the
+        /// active unit is left as it was when nothing is issued
+        void bind_texture(GLuint unit, GLenum target, GLuint id);
+        /// @brief GL_ELEMENT_ARRAY_BUFFER belongs to the vertex array and is always issued
+        void bind_buffer(GLenum target, GLuint id);
+        /// @brief glBindBufferBase, always issued: indexed bindings aren't tracked, the generic
+        /// binding of target it also sets is
+        void bind_buffer_base(GLenum target, GLuint index, GLuint id);
+        void viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+        /// @brief current (x, y, w, h), queried from GL only while unknown
+        std::array<GLint, 4> viewport();
+        void scissor(GLint x, GLint y, GLsizei w, GLsizei h);
+        /// @brief glEnable or glDisable. GL_DEPTH_TEST, GL_SCISSOR_TEST, GL_BLEND and
+        /// GL_CULL_FACE are tracked, other caps are always issued
+        void set_enabled(GLenum cap, bool enabled);
+        /// @brief sampler object of these parameters (GL_TEXTURE_WRAP_S, _T, _R, MAG_FILTER,
+        /// MIN_FILTER), created on first use and kept with the context
+        GLuint sampler(const std::array<GLenum, 5> &parameters);
+        void   bind_sampler(GLuint unit, GLuint sampler);
+        /// @brief of the bound framebuffer, tracked per framebuffer like GL does
+        void draw_buffers(int n, const GLenum *buffers);
+        /// @brief glDrawBuffer, which also takes GL_BACK etc.
+        void draw_buffer(GLenum buffer);
+        /// @brief glPixelStorei. GL_UNPACK_ALIGNMENT and GL_PACK_ALIGNMENT are tracked, other
+        /// parameters are always issued
+        void pixel_store(GLenum pname, GLint value);
+
+        // deleting an object unbinds it, and GL may hand its name out again
+        void forget_program(GLuint id);
+        void forget_vertex_array(GLuint id);
+        void forget_framebuffer(GLuint id);
+        void forget_texture(GLuint id);
+        void forget_buffer(GLuint id);
+        /// @brief forget everything, e.g. after raw GL calls
+        void invalidate();
+
+        inline const Counter &counter(Kind kind) const { return counters_[kind]; }
+        Counter               total() const;
+        void                  reset_counters();
+
+        protected:
+        constexpr static GLuint unknown      = ~0u;
+        constexpr static int    nb_units     = 32;
+        constexpr static int    nb_targets   = 4; // texture targets, see texture_slot
+        constexpr static int    nb_buffers   = 4; // buffer targets, see buffer_slot
+        constexpr static int    nb_caps      = 4; // see cap_slot
+        constexpr static int    unknown_bool = -1;
+
+        GLuint                                               program_;
+        GLuint                                               vertex_array_;
+        GLuint                                               framebuffer_;
+        GLuint                                               active_unit_;
+        std::array<std::array<GLuint, nb_targets>, nb_units> textures_;
+        std::array<GLuint, nb_buffers>                       buffers_;
+        std::array<GLint, 4>                                 viewport_;
+        std::array<GLint, 4>                                 scissor_;
+        std::array<int, nb_caps>                             caps_;
+        std::array<GLuint, nb_units>                         bound_samplers_;
+        std::array<GLint, 2>                                 alignments_; // unpack, pack
+        // draw buffers of each framebuffer set so far
+        std::map<GLuint, std::vector<GLenum>>   draw_buffers_;
+        std::map<std::array<GLenum, 5>, GLuint> samplers_; // see sampler()
+        bool                                    dsa_ = true;
+
+        std::array<Counter, NB_KINDS> counters_;
+
+        GLState();
+        // true if the call must be issued, counted either way
+        inline bool changed(Kind kind, bool differs) {
+            differs ? counters_[kind].issued++ : counters_[kind].elided++;
+            return differs;
+        }
+        static int texture_slot(GLenum target);
+        static int buffer_slot(GLenum target);
+        static int cap_slot(GLenum cap);
+    };
+
+} // namespace glwrapper
+
+/// @}
+// end of group
\ No newline at end of file
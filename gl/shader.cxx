@@ -1,6 +1,7 @@
 #include "shader.hxx"
 
 #include <cstddef>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -12,6 +13,39 @@
 
 using glwrapper::Shader;
 
+// replace every line #include "name" by the file name, relative to dir. GLSL has no includes of its
+// own; this lets shaders share code without pasting it
+static std::string expand_includes(const std::string &code, std::filesystem::path dir, int depth) {
+    if (depth > 16) {
+        spdlog::error("expand_includes: too deeply nested #include in {}", dir.string());
+        exit(-1);
+    }
+    std::stringstream in(code), out;
+    std::string       line;
+    while (std::getline(in, line)) {
+        auto at = line.find_first_not_of(" \t");
+        if (at == std::string::npos || line.compare(at, 8, "#include") != 0) {
+            out << line << '\n';
+            continue;
+        }
+        auto q0 = line.find('"', at), q1 = line.find('"', q0 + 1);
+        if (q0 == std::string::npos || q1 == std::string::npos) {
+            spdlog::error("expand_includes: bad line: {}", line);
+            exit(-1);
+        }
+        auto          file_path = dir / line.substr(q0 + 1, q1 - q0 - 1);
+        std::ifstream file(file_path);
+        if (!file.is_open()) {
+            spdlog::error("can't open file: {}", file_path.string());
+            exit(-1);
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        out << expand_includes(stream.str(), file_path.parent_path(), depth + 1) << '\n';
+    }
+    return out.str();
+}
+
 Shader::Shader(std::string file_path, GLenum shader_type, std::string src) :
     shader_name(file_path) {
 
@@ -36,7 +70,7 @@ Shader::Shader(std::string file_path, GLenum shader_type, std::string src) :
         }
         stream << file.rdbuf();
         file.close();
-        code = stream.str();
+        code = expand_includes(stream.str(), std::filesystem::path(file_path).parent_path(), 0);
     } else { // shader source exist
         code = src;
     } // get shader source/>
@@ -12,6 +12,8 @@
 
 namespace glwrapper {
 
+    /// @brief shader object. loaded from file_path unless src is given; a file may pull in others
+    /// by lines #include "name", relative to its own directory
     class Shader {
         public:
         Shader(
@@ -2,15 +2,19 @@
 
 #include "shader_program.hxx"
 #include "checkfail.hxx"
+#include "gl_state.hxx"
 #include "shader.hxx"
 
+#include <algorithm>
 #include <filesystem>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 #include <spdlog/spdlog.h>
 
+using glwrapper::GLState;
 using glwrapper::ShaderProgram;
 using std::filesystem::path;
 
@@ -46,9 +50,48 @@ ShaderProgram::ShaderProgram(
     init();
 }
 
+ShaderProgram::ShaderProgram(Shader &&cshader) : cshader(std::move(cshader)) { init(); }
+
+std::shared_ptr<ShaderProgram> ShaderProgram::compute(std::string cshader_str) {
+    if (cshader_str.find('#') != std::string::npos) {
+        return std::shared_ptr<ShaderProgram>(
+            new ShaderProgram(Shader("", GL_COMPUTE_SHADER, cshader_str))
+        );
+    }
+    return std::shared_ptr<ShaderProgram>(
+        new ShaderProgram(Shader(find_path(cshader_str).string(), GL_COMPUTE_SHADER, ""))
+    );
+}
+
+ShaderProgram::ShaderProgram(
+    Shader &&vshader, Shader &&tcshader, Shader &&teshader, Shader &&fshader
+) :
+    vshader(std::move(vshader)),
+    fshader(std::move(fshader)), tcshader(std::move(tcshader)), teshader(std::move(teshader)) {
+    init();
+}
+
+std::shared_ptr<ShaderProgram> ShaderProgram::tessellation(
+    std::string vshader_str, std::string tcshader_str, std::string teshader_str,
+    std::string fshader_str
+) {
+    auto load = [](std::string str, GLenum type) {
+        if (str.find('#') != std::string::npos) return Shader("", type, str);
+        return Shader(find_path(str).string(), type, "");
+    };
+    return std::shared_ptr<ShaderProgram>(new ShaderProgram(
+        load(vshader_str, GL_VERTEX_SHADER), load(tcshader_str, GL_TESS_CONTROL_SHADER),
+        load(teshader_str, GL_TESS_EVALUATION_SHADER), load(fshader_str, GL_FRAGMENT_SHADER)
+    ));
+}
+
 void ShaderProgram::init() {
 
-    if (!vshader.exist() || !fshader.exist()) {
+    if (cshader.exist() && (vshader.exist() || fshader.exist())) {
+        spdlog::error("compute shader can't be linked with vshader/fshader");
+        exit(-1);
+    }
+    if (!cshader.exist() && (!vshader.exist() || !fshader.exist())) {
         spdlog::error("vshader and fshader is required {},{}", vshader.exist(), fshader.exist());
         exit(-1);
     }
@@ -56,9 +99,12 @@ void ShaderProgram::init() {
     int success;
 
     ID_ = glCreateProgram();
-    vshader.attach_to_program(ID_);
-    fshader.attach_to_program(ID_);
+    if (vshader.exist()) vshader.attach_to_program(ID_);
+    if (fshader.exist()) fshader.attach_to_program(ID_);
     if (gshader.exist()) gshader.attach_to_program(ID_);
+    if (cshader.exist()) cshader.attach_to_program(ID_);
+    if (tcshader.exist()) tcshader.attach_to_program(ID_);
+    if (teshader.exist()) teshader.attach_to_program(ID_);
 
     spdlog::info("linking shader program...\n");
 
@@ -72,22 +118,150 @@ void ShaderProgram::init() {
         exit(-1);
     }
     spdlog::info("shader program linked successfully: {}", ID_);
+    reflect_uniforms();
+}
+
+void ShaderProgram::reflect_uniforms() {
+    GLint count = 0, max_length = 0;
+    glGetProgramiv(ID_, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<char> buffer(std::max(max_length, 1));
+
+    uniforms_.clear();
+    uniform_index_.clear();
+    for (GLuint i = 0; i < (GLuint)count; i++) {
+        GLsizei length;
+        GLint   size;
+        GLenum  type;
+        glGetActiveUniform(ID_, i, buffer.size(), &length, &size, &type, buffer.data());
+
+        // arrays are reported as name[0]
+        std::string name(buffer.data(), length);
+        bool        array = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+        if (array) name.resize(name.size() - 3);
+
+        UniformInfo info{name, type, {}};
+        for (int e = 0; e < size; e++) {
+            auto element = array || size > 1 ? fmt::format("{}[{}]", name, e) : name;
+            info.locations.push_back(glGetUniformLocation(ID_, element.c_str()));
+        }
+        // members of uniform blocks have no location
+        if (info.locations[0] == -1) continue;
+        uniforms_.push_back(std::move(info));
+    }
+    for (int i = 0; i < uniforms_.size(); i++) {
+        uniform_index_[uniforms_[i].name] = i;
+    }
+    MY_CHECK_FAIL
+}
+
+const ShaderProgram::UniformInfo *ShaderProgram::find_uniform(std::string_view name, int *element) {
+    nb_lookups_++;
+    if (element) *element = 0;
+
+    auto it = uniform_index_.find(name);
+    if (it != uniform_index_.end()) return &uniforms_[it->second];
+
+    // name[i]
+    auto open = name.rfind('[');
+    if (open != std::string_view::npos && name.back() == ']' && open + 2 < name.size()) {
+        int i = 0;
+        for (auto c : name.substr(open + 1, name.size() - open - 2)) {
+            if (c < '0' || c > '9') {
+                nb_failed_lookups_++;
+                return nullptr;
+            }
+            i = i * 10 + (c - '0');
+        }
+        it = uniform_index_.find(name.substr(0, open));
+        if (it != uniform_index_.end() && i < uniforms_[it->second].locations.size()) {
+            if (element) *element = i;
+            return &uniforms_[it->second];
+        }
+    }
+    nb_failed_lookups_++;
+    return nullptr;
+}
+
+bool ShaderProgram::is_opaque(GLenum type) {
+    switch (type) {
+        case GL_FLOAT:
+        case GL_FLOAT_VEC2:
+        case GL_FLOAT_VEC3:
+        case GL_FLOAT_VEC4:
+        case GL_INT:
+        case GL_INT_VEC2:
+        case GL_INT_VEC3:
+        case GL_INT_VEC4:
+        case GL_UNSIGNED_INT:
+        case GL_UNSIGNED_INT_VEC2:
+        case GL_UNSIGNED_INT_VEC3:
+        case GL_UNSIGNED_INT_VEC4:
+        case GL_BOOL:
+        case GL_BOOL_VEC2:
+        case GL_BOOL_VEC3:
+        case GL_BOOL_VEC4:
+        case GL_FLOAT_MAT2:
+        case GL_FLOAT_MAT3:
+        case GL_FLOAT_MAT4:
+        case GL_FLOAT_MAT2x3:
+        case GL_FLOAT_MAT2x4:
+        case GL_FLOAT_MAT3x2:
+        case GL_FLOAT_MAT3x4:
+        case GL_FLOAT_MAT4x2:
+        case GL_FLOAT_MAT4x3:
+        case GL_DOUBLE:
+        case GL_DOUBLE_VEC2:
+        case GL_DOUBLE_VEC3:
+        case GL_DOUBLE_VEC4: return false;
+        // samplers and images, set by unit
+        default: return true;
+    }
 }
 
 ShaderProgram::ShaderProgram(ShaderProgram &&o) :
     ID_(o.ID_), vshader(std::move(o.vshader)), fshader(std::move(o.fshader)),
-    gshader(std::move(o.gshader)) {
+    gshader(std::move(o.gshader)), cshader(std::move(o.cshader)),
+    tcshader(std::move(o.tcshader)), teshader(std::move(o.teshader)),
+    uniforms_(std::move(o.uniforms_)), uniform_index_(std::move(o.uniform_index_)),
+    nb_lookups_(o.nb_lookups_), nb_failed_lookups_(o.nb_failed_lookups_),
+    block_bindings_applied_(o.block_bindings_applied_) {
 
     o.ID_ = 0;
 }
 
 ShaderProgram::~ShaderProgram() {
     if (ID_ == 0) return;
+    GLState::current().forget_program(ID_);
     glDeleteProgram(ID_);
 }
 void ShaderProgram::use() {
     MY_CHECK_FAIL;
-    glUseProgram(ID_);
+    GLState::current().use_program(ID_);
+    if (block_bindings_applied_ != block_bindings_version_) apply_block_bindings();
+    MY_CHECK_FAIL
+}
+
+void ShaderProgram::bind_uniform_block(const std::string &name, GLuint binding) {
+    auto it = block_bindings_.find(name);
+    if (it != block_bindings_.end() && it->second == binding) return;
+    block_bindings_[name] = binding;
+    block_bindings_version_++;
+}
+
+void ShaderProgram::apply_block_bindings() {
+    block_bindings_applied_ = block_bindings_version_;
+
+    GLint count = 0, max_length = 0;
+    glGetProgramiv(ID_, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    glGetProgramiv(ID_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    std::vector<char> buffer(std::max(max_length, 1));
+    for (GLuint i = 0; i < (GLuint)count; i++) {
+        GLsizei length;
+        glGetActiveUniformBlockName(ID_, i, buffer.size(), &length, buffer.data());
+        auto it = block_bindings_.find(std::string_view(buffer.data(), length));
+        if (it != block_bindings_.end()) glUniformBlockBinding(ID_, i, it->second);
+    }
     MY_CHECK_FAIL
 }
 
@@ -3,13 +3,17 @@
 #include "checkfail.hxx"
 #include "shader.hxx"
 
+#include <algorithm>
 #include <filesystem>
 #include <glm/fwd.hpp>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -35,6 +39,15 @@ namespace glwrapper {
     using glm::vec4;
     using std::is_same_v;
 
+    /// @brief location of a uniform resolved once by ShaderProgram::uniform, then set by
+    /// ShaderProgram::set without a name lookup. invalid handles are skipped
+    template<typename T> struct Uniform {
+        GLint  location = -1;
+        GLenum type     = GL_NONE; // GLSL type, picks the glUniform call
+
+        inline explicit operator bool() const { return location != -1; }
+    };
+
     class ShaderProgram {
         public:
         ShaderProgram(
@@ -47,9 +60,39 @@ namespace glwrapper {
         ShaderProgram(const ShaderProgram &) = delete;
         ~ShaderProgram();
 
+        /// @brief compute shader program (GL 4.3), cshader being a source or a path as above
+        static std::shared_ptr<ShaderProgram> compute(std::string cshader);
+        /// @brief program with tessellation control and evaluation stages (GL 4.0), each a source
+        /// or a path as above
+        static std::shared_ptr<ShaderProgram> tessellation(
+            std::string vshader, std::string tcshader, std::string teshader, std::string fshader
+        );
+
         void use();
 
-        template<typename T> void set_value(std::string name, T value, bool silence = false);
+        template<typename T> void set_value(std::string_view name, T value, bool silence = false);
+
+        /// @brief handle of uniform name, or of its element-th element for arrays. invalid when
+        /// the uniform is not active or T does not match its type, with an error unless silence
+        template<typename T>
+        Uniform<T> uniform(std::string_view name, int element = 0, bool silence = false);
+        template<typename T> void set(Uniform<T> u, const T &value);
+
+        /// @brief active uniform of the default block, reflected once after linking
+        struct UniformInfo {
+            std::string        name; // arrays without their [0]
+            GLenum             type;
+            std::vector<GLint> locations; // one per array element
+        };
+        /// @brief uniform by name, also "name[i]" for an element of an array, with the element
+        /// index. null if not active. every call counts as a lookup
+        const UniformInfo *find_uniform(std::string_view name, int *element = nullptr);
+        inline size_t      nb_lookups() const { return nb_lookups_; }
+        inline size_t      nb_failed_lookups() const { return nb_failed_lookups_; }
+
+        /// @brief bind uniform block name of every program, linked or not yet, to binding point
+        /// binding. applied by use()
+        static void bind_uniform_block(const std::string &name, GLuint binding);
 
         // readonly's
         inline auto ID() { return ID_; };
@@ -59,27 +102,37 @@ namespace glwrapper {
         Shader vshader;
         Shader fshader;
         Shader gshader;
+        Shader cshader;
+        Shader tcshader;
+        Shader teshader;
 
-        static std::filesystem::path find_path(std::filesystem::path p);
-    };
+        ShaderProgram(Shader &&cshader);
+        ShaderProgram(Shader &&vshader, Shader &&tcshader, Shader &&teshader, Shader &&fshader);
 
-    template<typename T> void ShaderProgram::set_value(std::string name, T value, bool silence) {
-        // use program
-        MY_CHECK_FAIL
-        use();
-        MY_CHECK_FAIL
+        // reflection. the keys of uniform_index_ view into uniforms_, which is filled once
+        std::vector<UniformInfo>                  uniforms_;
+        std::unordered_map<std::string_view, int> uniform_index_;
+        size_t                                    nb_lookups_        = 0;
+        size_t                                    nb_failed_lookups_ = 0;
 
-        // get parm location and checkfail
-        auto location = glGetUniformLocation(ID_, name.c_str());
-        if (location == -1 && !silence) {
-            spdlog::error(
-                "uniform parm not found: {} (of type:{})(prog_id: {})", name, typeid(T).name(), ID_
-            );
-            // exit(-1);
-            return;
-        }
+        // uniform block bindings of all programs, by block name. a program applies them in use()
+        // when block_bindings_version_ moved since it last did
+        inline static std::map<std::string, GLuint, std::less<>> block_bindings_;
+        inline static int                                      block_bindings_version_ = 0;
+        int                                                    block_bindings_applied_ = -1;
 
-        // set parm according to type
+        void reflect_uniforms();
+        void apply_block_bindings();
+        // T can be set on a uniform of GLSL type
+        template<typename T> static bool type_matches(GLenum type);
+        static bool                      is_opaque(GLenum type);
+        template<typename T>
+        static void upload(GLint location, const T &value, int count = 1, GLenum type = GL_NONE);
+
+        static std::filesystem::path find_path(std::filesystem::path p);
+    };
+
+    template<typename T> bool ShaderProgram::type_matches(GLenum type) {
         static_assert(
             is_same_v<T, int> || is_same_v<T, unsigned int> || is_same_v<T, float> ||
                 is_same_v<T, vec2> || is_same_v<T, mat2> || is_same_v<T, vec3> ||
@@ -87,13 +140,40 @@ namespace glwrapper {
                 is_same_v<T, std::vector<vec4>>,
             "T not supported"
         );
+        if constexpr (is_same_v<T, float>) {
+            return type == GL_FLOAT || type == GL_BOOL;
+        } else if constexpr (is_same_v<T, int>) {
+            return type == GL_INT || type == GL_BOOL || is_opaque(type);
+        } else if constexpr (is_same_v<T, unsigned int>) {
+            // also texture units of samplers
+            return type == GL_UNSIGNED_INT || type == GL_BOOL || is_opaque(type);
+        } else if constexpr (is_same_v<T, vec2>) {
+            return type == GL_FLOAT_VEC2;
+        } else if constexpr (is_same_v<T, mat2>) {
+            return type == GL_FLOAT_MAT2;
+        } else if constexpr (is_same_v<T, vec3>) {
+            return type == GL_FLOAT_VEC3;
+        } else if constexpr (is_same_v<T, mat3>) {
+            return type == GL_FLOAT_MAT3;
+        } else if constexpr (is_same_v<T, vec4> || is_same_v<T, std::vector<vec4>>) {
+            return type == GL_FLOAT_VEC4;
+        } else {
+            return type == GL_FLOAT_MAT4;
+        }
+    }
 
+    template<typename T>
+    void ShaderProgram::upload(GLint location, const T &value, int count, GLenum type) {
+        // set parm according to type
         if constexpr (is_same_v<T, float>) {
             glUniform1f(location, value);
             MY_CHECK_FAIL
-        } else if constexpr (is_same_v<T, int> || is_same_v<T, unsigned int>) {
+        } else if constexpr (is_same_v<T, int>) {
             glUniform1i(location, value);
             MY_CHECK_FAIL
+        } else if constexpr (is_same_v<T, unsigned int>) {
+            type == GL_UNSIGNED_INT ? glUniform1ui(location, value) : glUniform1i(location, value);
+            MY_CHECK_FAIL
         }
         // vec2, mat2
         else if constexpr (is_same_v<T, vec2>) {
@@ -119,11 +199,75 @@ namespace glwrapper {
             glUniformMatrix4fv(location, 1, GL_FALSE, value_ptr(value));
             MY_CHECK_FAIL
         } else if constexpr (is_same_v<T, std::vector<vec4>>) {
-            glUniform4fv(location, value.size(), value_ptr(value[0]));
+            glUniform4fv(location, count, value_ptr(value[0]));
             MY_CHECK_FAIL
         }
     }
 
+    template<typename T>
+    void ShaderProgram::set_value(std::string_view name, T value, bool silence) {
+        // use program
+        MY_CHECK_FAIL
+        use();
+        MY_CHECK_FAIL
+
+        // get parm location and checkfail
+        int  element = 0;
+        auto info    = find_uniform(name, &element);
+        if (!info) {
+            if (!silence) {
+                spdlog::error(
+                    "uniform parm not found: {} (of type:{})(prog_id: {})", name, typeid(T).name(),
+                    ID_
+                );
+            }
+            return;
+        }
+        if (!type_matches<T>(info->type)) {
+            spdlog::error(
+                "uniform parm type mismatch: {} is GL type {:#x}, set as {} (prog_id: {})", name,
+                info->type, typeid(T).name(), ID_
+            );
+            return;
+        }
+
+        int count = 1;
+        if constexpr (is_same_v<T, std::vector<vec4>>) {
+            count = std::min<int>(value.size(), info->locations.size() - element);
+            if (count <= 0) return;
+        }
+        upload(info->locations[element], value, count, info->type);
+    }
+
+    template<typename T>
+    Uniform<T> ShaderProgram::uniform(std::string_view name, int element, bool silence) {
+        int  first = 0;
+        auto info  = find_uniform(name, &first);
+        if (!info || first + element < 0 || first + element >= info->locations.size()) {
+            if (!silence) {
+                spdlog::error(
+                    "uniform parm not found: {}, element {} (prog_id: {})", name, element, ID_
+                );
+            }
+            return {};
+        }
+        if (!type_matches<T>(info->type)) {
+            spdlog::error(
+                "uniform parm type mismatch: {} is GL type {:#x}, handle of {} (prog_id: {})",
+                name, info->type, typeid(T).name(), ID_
+            );
+            return {};
+        }
+        return {info->locations[first + element], info->type};
+    }
+
+    template<typename T> void ShaderProgram::set(Uniform<T> u, const T &value) {
+        if (!u) return;
+        MY_CHECK_FAIL
+        use();
+        upload(u.location, value, 1, u.type);
+    }
+
 } // namespace glwrapper
 
 /// @}
@@ -1,18 +1,30 @@
 #include "texture_objects.hxx"
+#include "buffer_objects.hxx"
 #include "checkfail.hxx"
+#include "gl_state.hxx"
 #include "shader_program.hxx"
+#include "thread_pool.hxx"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <optional>
+#include <thread>
 
 #include "stb_image.h"
+#include <GLFW/glfw3.h>
 #include <spdlog/spdlog.h>
 #include <stddef.h>
 #include <vector>
 
+using glwrapper::GLState;
+using glwrapper::ProgressiveTexture3D;
 using glwrapper::TextureImageData;
+using glwrapper::TextureLoader;
 using glwrapper::TextureObject;
 using glwrapper::TextureParameter;
 
@@ -22,8 +34,8 @@ TextureImageData::TextureImageData(std::string image_path) {
     spdlog::info("loading image:{}", image_path);
     int nb_channels; // unused. always set format to RGBA
 
-    // flip y axis
-    stbi_set_flip_vertically_on_load(true);
+    // flip y axis, for this thread only
+    stbi_set_flip_vertically_on_load_thread(true);
 
     data_ = stbi_load(image_path.c_str(), &width_, &height_, &nb_channels, 4);
     if (!data_) {
@@ -38,7 +50,7 @@ TextureImageData::TextureImageData(void *raw_image, size_t size) {
     spdlog::info("loading from raw image");
     int nb_channels;
 
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(true);
     data_ =
         stbi_load_from_memory((unsigned char *)raw_image, size, &width_, &height_, &nb_channels, 4);
     if (!data_) {
@@ -69,22 +81,28 @@ TextureObject::TextureObject(
     this->parms.type = type;
 
     validate();
-    glGenTextures(1, &ID_);
+    if (GLState::current().dsa()) {
+        glCreateTextures(type_, 1, &ID_);
+    } else {
+        glGenTextures(1, &ID_);
+    }
 }
 
 TextureObject::TextureObject(TextureObject &&o) :
     ID_(o.ID_), tex_index_(o.tex_index_), name_(o.name_), data_(o.data_), format_(o.format_),
-    gen_mipmap_(o.gen_mipmap_) {
+    gen_mipmap_(o.gen_mipmap_), width_(o.width_), height_(o.height_), depth_(o.depth_),
+    levels_(o.levels_) {
     o.ID_ = 0;
 }
 
 TextureObject::~TextureObject() {
     if (ID_ == 0) return;
     spdlog::debug("TextureObject::~TextureObject(id={})", ID_);
+    GLState::current().forget_texture(ID_);
     glDeleteTextures(1, &ID_);
 }
 
-void TextureObject::bind() { glBindTexture(type_, ID_); }
+void TextureObject::bind() { GLState::current().bind_texture(type_, ID_); }
 
 void TextureObject::validate() {
     if (tex_index_ >= 32) {
@@ -105,16 +123,15 @@ void TextureObject::activate(GLuint at) {
     // decide tex_index
     if (at != -1) tex_index_ = at;
     validate();
-    // activate and bind
-    //  NOTE: activetexture must prior to the first bindtexture call
-    glActiveTexture(GL_TEXTURE0 + tex_index_);
-    bind();
+    // activate and bind, nothing if already bound there
+    auto &state = GLState::current();
+    state.bind_texture(tex_index_, type_, ID_);
+    if (state.dsa()) state.bind_sampler(tex_index_, parms.sampler());
 }
 void TextureObject::activate_sampler(
     std::shared_ptr<ShaderProgram> prog, std::string name, int at
 ) {
     MY_CHECK_FAIL
-    prog->use();
     activate(at);
     name_ = (name == "" ? name_ : name);
     prog->set_value(name_, tex_index_);
@@ -128,6 +145,18 @@ void TextureObject::from_data(
     value_type   = from_data_parse_value_type(value_type);
     input_format = from_data_parse_input_format(input_format);
 
+    // rows are tightly packed, e.g. odd widths of R8/R16
+    GLState::current().pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    if (GLState::current().dsa()) {
+        allocate_storage(width, height, 1);
+        if (data) {
+            glTextureSubImage2D(ID_, 0, 0, 0, width, height, input_format, value_type, data);
+        }
+        if (gen_mipmap_) glGenerateTextureMipmap(ID_);
+        MY_CHECK_FAIL
+        return;
+    }
+
     // bind context
     bind();
     parms.BindParameter();
@@ -161,6 +190,19 @@ void TextureObject::from_data(
     value_type   = from_data_parse_value_type(value_type);
     input_format = from_data_parse_input_format(input_format);
 
+    GLState::current().pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    if (GLState::current().dsa()) {
+        allocate_storage(width, height, depth);
+        if (data) {
+            glTextureSubImage3D(
+                ID_, 0, 0, 0, 0, width, height, depth, input_format, value_type, data
+            );
+        }
+        if (gen_mipmap_) glGenerateTextureMipmap(ID_);
+        MY_CHECK_FAIL
+        return;
+    }
+
     // bind context
     bind();
     parms.BindParameter();
@@ -184,6 +226,92 @@ void TextureObject::from_data(
     MY_CHECK_FAIL
 }
 
+void TextureObject::sub_data(
+    void *data, int x, int y, int z, int width, int height, int depth, GLenum value_type,
+    GLenum input_format
+) {
+    MY_CHECK_FAIL
+    assert(type_ == GL_TEXTURE_2D || type_ == GL_TEXTURE_3D);
+    value_type   = from_data_parse_value_type(value_type);
+    input_format = from_data_parse_input_format(input_format);
+
+    GLState::current().pixel_store(GL_UNPACK_ALIGNMENT, 1);
+    if (GLState::current().dsa()) {
+        if (type_ == GL_TEXTURE_2D) {
+            glTextureSubImage2D(ID_, 0, x, y, width, height, input_format, value_type, data);
+        } else {
+            glTextureSubImage3D(
+                ID_, 0, x, y, z, width, height, depth, input_format, value_type, data
+            );
+        }
+        MY_CHECK_FAIL
+        return;
+    }
+
+    bind();
+    if (type_ == GL_TEXTURE_2D) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, input_format, value_type, data);
+    } else {
+        glTexSubImage3D(
+            GL_TEXTURE_3D, 0, x, y, z, width, height, depth, input_format, value_type, data
+        );
+    }
+    MY_CHECK_FAIL
+}
+
+void TextureObject::generate_mipmap() {
+    MY_CHECK_FAIL
+    if (GLState::current().dsa()) {
+        glGenerateTextureMipmap(ID_);
+    } else {
+        bind();
+        glGenerateMipmap(type_);
+    }
+    MY_CHECK_FAIL
+}
+
+void TextureObject::allocate_storage(int w, int h, int d) {
+    // the whole chain if it may be sampled or generated, level 0 otherwise
+    int levels = 1;
+    if (gen_mipmap_ || parms.uses_mipmaps()) {
+        levels = (int)std::floor(std::log2(std::max({w, h, d, 1}))) + 1;
+    }
+    if (w == width_ && h == height_ && d == depth_ && levels == levels_) return;
+
+    auto &state = GLState::current();
+    if (levels_ > 0) {
+        // immutable, resizing takes a new texture
+        if (attached_) {
+            spdlog::error(
+                "TextureObject: resizing texture(id={}) attached to a framebuffer, {}x{}x{} to "
+                "{}x{}x{}",
+                ID_, width_, height_, depth_, w, h, d
+            );
+            exit(-1);
+        }
+        state.forget_texture(ID_);
+        glDeleteTextures(1, &ID_);
+        glCreateTextures(type_, 1, &ID_);
+    }
+    if (type_ == GL_TEXTURE_2D) {
+        glTextureStorage2D(ID_, levels, format_, w, h);
+    } else {
+        glTextureStorage3D(ID_, levels, format_, w, h, d);
+    }
+    // for plain binds, activate() overrides them with the sampler
+    glTextureParameteri(ID_, GL_TEXTURE_WRAP_S, parms.wrap_s);
+    glTextureParameteri(ID_, GL_TEXTURE_WRAP_T, parms.wrap_t);
+    glTextureParameteri(ID_, GL_TEXTURE_WRAP_R, parms.wrap_r);
+    glTextureParameteri(ID_, GL_TEXTURE_MIN_FILTER, parms.min_filt);
+    glTextureParameteri(ID_, GL_TEXTURE_MAG_FILTER, parms.max_filt);
+    MY_CHECK_FAIL
+
+    width_  = w;
+    height_ = h;
+    depth_  = d;
+    levels_ = levels;
+}
+
 void TextureObject::from_image(std::string filename, bool save) {
     auto img = std::make_shared<TextureImageData>(filename);
     from_data((void *)img->data(), img->width(), img->height());
@@ -247,7 +375,12 @@ void TextureObject::repr(int nb_component) {
 
 std::map<GLenum, TextureObject::f_v> TextureObject::format_map = {
     {GL_R8, {GL_RED, GL_UNSIGNED_BYTE}},
+    {GL_R16, {GL_RED, GL_UNSIGNED_SHORT}},
+    {GL_R16F, {GL_RED, GL_HALF_FLOAT}},
     {GL_R32F, {GL_RED, GL_FLOAT}},
+    {GL_RG16F, {GL_RG, GL_HALF_FLOAT}},
+    {GL_RG32F, {GL_RG, GL_FLOAT}},
+    {GL_RG8UI, {GL_RG_INTEGER, GL_UNSIGNED_BYTE}},
     {GL_RGB8, {GL_RGB, GL_UNSIGNED_BYTE}},
     {GL_RGBA8, {GL_RGBA, GL_UNSIGNED_BYTE}},
     {GL_RGB32F, {GL_RGB, GL_FLOAT}},
@@ -302,3 +435,267 @@ void TextureParameter::BindParameter() {
     }
     MY_CHECK_FAIL
 }
+
+GLuint TextureParameter::sampler() const {
+    return GLState::current().sampler({wrap_s, wrap_t, wrap_r, max_filt, min_filt});
+}
+
+bool TextureParameter::uses_mipmaps() const {
+    return min_filt != GL_NEAREST && min_filt != GL_LINEAR;
+}
+
+// ProgressiveTexture3D
+
+ProgressiveTexture3D::ProgressiveTexture3D(TextureParameter parms, GLenum format, int slab_depth) :
+    slab_depth_(std::max(slab_depth, 1)) {
+    front_ = std::make_shared<TextureObject>("", 0, parms, format, GL_TEXTURE_3D);
+    back_  = std::make_shared<TextureObject>("", 0, parms, format, GL_TEXTURE_3D);
+}
+
+void ProgressiveTexture3D::start(
+    int w, int h, int d, SlabSource source, GLenum value_type, GLenum input_format
+) {
+    w_            = w;
+    h_            = h;
+    d_            = d;
+    z_            = 0;
+    source_       = std::move(source);
+    ready_        = false;
+    value_type_   = value_type;
+    input_format_ = input_format;
+
+    if (back_size_ != std::array<int, 3>{w, h, d}) {
+        back_->from_data(nullptr, w, h, d, value_type, input_format);
+        back_size_ = {w, h, d};
+    }
+}
+
+bool ProgressiveTexture3D::step(double budget_ms) {
+    if (!source_) return false;
+
+    using clock = std::chrono::steady_clock;
+    auto ms     = [](clock::time_point a, clock::time_point b) {
+        return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+
+    auto   t0      = clock::now();
+    double slab_ms = 0;
+    for (bool first = true; z_ < d_; first = false) {
+        // stop before the next slab, estimated as long as the last one, would overrun
+        if (!first && ms(t0, clock::now()) + slab_ms > budget_ms) break;
+
+        auto t  = clock::now();
+        int  z1 = std::min(z_ + slab_depth_, d_);
+        back_->sub_data(
+            (void *)source_(z_, z1), 0, 0, z_, w_, h_, z1 - z_, value_type_, input_format_
+        );
+        slab_ms = ms(t, clock::now());
+        z_      = z1;
+    }
+    if (z_ < d_) return false;
+
+    spdlog::debug("ProgressiveTexture3D: {}x{}x{} complete", w_, h_, d_);
+    source_ = nullptr;
+    ready_  = true;
+    return true;
+}
+
+void ProgressiveTexture3D::present() {
+    if (!ready_) return;
+    std::swap(front_, back_);
+    std::swap(front_size_, back_size_);
+    has_front_ = true;
+    ready_     = false;
+}
+
+// TextureLoader
+
+TextureLoader::TextureLoader() : queue_(std::make_shared<Queue>()) {}
+
+TextureLoader::~TextureLoader() {
+    if (nb_pending_ > 0) spdlog::debug("TextureLoader: {} loads dropped", nb_pending_);
+    // shared() outlives the context, whose objects then go with it
+    if (!glfwGetCurrentContext()) return;
+    for (auto &slot : slots_) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.pbo == 0) continue;
+        GLState::current().forget_buffer(slot.pbo);
+        glDeleteBuffers(1, &slot.pbo);
+    }
+}
+
+TextureLoader &TextureLoader::shared() {
+    static TextureLoader loader;
+    return loader;
+}
+
+void TextureLoader::load(std::shared_ptr<TextureObject> tex, std::string path) {
+    start(tex, [path] {
+        Decoded d;
+        d.source = path;
+        stbi_set_flip_vertically_on_load_thread(true);
+        d.pixels = std::shared_ptr<unsigned char>(
+            stbi_load(path.c_str(), &d.w, &d.h, &d.nb_channels, 0), stbi_image_free
+        );
+        return d;
+    });
+}
+
+void TextureLoader::load(std::shared_ptr<TextureObject> tex, const void *raw_image, size_t size) {
+    auto image = std::make_shared<std::vector<stbi_uc>>(
+        (const stbi_uc *)raw_image, (const stbi_uc *)raw_image + size
+    );
+    start(tex, [image] {
+        Decoded d;
+        d.source = "<raw image>";
+        stbi_set_flip_vertically_on_load_thread(true);
+        d.pixels = std::shared_ptr<unsigned char>(
+            stbi_load_from_memory(
+                image->data(), image->size(), &d.w, &d.h, &d.nb_channels, 0
+            ),
+            stbi_image_free
+        );
+        return d;
+    });
+}
+
+void TextureLoader::start(std::shared_ptr<TextureObject> tex, std::function<Decoded()> decode) {
+    assert(tex->type() == GL_TEXTURE_2D);
+    tex->from_data(placeholder.data(), 1, 1, (GLenum)GL_UNSIGNED_BYTE, (GLenum)GL_RGBA);
+    nb_pending_++;
+
+    std::weak_ptr<TextureObject> target = tex;
+    mf::ThreadPool::global().push([queue = queue_, target, decode] {
+        auto d = decode();
+        d.tex  = target;
+        if (!d.pixels) spdlog::error("TextureLoader: can't decode image {}", d.source);
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->decoded.push_back(std::move(d));
+    });
+}
+
+int TextureLoader::poll(size_t budget) {
+    // move the slots whose fence has signalled on, never waiting
+    for (auto &slot : slots_) {
+        if (slot.stage == Stage::FREE) continue;
+        if (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        if (slot.stage == Stage::STAGED) {
+            upload(slot);
+        } else {
+            slot.stage = Stage::FREE;
+        }
+    }
+
+    size_t staged = 0;
+    while (staged < std::max<size_t>(budget, 1)) {
+        auto slot = std::find_if(slots_.begin(), slots_.end(), [](const Slot &s) {
+            return s.stage == Stage::FREE;
+        });
+        if (slot == slots_.end()) break;
+
+        Decoded d;
+        {
+            std::lock_guard<std::mutex> lock(queue_->mutex);
+            if (queue_->decoded.empty()) break;
+            d = std::move(queue_->decoded.front());
+            queue_->decoded.pop_front();
+        }
+        if (d.tex.expired() || !d.pixels) {
+            nb_pending_--; // gone, or keeps the placeholder
+            continue;
+        }
+        staged += (size_t)d.w * d.h * d.nb_channels;
+        stage(*slot, std::move(d));
+    }
+    return nb_pending_;
+}
+
+void TextureLoader::finish() {
+    while (poll(std::numeric_limits<size_t>::max()) > 0) {
+        std::this_thread::yield();
+    }
+}
+
+void TextureLoader::stage(Slot &slot, Decoded d) {
+    MY_CHECK_FAIL
+    auto  &state = GLState::current();
+    size_t size  = (size_t)d.w * d.h * std::clamp(d.nb_channels, 1, 4);
+    spdlog::debug("TextureLoader: staging {} ({}x{}x{})", d.source, d.w, d.h, d.nb_channels);
+
+    if (slot.pbo == 0) {
+        if (state.dsa()) {
+            glCreateBuffers(1, &slot.pbo);
+        } else {
+            glGenBuffers(1, &slot.pbo);
+        }
+    }
+    state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    if (slot.capacity < size) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        slot.capacity = size;
+    }
+    // the last fence of the slot has signalled, gl is done reading it
+    auto dst = glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    std::memcpy(dst, d.pixels.get(), size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    d.pixels.reset();
+    slot.image = std::move(d);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.stage = Stage::STAGED;
+    MY_CHECK_FAIL
+}
+
+void TextureLoader::upload(Slot &slot) {
+    MY_CHECK_FAIL
+    auto &d   = slot.image;
+    auto  tex = d.tex.lock();
+    nb_pending_--;
+    if (!tex) {
+        slot.stage = Stage::FREE;
+        return;
+    }
+
+    const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    int          n         = std::clamp(d.nb_channels, 1, 4);
+    GLenum       format    = formats[n - 1];
+    spdlog::debug("TextureLoader: uploading {} ({}x{}x{})", d.source, d.w, d.h, d.nb_channels);
+
+    // allocate while no unpack buffer is bound
+    tex->from_data(nullptr, d.w, d.h, (GLenum)GL_UNSIGNED_BYTE, format);
+
+    // the texels are in the unpack buffer already, the copy stays on the gpu
+    auto &state = GLState::current();
+    state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+    tex->sub_data(nullptr, 0, 0, 0, d.w, d.h, 1, GL_UNSIGNED_BYTE, format);
+    state.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // gray (and alpha) images sample as rgb(a)
+    const GLint swizzles[][4] = {
+        {GL_RED, GL_RED, GL_RED, GL_ONE},
+        {GL_RED, GL_RED, GL_RED, GL_GREEN},
+        {GL_RED, GL_GREEN, GL_BLUE, GL_ONE},
+        {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA},
+    };
+    if (state.dsa()) {
+        glTextureParameteriv(tex->ID(), GL_TEXTURE_SWIZZLE_RGBA, swizzles[n - 1]);
+    } else {
+        tex->bind();
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzles[n - 1]);
+    }
+    if (tex->parms.uses_mipmaps()) tex->generate_mipmap();
+
+    // free once gl has read the buffer
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.stage = Stage::UPLOADED;
+    slot.image = Decoded();
+    MY_CHECK_FAIL
+}
\ No newline at end of file
@@ -3,7 +3,12 @@
 #include "checkfail.hxx"
 #include "shader_program.hxx"
 
+#include <array>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -48,10 +53,18 @@ namespace glwrapper {
         GLenum min_filt;
         GLenum type;
         void   BindParameter();
+        /// @brief the context's sampler object with these parameters
+        GLuint sampler() const;
+        /// @brief min_filt samples mip levels
+        bool uses_mipmaps() const;
     };
 
-    // default texture format: rgba-rgba
+    // default texture format: rgba-rgba. with GLState::dsa() the storage is immutable: from_data
+    // of a new size replaces the texture (and ID()), of the same size only updates it. a texture
+    // attached to a FrameBufferObject can't be replaced, resize by making a new framebuffer
     class TextureObject {
+        friend class FrameBufferObject;
+
 
         public:
         //
@@ -82,7 +95,7 @@ namespace glwrapper {
         /// @brief validate tex_index, format and type of the texture
         void validate();
 
-        /// @brief wrapper for glActiveTexture (+bind())
+        /// @brief wrapper for glActiveTexture (+bind()), and glBindSampler with dsa
         /// @param at texture index, to override default tex_index
         void activate(GLuint at = -1);
 
@@ -103,6 +116,15 @@ namespace glwrapper {
             void *data, int w, int h, int d, GLenum value_type = GL_NONE,
             GLenum input_format = GL_NONE
         );
+        /// @brief wrapper for glTexSubImage3D (glTexSubImage2D for 2D textures, z and d unused).
+        /// update a box of level 0, allocated before e.g. by from_data(nullptr, ...). mipmaps are
+        /// not regenerated
+        void sub_data(
+            void *data, int x, int y, int z, int w, int h, int d, GLenum value_type = GL_NONE,
+            GLenum input_format = GL_NONE
+        );
+        /// @brief wrapper for glGenerateMipmap, e.g. after sub_data
+        void          generate_mipmap();
         inline GLenum from_data_parse_value_type(GLenum value_type) {
             return value_type == GL_NONE ? format_map[format_].value : value_type;
         };
@@ -110,7 +132,8 @@ namespace glwrapper {
             return input_format == GL_NONE ? format_map[format_].format : input_format;
         }
 
-        /// @brief read 2d texture from file
+        /// @brief read 2d texture from file, decoded on the calling thread. TextureLoader
+        /// decodes in the background
         /// @param filename
         /// @param gen_mipmap
         /// @param save save image data to data_
@@ -119,7 +142,7 @@ namespace glwrapper {
 
         //
         //
-        // gather data
+        // gather data, synchronously: waits for the GPU. see FrameBufferObject::read_async
         std::vector<GLubyte> get_data(int &w, int &h);
 
         //
@@ -138,6 +161,7 @@ namespace glwrapper {
         auto inline name() { return name_; }
         auto inline tex_internal_index() { return tex_index_; }
         auto inline type() { return type_; }
+        auto inline format() { return format_; }
 
         private:
         GLuint      ID_;
@@ -150,6 +174,11 @@ namespace glwrapper {
 
         bool gen_mipmap_;
 
+        // immutable storage of the dsa path, levels_ == 0 until allocated
+        int  width_ = 0, height_ = 0, depth_ = 0, levels_ = 0;
+        bool attached_ = false; // to a FrameBufferObject, which keeps ID_
+        void allocate_storage(int w, int h, int d);
+
         typedef struct {
             GLenum format;
             GLenum value;
@@ -157,6 +186,124 @@ namespace glwrapper {
         static std::map<GLenum, f_v> format_map;
     };
 
+    /// @brief double-buffered 3D texture that is refilled over several frames. start() allocates
+    /// the back texture (once per size), step() pushes depth slabs with glTexSubImage3D until its
+    /// time budget is spent. front() keeps the last presented volume until present() swaps in the
+    /// completed one, so several textures can switch over on the same frame
+    class ProgressiveTexture3D {
+        public:
+        /// @brief source(z0, z1): texels of depth layers [z0, z1), w*h*(z1-z0) of them, valid
+        /// until the next call. called from step(), its time counts against the budget
+        typedef std::function<const void *(int, int)> SlabSource;
+
+        ProgressiveTexture3D(
+            TextureParameter parms = TextureParameter("smooth"), GLenum format = GL_R32F,
+            int slab_depth = 4
+        );
+
+        /// @brief begin refilling the back texture, dropping any unfinished fill
+        void start(
+            int w, int h, int d, SlabSource source, GLenum value_type = GL_NONE,
+            GLenum input_format = GL_NONE
+        );
+        /// @brief upload slabs for about budget_ms, at least one
+        /// @return true when this call completed the volume
+        bool step(double budget_ms);
+        /// @brief swap a completed volume to front(), no-op otherwise
+        void present();
+        /// @brief step until complete, then present
+        inline void finish() {
+            step(std::numeric_limits<double>::infinity());
+            present();
+        }
+
+        /// @brief still uploading
+        inline bool  pending() const { return (bool)source_; }
+        /// @brief complete, waiting for present()
+        inline bool  ready() const { return ready_; }
+        inline float progress() const { return pending() ? (float)z_ / d_ : 1.f; }
+        /// @brief last complete volume, nullptr before the first one
+        inline std::shared_ptr<TextureObject> front() { return has_front_ ? front_ : nullptr; }
+
+        protected:
+        std::shared_ptr<TextureObject> front_, back_;
+
+        SlabSource source_;
+        int        w_ = 0, h_ = 0, d_ = 0, z_ = 0;
+        int        slab_depth_;
+        GLenum     value_type_, input_format_;
+
+        // sizes the textures are allocated with
+        std::array<int, 3> front_size_ = {0, 0, 0}, back_size_ = {0, 0, 0};
+        bool               has_front_  = false;
+        bool               ready_      = false;
+    };
+
+    /// @brief 2D textures from image files decoded on mf::ThreadPool::global(), flipped like
+    /// from_image and with the file's channels. load() returns at once, the texture holding one
+    /// placeholder texel; poll() on the context thread moves what is decoded through a ring of
+    /// fenced pixel unpack buffers: staged on one call, copied into the texture on a later one
+    /// once the fence has signalled, about budget bytes per call. Window::draw polls shared()
+    /// every frame. with GLState::dsa() the texture grows from the placeholder into a new
+    /// texture: ID() read before the upload is stale, read it again when drawing
+    class TextureLoader {
+        public:
+        TextureLoader();
+        ~TextureLoader();
+        TextureLoader(const TextureLoader &) = delete;
+
+        /// @brief loader polled by the framework
+        static TextureLoader &shared();
+
+        /// @brief decode the image at path into tex
+        void load(std::shared_ptr<TextureObject> tex, std::string path);
+        /// @brief decode a compressed image in memory (e.g. embedded in a glb), copied
+        void load(std::shared_ptr<TextureObject> tex, const void *raw_image, size_t size);
+
+        /// @brief copy the staged images whose fence signalled into their textures, then stage
+        /// decoded ones into the free buffers, at least one if any
+        /// @return loads not uploaded yet
+        int poll(size_t budget = 16 << 20);
+        /// @brief wait for and upload every load
+        void finish();
+
+        inline int pending() const { return nb_pending_; }
+
+        // texel shown until the image is uploaded
+        std::array<GLubyte, 4> placeholder = {128, 128, 128, 255};
+
+        protected:
+        struct Decoded {
+            std::weak_ptr<TextureObject>   tex; // not kept alive, nor deleted off the gl thread
+            std::string                    source; // for logs
+            int                            w = 0, h = 0, nb_channels = 0;
+            std::shared_ptr<unsigned char> pixels; // null if decoding failed
+        };
+        // shared with the decoding tasks, which may outlive the loader
+        struct Queue {
+            std::mutex          mutex;
+            std::deque<Decoded> decoded;
+        };
+        std::shared_ptr<Queue> queue_;
+        int                    nb_pending_ = 0;
+
+        // free, then staged: written and fenced, then uploaded: copied to the texture and fenced
+        // again, free once that fence signals
+        enum class Stage { FREE, STAGED, UPLOADED };
+        struct Slot {
+            GLuint  pbo      = 0;
+            size_t  capacity = 0;
+            GLsync  fence    = nullptr;
+            Stage   stage    = Stage::FREE;
+            Decoded image; // pixels released once staged
+        };
+        std::array<Slot, 4> slots_;
+
+        void start(std::shared_ptr<TextureObject> tex, std::function<Decoded()> decode);
+        void stage(Slot &slot, Decoded d);
+        void upload(Slot &slot);
+    };
+
 } // namespace glwrapper
 
 /// @}
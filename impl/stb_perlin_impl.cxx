@@ -1,2 +1,6 @@
 #define STB_PERLIN_IMPLEMENTATION
-#include <stb_perlin.h>
\ No newline at end of file
+#include <stb_perlin.h>
+
+// lattice tables, used by the batched kernel in procedural/perlin_noise.cxx
+extern "C" const unsigned char *stb_perlin_impl_randtab() { return stb__perlin_randtab; }
+extern "C" const unsigned char *stb_perlin_impl_grad_idx() { return stb__perlin_randtab_grad_idx; }
\ No newline at end of file
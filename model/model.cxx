@@ -168,17 +168,19 @@ Model::load_texture_(aiMaterial *material, aiTextureType tp, string name, const
                 name, 0, glwrapper::TextureParameter(), GL_RGBA8, GL_TEXTURE_2D
             );
 
+            // images are decoded in the background and uploaded while the window draws
+            auto &loader = glwrapper::TextureLoader::shared();
             // is embedded tex
             if (!s_path.empty() && s_path[0] == '*') {
                 auto tex = scene->mTextures[std::stoi(s_path.substr(1))];
                 // compressed tex
                 if (tex->mHeight == 0) {
-                    cur_tex->from_image(tex->pcData, tex->mWidth);
+                    loader.load(cur_tex, tex->pcData, tex->mWidth);
                 } else {
                     cur_tex->from_data(tex->pcData, tex->mWidth, tex->mHeight);
                 }
             } else {
-                cur_tex->from_image(s_path);
+                loader.load(cur_tex, s_path);
             }
 
             // pushback
@@ -0,0 +1,245 @@
+#include "gpu_noise.hxx"
+#include "checkfail.hxx"
+#include "gl_state.hxx"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+// defined in impl/stb_perlin_impl.cxx
+extern "C" const unsigned char *stb_perlin_impl_randtab();
+extern "C" const unsigned char *stb_perlin_impl_grad_idx();
+
+using namespace terrain;
+using glwrapper::ShaderProgram;
+using glwrapper::TextureObject;
+using glwrapper::TextureParameter;
+
+// stb_perlin_noise3_seed with wrap 0, and the two lookups of gen_perlin_tex. no #version, shared
+// by the fragment and the compute shader
+std::string GpuNoise::noise_src = "\
+uniform usampler2D perlin_tab; // x: stb randtab, y: stb grad_idx                           \n\
+struct Octave {                                                                           \n\
+    float scale;                                                                          \n\
+    int   seed;                                                                           \n\
+    float amp;                                                                            \n\
+};                                                                                        \n\
+uniform Octave octaves[8];                                                                \n\
+uniform int    nb_octave;                                                                 \n\
+                                                                                          \n\
+const vec3 perlin_basis[12] = vec3[12](                                                   \n\
+    vec3(1, 1, 0), vec3(-1, 1, 0), vec3(1, -1, 0), vec3(-1, -1, 0),                      \n\
+    vec3(1, 0, 1), vec3(-1, 0, 1), vec3(1, 0, -1), vec3(-1, 0, -1),                      \n\
+    vec3(0, 1, 1), vec3(0, -1, 1), vec3(0, 1, -1), vec3(0, -1, -1)                       \n\
+);                                                                                        \n\
+                                                                                          \n\
+int randtab(int i) { return int(texelFetch(perlin_tab, ivec2(i, 0), 0).x); }             \n\
+float grad(int i, float x, float y, float z) {                                            \n\
+    vec3 b = perlin_basis[texelFetch(perlin_tab, ivec2(i, 0), 0).y];                      \n\
+    return b.x * x + b.y * y + b.z * z;                                                   \n\
+}                                                                                         \n\
+// stb's lerp and ease, in its operation order                                            \n\
+float lerp(float a, float b, float t) { return a + (b - a) * t; }                         \n\
+float ease(float a) { return ((a * 6. - 15.) * a + 10.) * a * a * a; }                    \n\
+                                                                                          \n\
+float perlin_noise3(vec3 p, int seed) {                                                   \n\
+    seed     = seed & 255;                                                                \n\
+    ivec3 pi = ivec3(floor(p));                                                           \n\
+    ivec3 c0 = pi & 255, c1 = (pi + 1) & 255;                                             \n\
+    float x = p.x - float(pi.x), y = p.y - float(pi.y), z = p.z - float(pi.z);           \n\
+    float u = ease(x), v = ease(y), w = ease(z);                                          \n\
+                                                                                          \n\
+    int r0  = randtab(c0.x + seed), r1 = randtab(c1.x + seed);                            \n\
+    int r00 = randtab(r0 + c0.y), r01 = randtab(r0 + c1.y);                               \n\
+    int r10 = randtab(r1 + c0.y), r11 = randtab(r1 + c1.y);                               \n\
+                                                                                          \n\
+    float n000 = grad(r00 + c0.z, x, y, z), n001 = grad(r00 + c1.z, x, y, z - 1.);        \n\
+    float n010 = grad(r01 + c0.z, x, y - 1., z), n011 = grad(r01 + c1.z, x, y - 1., z - 1.); \n\
+    float n100 = grad(r10 + c0.z, x - 1., y, z), n101 = grad(r10 + c1.z, x - 1., y, z - 1.); \n\
+    float n110 = grad(r11 + c0.z, x - 1., y - 1., z);                                     \n\
+    float n111 = grad(r11 + c1.z, x - 1., y - 1., z - 1.);                                \n\
+                                                                                          \n\
+    float n0 = lerp(lerp(n000, n001, w), lerp(n010, n011, w), v);                         \n\
+    float n1 = lerp(lerp(n100, n101, w), lerp(n110, n111, w), v);                         \n\
+    return lerp(n0, n1, u);                                                               \n\
+}                                                                                         \n\
+                                                                                          \n\
+// terrain::gen_perlin_tex at voxel idx, offset by a second noise                         \n\
+float perlin_tex(ivec3 idx, float scale, int seed) {                                      \n\
+    vec3  p    = vec3(idx);                                                               \n\
+    float offs = perlin_noise3(p / 10., seed + 5) * .5 + .5;                              \n\
+    return perlin_noise3((p + offs) / scale, seed);                                       \n\
+}                                                                                         \n\
+float fbm(ivec3 idx) {                                                                    \n\
+    float v = 0.;                                                                         \n\
+    for (int l = 0; l < nb_octave; l++) {                                                 \n\
+        v += perlin_tex(idx, octaves[l].scale, octaves[l].seed) * octaves[l].amp;         \n\
+    }                                                                                     \n\
+    return v;                                                                             \n\
+}                                                                                         \n\
+";
+
+// fullscreen triangle
+std::string GpuNoise::vshader = "\
+#version 330 core                                                     \n\
+void main() {                                                         \n\
+    vec2 p      = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);      \n\
+    gl_Position = vec4(p * 2. - 1., 0., 1.);                          \n\
+}                                                                     \n\
+";
+
+// texel (x, y) of layer is voxel (layer, y, x)
+std::string GpuNoise::fshader = "\
+uniform int layer;                                                    \n\
+out float noise;                                                      \n\
+void main() {                                                         \n\
+    ivec2 t = ivec2(gl_FragCoord.xy);                                 \n\
+    noise   = fbm(ivec3(layer, t.y, t.x));                            \n\
+}                                                                     \n\
+";
+
+// IMAGE_FORMAT is replaced by the layout qualifier of the target
+std::string GpuNoise::cshader = "\
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 4) in;      \n\
+layout(IMAGE_FORMAT) uniform writeonly image3D dst;                   \n\
+uniform int width;                                                    \n\
+uniform int height;                                                   \n\
+uniform int layer0;                                                   \n\
+uniform int layer1;                                                   \n\
+void main() {                                                         \n\
+    ivec3 t = ivec3(gl_GlobalInvocationID) + ivec3(0, 0, layer0);     \n\
+    if (t.x >= width || t.y >= height || t.z >= layer1) return;       \n\
+    imageStore(dst, t, vec4(fbm(ivec3(t.z, t.y, t.x))));             \n\
+}                                                                     \n\
+";
+
+GpuNoise::GpuNoise(GPU_NOISE_BACKEND backend) {
+    if (backend == GPU_NOISE_AUTO) {
+        backend = compute_supported() ? GPU_NOISE_COMPUTE : GPU_NOISE_FRAGMENT;
+    }
+    if (backend == GPU_NOISE_COMPUTE && !compute_supported()) {
+        spdlog::warn("GpuNoise::GpuNoise: no GL 4.3, using the fragment backend");
+        backend = GPU_NOISE_FRAGMENT;
+    }
+    backend_ = backend;
+    spdlog::info(
+        "GpuNoise::GpuNoise: {} backend", backend_ == GPU_NOISE_COMPUTE ? "compute" : "fragment"
+    );
+
+    std::vector<unsigned char> tables(512 * 2);
+    auto                       r = stb_perlin_impl_randtab();
+    auto                       g = stb_perlin_impl_grad_idx();
+    for (int i = 0; i < 512; i++) {
+        tables[2 * i]     = r[i];
+        tables[2 * i + 1] = g[i];
+    }
+    tables_ = std::make_shared<TextureObject>(
+        "", 0, TextureParameter("discrete"), GL_RG8UI, GL_TEXTURE_2D
+    );
+    tables_->from_data(tables.data(), 512, 1);
+
+    if (backend_ == GPU_NOISE_FRAGMENT) {
+        prog_ = std::make_shared<ShaderProgram>(
+            vshader, "#version 330 core\n" + noise_src + fshader
+        );
+        glGenFramebuffers(1, &fbo_);
+    }
+    MY_CHECK_FAIL
+}
+
+GpuNoise::~GpuNoise() {
+    if (fbo_) {
+        glwrapper::GLState::current().forget_framebuffer(fbo_);
+        glDeleteFramebuffers(1, &fbo_);
+    }
+}
+
+bool GpuNoise::compute_supported() { return GLAD_GL_VERSION_4_3; }
+
+void GpuNoise::set_noise_uniforms(ShaderProgram &prog, const std::vector<NoiseOctave> &octaves) {
+    if (octaves.size() > max_octaves) {
+        spdlog::error("GpuNoise::generate: {} octaves, at most {}", octaves.size(), max_octaves);
+        exit(-1);
+    }
+    prog.set_value("nb_octave", (int)octaves.size());
+    for (int l = 0; l < octaves.size(); l++) {
+        prog.set_value(fmt::format("octaves[{}].scale", l), octaves[l].scale);
+        prog.set_value(fmt::format("octaves[{}].seed", l), octaves[l].seed);
+        prog.set_value(fmt::format("octaves[{}].amp", l), octaves[l].amp);
+    }
+    // above any unit the caller may have bound
+    tables_->activate(15);
+    prog.set_value("perlin_tab", 15);
+}
+
+void GpuNoise::generate(
+    TextureObject &dst, int dimX, int dimY, int dimZ, const std::vector<NoiseOctave> &octaves,
+    int x0, int x1
+) {
+    MY_CHECK_FAIL
+    if (x1 < 0) x1 = dimX;
+    assert(0 <= x0 && x0 <= x1 && x1 <= dimX);
+    assert(dst.type() == GL_TEXTURE_3D);
+    if (x0 == x1) return;
+
+    if (dst.format() != GL_R32F && dst.format() != GL_R16F) {
+        spdlog::error("GpuNoise::generate: unsupported texture format {}", dst.format());
+        exit(-1);
+    }
+
+    if (backend_ == GPU_NOISE_COMPUTE) {
+        auto &prog = compute_progs_[dst.format()];
+        if (!prog) {
+            auto src = cshader;
+            src.replace(src.find("IMAGE_FORMAT"), 12, dst.format() == GL_R32F ? "r32f" : "r16f");
+            prog = ShaderProgram::compute("#version 430 core\n" + noise_src + src);
+        }
+        set_noise_uniforms(*prog, octaves);
+        prog->set_value("width", dimZ);
+        prog->set_value("height", dimY);
+        prog->set_value("layer0", x0);
+        prog->set_value("layer1", x1);
+
+        glBindImageTexture(0, dst.ID(), 0, GL_TRUE, 0, GL_WRITE_ONLY, dst.format());
+        prog->set_value("dst", 0);
+        glDispatchCompute((dimZ + 7) / 8, (dimY + 7) / 8, (x1 - x0 + 3) / 4);
+        // visible to samplers and to later uploads/readbacks
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+        MY_CHECK_FAIL
+        return;
+    }
+
+    // fragment: keep the caller's framebuffer, viewport and blending
+    GLint     prev_fbo, viewport[4];
+    auto     &state = glwrapper::GLState::current();
+    GLboolean blend = glIsEnabled(GL_BLEND), depth = glIsEnabled(GL_DEPTH_TEST);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    state.set_enabled(GL_BLEND, false);
+    state.set_enabled(GL_DEPTH_TEST, false);
+
+    set_noise_uniforms(*prog_, octaves);
+    state.bind_framebuffer(fbo_);
+    state.viewport(0, 0, dimZ, dimY);
+    vao_.bind();
+    for (int i = x0; i < x1; i++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst.ID(), 0, i);
+        if (i == x0 && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            spdlog::error("GpuNoise::generate: incomplete framebuffer");
+            exit(-1);
+        }
+        prog_->set_value("layer", i);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    vao_.unbind();
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+
+    state.bind_framebuffer(prev_fbo);
+    state.viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    state.set_enabled(GL_BLEND, blend);
+    state.set_enabled(GL_DEPTH_TEST, depth);
+    MY_CHECK_FAIL
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "buffer_objects.hxx"
+#include "shader_program.hxx"
+#include "texture_objects.hxx"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// gen_perlin_tex/add_perlin_tex on the GPU, written straight into a 3D texture: no CPU generation
+// and no upload. the shaders repeat stb_perlin on stb's own tables, so the result matches the CPU
+// generators up to float rounding of the GPU (examples/ray_marching/check_gpu_noise)
+
+namespace terrain {
+
+    enum GPU_NOISE_BACKEND {
+        GPU_NOISE_AUTO     = -1, // compute when the context has GL 4.3, else fragment
+        GPU_NOISE_FRAGMENT = 0,  // one fullscreen triangle per layer into a framebuffer
+        GPU_NOISE_COMPUTE  = 1,  // one dispatch over all layers, imageStore
+    };
+
+    /// @brief amp * gen_perlin_tex(..., scale, seed), one term of GpuNoise::generate. not
+    /// tileable
+    struct NoiseOctave {
+        float scale;
+        int   seed;
+        float amp = 1;
+    };
+
+    /// @brief GPU noise generator. needs a current GL context for its whole lifetime
+    class GpuNoise {
+        public:
+        constexpr static int max_octaves = 8;
+
+        GpuNoise(GPU_NOISE_BACKEND backend = GPU_NOISE_AUTO);
+        GpuNoise(const GpuNoise &) = delete;
+        ~GpuNoise();
+
+        /// @brief texel (k, j, i) of dst = sum of amp * gen_perlin_tex(dimX, dimY, dimZ, scale,
+        /// seed)[i, j, k] over the octaves, for depth layers i in [x0, x1) (x1 < 0: to dimX).
+        /// dst is a 3D GL_R32F or GL_R16F texture allocated as from_data(nullptr, dimZ, dimY,
+        /// dimX); mipmaps are not regenerated
+        void generate(
+            glwrapper::TextureObject &dst, int dimX, int dimY, int dimZ,
+            const std::vector<NoiseOctave> &octaves, int x0 = 0, int x1 = -1
+        );
+
+        inline GPU_NOISE_BACKEND backend() const { return backend_; }
+        /// @brief GL 4.3 compute shaders and image load/store
+        static bool compute_supported();
+
+        protected:
+        GPU_NOISE_BACKEND backend_;
+
+        // stb randtab and grad_idx side by side, GL_RG8UI 512x1
+        std::shared_ptr<glwrapper::TextureObject> tables_;
+
+        // fragment backend
+        std::shared_ptr<glwrapper::ShaderProgram> prog_;
+        glwrapper::VertexArrayObject              vao_; // empty, the triangle is gl_VertexID
+        GLuint                                    fbo_ = 0;
+
+        // compute backend, by image format
+        std::map<GLenum, std::shared_ptr<glwrapper::ShaderProgram>> compute_progs_;
+
+        void set_noise_uniforms(
+            glwrapper::ShaderProgram &prog, const std::vector<NoiseOctave> &octaves
+        );
+
+        static std::string noise_src;
+        static std::string vshader;
+        static std::string fshader;
+        static std::string cshader;
+    };
+
+} // namespace terrain
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "heightfield.hxx"
+#include "simd.hxx"
+#include "volumetric_cloud.hxx"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace terrain;
+
+namespace {
+    // lower and upper texel of one axis and the offset between them, for p in texels from the
+    // first texel center. the scalar reference of axis8
+    inline void axis(float p, int n, bool wrap, int &i0, int &i1, float &d) {
+        float f = std::floor(p);
+        d       = p - f;
+        if (wrap) {
+            float w = f - std::floor(f / n) * n;
+            i0      = (int)w;
+            if (i0 >= n) i0 -= n;
+            if (i0 < 0) i0 += n;
+            i1 = i0 + 1 == n ? 0 : i0 + 1;
+        } else {
+            int fi = (int)std::clamp(f, -1.f, (float)(n - 1));
+            i0     = std::max(fi, 0);
+            i1     = std::min(fi + 1, n - 1);
+        }
+    }
+
+    // glm::mix: a * (1 - t) + b * t
+    inline float mix(float a, float b, float t) { return a * (1 - t) + b * t; }
+
+#if SIMD_X86
+    // avx2: 8 queries, same arithmetic as Heightfield::sample's scalar loop so results are
+    // bit-identical
+
+    SIMD_TARGET("avx2")
+    inline __m256 mix8(__m256 a, __m256 b, __m256 t) {
+        return _mm256_add_ps(
+            _mm256_mul_ps(a, _mm256_sub_ps(_mm256_set1_ps(1.f), t)), _mm256_mul_ps(b, t)
+        );
+    }
+    SIMD_TARGET("avx2")
+    inline void axis8(__m256 p, int n, bool wrap, __m256i &i0, __m256i &i1, __m256 &d) {
+        __m256  f  = _mm256_floor_ps(p);
+        __m256i vn = _mm256_set1_epi32(n), one = _mm256_set1_epi32(1);
+        d          = _mm256_sub_ps(p, f);
+        if (wrap) {
+            __m256 fn = _mm256_set1_ps((float)n);
+            __m256 w  = _mm256_sub_ps(f, _mm256_mul_ps(_mm256_floor_ps(_mm256_div_ps(f, fn)), fn));
+            i0        = _mm256_cvttps_epi32(w);
+            // i0 -= n where i0 >= n, += n where i0 < 0
+            __m256i ge = _mm256_cmpgt_epi32(i0, _mm256_sub_epi32(vn, one));
+            i0         = _mm256_sub_epi32(i0, _mm256_and_si256(ge, vn));
+            __m256i lt = _mm256_cmpgt_epi32(_mm256_setzero_si256(), i0);
+            i0         = _mm256_add_epi32(i0, _mm256_and_si256(lt, vn));
+            i1         = _mm256_add_epi32(i0, one);
+            i1         = _mm256_andnot_si256(_mm256_cmpeq_epi32(i1, vn), i1);
+        } else {
+            f = _mm256_min_ps(_mm256_max_ps(f, _mm256_set1_ps(-1.f)), _mm256_set1_ps(n - 1.f));
+            __m256i fi = _mm256_cvttps_epi32(f);
+            i0         = _mm256_max_epi32(fi, _mm256_setzero_si256());
+            i1         = _mm256_min_epi32(_mm256_add_epi32(fi, one), _mm256_sub_epi32(vn, one));
+        }
+    }
+    SIMD_TARGET("avx2")
+    inline __m256 bilinear8(
+        const float *data, __m256i i00, __m256i i01, __m256i i10, __m256i i11, __m256 dx,
+        __m256 dz
+    ) {
+        __m256 c00 = _mm256_i32gather_ps(data, i00, 4);
+        __m256 c01 = _mm256_i32gather_ps(data, i01, 4);
+        __m256 c10 = _mm256_i32gather_ps(data, i10, 4);
+        __m256 c11 = _mm256_i32gather_ps(data, i11, 4);
+        return mix8(mix8(c00, c01, dx), mix8(c10, c11, dx), dz);
+    }
+
+    SIMD_TARGET("avx2")
+    void sample8_avx2(
+        const float *heights, const float *slope_x, const float *slope_z, int rows, int cols,
+        bool wrap, glm::vec2 origin, float spacing, float base, const float *px, const float *pz,
+        float *out_h, glm::vec3 *out_n
+    ) {
+        __m256 half = _mm256_set1_ps(.5f), sp = _mm256_set1_ps(spacing);
+        __m256 u    = _mm256_sub_ps(
+            _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(px), _mm256_set1_ps(origin.x)), sp), half
+        );
+        __m256 v = _mm256_sub_ps(
+            _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(pz), _mm256_set1_ps(origin.y)), sp), half
+        );
+
+        __m256i s0, s1, t0, t1;
+        __m256  dx, dz;
+        axis8(u, cols, wrap, s0, s1, dx);
+        axis8(v, rows, wrap, t0, t1, dz);
+        __m256i c   = _mm256_set1_epi32(cols);
+        __m256i r0  = _mm256_mullo_epi32(t0, c), r1 = _mm256_mullo_epi32(t1, c);
+        __m256i i00 = _mm256_add_epi32(r0, s0), i01 = _mm256_add_epi32(r0, s1);
+        __m256i i10 = _mm256_add_epi32(r1, s0), i11 = _mm256_add_epi32(r1, s1);
+
+        __m256 h = bilinear8(heights, i00, i01, i10, i11, dx, dz);
+        _mm256_storeu_ps(out_h, _mm256_add_ps(h, _mm256_set1_ps(base)));
+        if (!out_n) return;
+
+        __m256 sx  = bilinear8(slope_x, i00, i01, i10, i11, dx, dz);
+        __m256 sz  = bilinear8(slope_z, i00, i01, i10, i11, dx, dz);
+        __m256 len = _mm256_sqrt_ps(_mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(sx, sx), _mm256_set1_ps(1.f)), _mm256_mul_ps(sz, sz)
+        ));
+        alignas(32) float nx[8], ny[8], nz[8];
+        __m256            neg = _mm256_set1_ps(-0.f);
+        _mm256_store_ps(nx, _mm256_div_ps(_mm256_xor_ps(sx, neg), len));
+        _mm256_store_ps(ny, _mm256_div_ps(_mm256_set1_ps(1.f), len));
+        _mm256_store_ps(nz, _mm256_div_ps(_mm256_xor_ps(sz, neg), len));
+        for (int k = 0; k < 8; k++) {
+            out_n[k] = glm::vec3(nx[k], ny[k], nz[k]);
+        }
+    }
+#endif // SIMD_X86
+} // namespace
+
+Heightfield::Heightfield(
+    const Array3D<float> &heights, glm::vec2 origin, float spacing, float base, bool wrap
+) :
+    origin_(origin), spacing_(spacing), base_(base), wrap_(wrap) {
+    auto shape = heights.shape();
+    assert(shape[2] == 1 && spacing > 0);
+    rows_ = shape[0];
+    cols_ = shape[1];
+
+    // slopes in meters per meter
+    auto slopes = gen_slope_map(heights, 1 / (2 * spacing), wrap);
+    heights_.resize((size_t)rows_ * cols_);
+    slope_x_.resize(heights_.size());
+    slope_z_.resize(heights_.size());
+    for (int t = 0; t < rows_; t++) {
+        for (int s = 0; s < cols_; s++) {
+            size_t i    = (size_t)t * cols_ + s;
+            heights_[i] = heights.at(t, s, 0);
+            slope_x_[i] = slopes.at(t, s, 0).x;
+            slope_z_[i] = slopes.at(t, s, 0).y;
+        }
+    }
+}
+
+float Heightfield::height_at(glm::vec2 xz) const {
+    float h;
+    sample(&xz.x, &xz.y, &h, nullptr, 1);
+    return h;
+}
+
+glm::vec3 Heightfield::normal_at(glm::vec2 xz) const {
+    float     h;
+    glm::vec3 n;
+    sample(&xz.x, &xz.y, &h, &n, 1);
+    return n;
+}
+
+void Heightfield::sample(
+    const float *x, const float *z, float *out_h, glm::vec3 *out_n, int n
+) const {
+    if (empty()) {
+        std::fill(out_h, out_h + n, base_);
+        if (out_n) std::fill(out_n, out_n + n, glm::vec3(0, 1, 0));
+        return;
+    }
+
+    int i = 0;
+#if SIMD_X86
+    if (simd_has_avx2()) {
+        for (; i + 8 <= n; i += 8) {
+            sample8_avx2(
+                heights_.data(), slope_x_.data(), slope_z_.data(), rows_, cols_, wrap_, origin_,
+                spacing_, base_, x + i, z + i, out_h + i, out_n ? out_n + i : nullptr
+            );
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        int   s0, s1, t0, t1;
+        float dx, dz;
+        axis((x[i] - origin_.x) / spacing_ - .5f, cols_, wrap_, s0, s1, dx);
+        axis((z[i] - origin_.y) / spacing_ - .5f, rows_, wrap_, t0, t1, dz);
+        size_t i00 = (size_t)t0 * cols_ + s0, i01 = (size_t)t0 * cols_ + s1;
+        size_t i10 = (size_t)t1 * cols_ + s0, i11 = (size_t)t1 * cols_ + s1;
+
+        auto bilinear = [&](const std::vector<float> &d) {
+            return mix(mix(d[i00], d[i01], dx), mix(d[i10], d[i11], dx), dz);
+        };
+        out_h[i] = bilinear(heights_) + base_;
+        if (!out_n) continue;
+
+        float sx  = bilinear(slope_x_);
+        float sz  = bilinear(slope_z_);
+        float len = std::sqrt(sx * sx + 1.f + sz * sz);
+        out_n[i]  = glm::vec3(-sx / len, 1.f / len, -sz / len);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.hxx"
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace terrain {
+
+    /// @brief host copy of a heightmap kept after its upload, for height and normal queries on the
+    /// CPU, e.g. placing props on the ground without reading the GPU back. immutable once built:
+    /// the queries are const and take no lock, any number of threads may run them at once
+    class Heightfield {
+        public:
+        Heightfield() = default;
+        /// @param heights (rows, cols, 1), row t along world z and column s along x, as uploaded
+        /// with from_data(data, cols, rows)
+        /// @param origin world xz of the map's corner: texel (t, s) is centered at origin +
+        /// (s + .5, t + .5) * spacing
+        /// @param spacing meters per texel
+        /// @param base world y of height 0
+        /// @param wrap repeat the map (tileable), else clamp to the border like GL_CLAMP_TO_EDGE
+        Heightfield(
+            const Array3D<float> &heights, glm::vec2 origin, float spacing, float base = 0,
+            bool wrap = true
+        );
+
+        /// @brief world y at world xz, bilinear like GL_LINEAR at mip 0
+        float height_at(glm::vec2 xz) const;
+        /// @brief unit normal at world xz from the bilinear slopes of gen_slope_map, continuous
+        /// unlike the faces of the bilinear surface
+        glm::vec3 normal_at(glm::vec2 xz) const;
+        /// @brief out_h[i] = height_at({x[i], z[i]}), and out_n[i] = normal_at(...) unless out_n is
+        /// null. 8 points per step by AVX2 gathers when the cpu has it, the same results as the
+        /// scalar queries
+        void sample(const float *x, const float *z, float *out_h, glm::vec3 *out_n, int n) const;
+
+        inline bool empty() const { return heights_.empty(); }
+        inline int  rows() const { return rows_; }
+        inline int  cols() const { return cols_; }
+
+        protected:
+        int       rows_ = 0, cols_ = 0;
+        glm::vec2 origin_  = glm::vec2(0);
+        float     spacing_ = 1, base_ = 0;
+        bool      wrap_    = true;
+
+        // row-major, slopes split by axis for the gathers
+        std::vector<float> heights_;
+        std::vector<float> slope_x_;
+        std::vector<float> slope_z_;
+    };
+
+} // namespace terrain
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "mapped_file.hxx"
+
+#include <cstdint>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace terrain;
+
+MappedFile::MappedFile(const std::string &path, MAP_MODE mode, size_t size) : path_(path) {
+    bool create = mode == MAP_CREATE || mode == MAP_TEMPORARY;
+    bool write  = mode != MAP_READ_ONLY && mode != MAP_PRIVATE_RW;
+    bool cow    = mode == MAP_PRIVATE_RW;
+
+#ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (mode == MAP_TEMPORARY) flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+
+    HANDLE file = CreateFileA(
+        path.c_str(), GENERIC_READ | (write ? GENERIC_WRITE : 0), FILE_SHARE_READ, NULL,
+        create ? CREATE_ALWAYS : OPEN_EXISTING, flags, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        spdlog::error("MappedFile: cannot open {} ({})", path, GetLastError());
+        exit(-1);
+    }
+    file_ = file;
+
+    if (!create) {
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        size = (size_t)file_size.QuadPart;
+    }
+    size_ = size;
+    if (size_ == 0) return;
+
+    // creating the mapping also extends the file, zero-filled
+    HANDLE mapping = CreateFileMappingA(
+        file, NULL, write ? PAGE_READWRITE : (cow ? PAGE_WRITECOPY : PAGE_READONLY),
+        (DWORD)((uint64_t)size_ >> 32), (DWORD)(size_ & 0xffffffff), NULL
+    );
+    if (!mapping) {
+        spdlog::error("MappedFile: cannot map {} ({})", path, GetLastError());
+        exit(-1);
+    }
+    mapping_ = mapping;
+
+    data_ = MapViewOfFile(
+        mapping, write ? FILE_MAP_WRITE : (cow ? FILE_MAP_COPY : FILE_MAP_READ), 0, 0, size_
+    );
+    if (!data_) {
+        spdlog::error("MappedFile: cannot map view of {} ({})", path, GetLastError());
+        exit(-1);
+    }
+#else
+    int flags = write ? O_RDWR : O_RDONLY;
+    if (create) flags |= O_CREAT | O_TRUNC;
+
+    fd_ = open(path.c_str(), flags, 0644);
+    if (fd_ < 0) {
+        spdlog::error("MappedFile: cannot open {}", path);
+        exit(-1);
+    }
+
+    if (create) {
+        // sparse, zero-filled
+        if (ftruncate(fd_, (off_t)size) != 0) {
+            spdlog::error("MappedFile: cannot resize {} to {} bytes", path, size);
+            exit(-1);
+        }
+    } else {
+        struct stat st;
+        fstat(fd_, &st);
+        size = (size_t)st.st_size;
+    }
+    // the mapping keeps the data alive
+    if (mode == MAP_TEMPORARY) unlink(path.c_str());
+
+    size_ = size;
+    if (size_ == 0) return;
+
+    data_ = mmap(
+        nullptr, size_, PROT_READ | (write || cow ? PROT_WRITE : 0), cow ? MAP_PRIVATE : MAP_SHARED,
+        fd_, 0
+    );
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        spdlog::error("MappedFile: cannot map {}", path);
+        exit(-1);
+    }
+#endif
+
+    spdlog::debug("MappedFile: {} mapped, {} bytes", path, size_);
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle((HANDLE)mapping_);
+    if (file_) CloseHandle((HANDLE)file_);
+#else
+    if (data_) munmap(data_, size_);
+    if (fd_ >= 0) close(fd_);
+#endif
+}
+
+void MappedFile::flush() {
+    if (!data_) return;
+#ifdef _WIN32
+    FlushViewOfFile(data_, 0);
+#else
+    msync(data_, size_, MS_SYNC);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "types.hxx"
+
+#include <memory>
+#include <string>
+
+namespace terrain {
+
+    enum MAP_MODE {
+        MAP_READ_ONLY  = 0, // existing file, writes fault
+        MAP_READ_WRITE = 1, // existing file
+        MAP_CREATE     = 2, // created or truncated to size, zero-filled
+        MAP_TEMPORARY  = 3, // as MAP_CREATE, the file is removed once unmapped
+        MAP_PRIVATE_RW = 4, // existing file, writes stay in memory and never reach the file
+    };
+
+    /// @brief a whole file mapped into memory. pages are loaded on access and written back by the
+    /// OS, so the resident size stays well below the file size
+    class MappedFile {
+        public:
+        /// @param size bytes, MAP_CREATE/MAP_TEMPORARY only. the others map the file as is
+        MappedFile(const std::string &path, MAP_MODE mode, size_t size = 0);
+        MappedFile(const MappedFile &) = delete;
+        ~MappedFile();
+
+        inline void       *data() const { return data_; }
+        inline size_t      size() const { return size_; }
+        inline std::string path() const { return path_; }
+
+        /// @brief write dirty pages back now
+        void flush();
+
+        protected:
+        std::string path_;
+        void       *data_ = nullptr;
+        size_t      size_ = 0;
+#ifdef _WIN32
+        void *file_    = nullptr;
+        void *mapping_ = nullptr;
+#else
+        int fd_ = -1;
+#endif
+    };
+
+    /// @brief Array3D on a file mapping instead of the heap. indexing, expressions and the
+    /// generators work on it in place. read modes expect exactly the volume's size in the file
+    template<typename T, typename Layout = LinearLayout>
+    Array3D<T, Layout>
+    mapped_array3d(const std::string &path, int dimX, int dimY, int dimZ, MAP_MODE mode) {
+        size_t n    = Layout(dimX, dimY, dimZ).size();
+        auto   file = std::make_shared<MappedFile>(path, mode, n * sizeof(T));
+        if (file->size() != n * sizeof(T)) {
+            spdlog::error(
+                "terrain::mapped_array3d: {} has {} bytes, expected {}", path, file->size(),
+                n * sizeof(T)
+            );
+            exit(-1);
+        }
+        auto storage = Array3DStorage<T>(reinterpret_cast<T *>(file->data()), n, file);
+        return Array3D<T, Layout>(dimX, dimY, dimZ, std::move(storage));
+    }
+
+} // namespace terrain
\ No newline at end of file
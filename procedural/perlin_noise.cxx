@@ -1,2 +1,366 @@
 #include "perlin_noise.hxx"
+#include "simd.hxx"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+#include <stb_perlin.h>
+
+// defined in impl/stb_perlin_impl.cxx
+extern "C" const unsigned char *stb_perlin_impl_randtab();
+extern "C" const unsigned char *stb_perlin_impl_grad_idx();
+
+using namespace terrain;
+
+namespace {
+
+    // stb tables widened to int32 for gathers, gradient basis split by component
+    struct PerlinTables {
+        alignas(32) int32_t randtab[512];
+        alignas(32) int32_t grad_idx[512];
+        alignas(32) float basis[3][16];
+
+        PerlinTables() {
+            const float b[12][3] = {
+                {1, 1, 0},  {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0}, //
+                {1, 0, 1},  {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1}, //
+                {0, 1, 1},  {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+            };
+            auto r = stb_perlin_impl_randtab();
+            auto g = stb_perlin_impl_grad_idx();
+            for (int i = 0; i < 512; i++) {
+                randtab[i]  = r[i];
+                grad_idx[i] = g[i];
+            }
+            for (int c = 0; c < 3; c++) {
+                for (int i = 0; i < 16; i++) {
+                    basis[c][i] = i < 12 ? b[i][c] : 0;
+                }
+            }
+        }
+    };
+    const PerlinTables &tables() {
+        static PerlinTables t;
+        return t;
+    }
+
+    PERLIN_BACKEND detect_backend() {
+#if SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return PERLIN_AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return PERLIN_SSE4;
+#elif SIMD_X86 && defined(__AVX2__)
+        return PERLIN_AVX2;
+#endif
+        return PERLIN_SCALAR;
+    }
+
+    std::atomic<int> backend{PERLIN_AUTO};
+
+    struct Lattice {
+        int           x_mask, y_mask, z_mask;
+        unsigned char seed;
+    };
+
+#if SIMD_X86
+
+    //
+    // avx2: 8 points, gathers
+
+    SIMD_TARGET("avx2")
+    inline __m256 ease8(__m256 a) {
+        // ((a*6-15)*a + 10) * a * a * a
+        __m256 r = _mm256_sub_ps(_mm256_mul_ps(a, _mm256_set1_ps(6)), _mm256_set1_ps(15));
+        r        = _mm256_add_ps(_mm256_mul_ps(r, a), _mm256_set1_ps(10));
+        return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(r, a), a), a);
+    }
+    SIMD_TARGET("avx2")
+    inline __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+        return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+    }
+    SIMD_TARGET("avx2")
+    inline __m256
+    grad8(const PerlinTables &t, __m256i r, __m256i zi, __m256 x, __m256 y, __m256 z) {
+        __m256i g  = _mm256_i32gather_epi32(t.grad_idx, _mm256_add_epi32(r, zi), 4);
+        __m256  gx = _mm256_i32gather_ps(t.basis[0], g, 4);
+        __m256  gy = _mm256_i32gather_ps(t.basis[1], g, 4);
+        __m256  gz = _mm256_i32gather_ps(t.basis[2], g, 4);
+        return _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y)), _mm256_mul_ps(gz, z)
+        );
+    }
+    SIMD_TARGET("avx2")
+    inline void floor8(__m256 &v, __m256i &iv) {
+        iv        = _mm256_cvttps_epi32(v);
+        __m256 lt = _mm256_cmp_ps(v, _mm256_cvtepi32_ps(iv), _CMP_LT_OQ);
+        iv        = _mm256_add_epi32(iv, _mm256_castps_si256(lt)); // -1 where v < trunc(v)
+        v         = _mm256_sub_ps(v, _mm256_cvtepi32_ps(iv));
+    }
+
+    SIMD_TARGET("avx2")
+    void noise8_avx2(
+        const PerlinTables &t, const Lattice &lat, const float *px, const float *py,
+        const float *pz, float *out
+    ) {
+        __m256  x = _mm256_loadu_ps(px), y = _mm256_loadu_ps(py), z = _mm256_loadu_ps(pz);
+        __m256i ix, iy, iz;
+        floor8(x, ix);
+        floor8(y, iy);
+        floor8(z, iz);
+
+        __m256i one = _mm256_set1_epi32(1);
+        __m256i xm = _mm256_set1_epi32(lat.x_mask), ym = _mm256_set1_epi32(lat.y_mask),
+                zm = _mm256_set1_epi32(lat.z_mask);
+        __m256i x0 = _mm256_and_si256(ix, xm);
+        __m256i x1 = _mm256_and_si256(_mm256_add_epi32(ix, one), xm);
+        __m256i y0 = _mm256_and_si256(iy, ym);
+        __m256i y1 = _mm256_and_si256(_mm256_add_epi32(iy, one), ym);
+        __m256i z0 = _mm256_and_si256(iz, zm);
+        __m256i z1 = _mm256_and_si256(_mm256_add_epi32(iz, one), zm);
+
+        __m256 u = ease8(x), v = ease8(y), w = ease8(z);
+
+        __m256i seed = _mm256_set1_epi32(lat.seed);
+        __m256i r0   = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(x0, seed), 4);
+        __m256i r1   = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(x1, seed), 4);
+        __m256i r00  = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(r0, y0), 4);
+        __m256i r01  = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(r0, y1), 4);
+        __m256i r10  = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(r1, y0), 4);
+        __m256i r11  = _mm256_i32gather_epi32(t.randtab, _mm256_add_epi32(r1, y1), 4);
+
+        __m256 c1 = _mm256_set1_ps(1);
+        __m256 xs = _mm256_sub_ps(x, c1), ys = _mm256_sub_ps(y, c1), zs = _mm256_sub_ps(z, c1);
+
+        __m256 n000 = grad8(t, r00, z0, x, y, z);
+        __m256 n001 = grad8(t, r00, z1, x, y, zs);
+        __m256 n010 = grad8(t, r01, z0, x, ys, z);
+        __m256 n011 = grad8(t, r01, z1, x, ys, zs);
+        __m256 n100 = grad8(t, r10, z0, xs, y, z);
+        __m256 n101 = grad8(t, r10, z1, xs, y, zs);
+        __m256 n110 = grad8(t, r11, z0, xs, ys, z);
+        __m256 n111 = grad8(t, r11, z1, xs, ys, zs);
+
+        __m256 n00 = lerp8(n000, n001, w);
+        __m256 n01 = lerp8(n010, n011, w);
+        __m256 n10 = lerp8(n100, n101, w);
+        __m256 n11 = lerp8(n110, n111, w);
+
+        __m256 n0 = lerp8(n00, n01, v);
+        __m256 n1 = lerp8(n10, n11, v);
+
+        _mm256_storeu_ps(out, lerp8(n0, n1, u));
+    }
+
+    //
+    // sse4.1: 4 points, table lookups lane by lane
+
+    SIMD_TARGET("sse4.1")
+    inline __m128 ease4(__m128 a) {
+        __m128 r = _mm_sub_ps(_mm_mul_ps(a, _mm_set1_ps(6)), _mm_set1_ps(15));
+        r        = _mm_add_ps(_mm_mul_ps(r, a), _mm_set1_ps(10));
+        return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(r, a), a), a);
+    }
+    SIMD_TARGET("sse4.1")
+    inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+    }
+    SIMD_TARGET("sse4.1")
+    inline __m128i lookup4(const int32_t *table, __m128i idx) {
+        return _mm_setr_epi32(
+            table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+            table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]
+        );
+    }
+    SIMD_TARGET("sse4.1")
+    inline __m128 lookup4(const float *table, __m128i idx) {
+        return _mm_setr_ps(
+            table[_mm_extract_epi32(idx, 0)], table[_mm_extract_epi32(idx, 1)],
+            table[_mm_extract_epi32(idx, 2)], table[_mm_extract_epi32(idx, 3)]
+        );
+    }
+    SIMD_TARGET("sse4.1")
+    inline __m128
+    grad4(const PerlinTables &t, __m128i r, __m128i zi, __m128 x, __m128 y, __m128 z) {
+        __m128i g  = lookup4(t.grad_idx, _mm_add_epi32(r, zi));
+        __m128  gx = lookup4(t.basis[0], g);
+        __m128  gy = lookup4(t.basis[1], g);
+        __m128  gz = lookup4(t.basis[2], g);
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)), _mm_mul_ps(gz, z));
+    }
+    SIMD_TARGET("sse4.1")
+    inline void floor4(__m128 &v, __m128i &iv) {
+        iv        = _mm_cvttps_epi32(v);
+        __m128 lt = _mm_cmplt_ps(v, _mm_cvtepi32_ps(iv));
+        iv        = _mm_add_epi32(iv, _mm_castps_si128(lt));
+        v         = _mm_sub_ps(v, _mm_cvtepi32_ps(iv));
+    }
+
+    SIMD_TARGET("sse4.1")
+    void noise4_sse4(
+        const PerlinTables &t, const Lattice &lat, const float *px, const float *py,
+        const float *pz, float *out
+    ) {
+        __m128  x = _mm_loadu_ps(px), y = _mm_loadu_ps(py), z = _mm_loadu_ps(pz);
+        __m128i ix, iy, iz;
+        floor4(x, ix);
+        floor4(y, iy);
+        floor4(z, iz);
+
+        __m128i one = _mm_set1_epi32(1);
+        __m128i xm = _mm_set1_epi32(lat.x_mask), ym = _mm_set1_epi32(lat.y_mask),
+                zm = _mm_set1_epi32(lat.z_mask);
+        __m128i x0 = _mm_and_si128(ix, xm), x1 = _mm_and_si128(_mm_add_epi32(ix, one), xm);
+        __m128i y0 = _mm_and_si128(iy, ym), y1 = _mm_and_si128(_mm_add_epi32(iy, one), ym);
+        __m128i z0 = _mm_and_si128(iz, zm), z1 = _mm_and_si128(_mm_add_epi32(iz, one), zm);
+
+        __m128 u = ease4(x), v = ease4(y), w = ease4(z);
+
+        __m128i seed = _mm_set1_epi32(lat.seed);
+        __m128i r0   = lookup4(t.randtab, _mm_add_epi32(x0, seed));
+        __m128i r1   = lookup4(t.randtab, _mm_add_epi32(x1, seed));
+        __m128i r00  = lookup4(t.randtab, _mm_add_epi32(r0, y0));
+        __m128i r01  = lookup4(t.randtab, _mm_add_epi32(r0, y1));
+        __m128i r10  = lookup4(t.randtab, _mm_add_epi32(r1, y0));
+        __m128i r11  = lookup4(t.randtab, _mm_add_epi32(r1, y1));
+
+        __m128 c1 = _mm_set1_ps(1);
+        __m128 xs = _mm_sub_ps(x, c1), ys = _mm_sub_ps(y, c1), zs = _mm_sub_ps(z, c1);
+
+        __m128 n000 = grad4(t, r00, z0, x, y, z);
+        __m128 n001 = grad4(t, r00, z1, x, y, zs);
+        __m128 n010 = grad4(t, r01, z0, x, ys, z);
+        __m128 n011 = grad4(t, r01, z1, x, ys, zs);
+        __m128 n100 = grad4(t, r10, z0, xs, y, z);
+        __m128 n101 = grad4(t, r10, z1, xs, y, zs);
+        __m128 n110 = grad4(t, r11, z0, xs, ys, z);
+        __m128 n111 = grad4(t, r11, z1, xs, ys, zs);
+
+        __m128 n00 = lerp4(n000, n001, w);
+        __m128 n01 = lerp4(n010, n011, w);
+        __m128 n10 = lerp4(n100, n101, w);
+        __m128 n11 = lerp4(n110, n111, w);
+
+        __m128 n0 = lerp4(n00, n01, v);
+        __m128 n1 = lerp4(n10, n11, v);
+
+        _mm_storeu_ps(out, lerp4(n0, n1, u));
+    }
+
+#endif // SIMD_X86
+
+    //
+    // any period: stb_perlin_noise3_internal with the lattice wrapped by modulo
+
+    inline int fastfloor(float a) {
+        int ai = (int)a;
+        return (a < ai) ? ai - 1 : ai;
+    }
+    inline float lerp(float a, float b, float t) { return a + (b - a) * t; }
+    inline float ease(float a) { return ((a * 6 - 15) * a + 10) * a * a * a; }
+    inline float grad(const PerlinTables &t, int idx, float x, float y, float z) {
+        int g = t.grad_idx[idx];
+        return t.basis[0][g] * x + t.basis[1][g] * y + t.basis[2][g] * z;
+    }
+
+    float noise_mod(
+        const PerlinTables &t, float x, float y, float z, int x_wrap, int y_wrap, int z_wrap,
+        unsigned char seed
+    ) {
+        auto wrap = [](int i, int n) { return (i % n + n) % n; };
+        int  px = fastfloor(x), py = fastfloor(y), pz = fastfloor(z);
+        int  x0 = wrap(px, x_wrap), x1 = wrap(px + 1, x_wrap);
+        int  y0 = wrap(py, y_wrap), y1 = wrap(py + 1, y_wrap);
+        int  z0 = wrap(pz, z_wrap), z1 = wrap(pz + 1, z_wrap);
+
+        x -= px;
+        y -= py;
+        z -= pz;
+        float u = ease(x), v = ease(y), w = ease(z);
+
+        int r0 = t.randtab[x0 + seed], r1 = t.randtab[x1 + seed];
+        int r00 = t.randtab[r0 + y0], r01 = t.randtab[r0 + y1];
+        int r10 = t.randtab[r1 + y0], r11 = t.randtab[r1 + y1];
+
+        float n000 = grad(t, r00 + z0, x, y, z);
+        float n001 = grad(t, r00 + z1, x, y, z - 1);
+        float n010 = grad(t, r01 + z0, x, y - 1, z);
+        float n011 = grad(t, r01 + z1, x, y - 1, z - 1);
+        float n100 = grad(t, r10 + z0, x - 1, y, z);
+        float n101 = grad(t, r10 + z1, x - 1, y, z - 1);
+        float n110 = grad(t, r11 + z0, x - 1, y - 1, z);
+        float n111 = grad(t, r11 + z1, x - 1, y - 1, z - 1);
+
+        float n0 = lerp(lerp(n000, n001, w), lerp(n010, n011, w), v);
+        float n1 = lerp(lerp(n100, n101, w), lerp(n110, n111, w), v);
+        return lerp(n0, n1, u);
+    }
+
+    inline bool stb_wraps(int wrap) { return wrap <= 0 || (wrap <= 256 && !(wrap & (wrap - 1))); }
+
+} // namespace
+
+void terrain::set_perlin_backend(PERLIN_BACKEND b) {
+    auto supported = detect_backend();
+    b              = b == PERLIN_AUTO ? supported : std::min(b, supported);
+    spdlog::debug("terrain::set_perlin_backend: {}", (int)b);
+    backend.store(b);
+}
+
+PERLIN_BACKEND terrain::get_perlin_backend() {
+    int b = backend.load();
+    if (b == PERLIN_AUTO) {
+        b = detect_backend();
+        backend.store(b);
+    }
+    return (PERLIN_BACKEND)b;
+}
+
+void terrain::perlin_noise3_batch(
+    const float *x, const float *y, const float *z, float *out, int n, int seed, int x_wrap,
+    int y_wrap, int z_wrap
+) {
+    if (!stb_wraps(x_wrap) || !stb_wraps(y_wrap) || !stb_wraps(z_wrap)) {
+        // the tables hold 256 lattice cells, a longer period would index past them
+        if (x_wrap > 256 || y_wrap > 256 || z_wrap > 256) {
+            spdlog::error(
+                "terrain::perlin_noise3_batch: wraps ({}, {}, {}) over 256", x_wrap, y_wrap, z_wrap
+            );
+            exit(-1);
+        }
+        const auto &t = tables();
+        x_wrap        = x_wrap <= 0 ? 256 : x_wrap;
+        y_wrap        = y_wrap <= 0 ? 256 : y_wrap;
+        z_wrap        = z_wrap <= 0 ? 256 : z_wrap;
+        for (int i = 0; i < n; i++) {
+            out[i] = noise_mod(t, x[i], y[i], z[i], x_wrap, y_wrap, z_wrap, (unsigned char)seed);
+        }
+        return;
+    }
+
+    int i = 0;
+
+#if SIMD_X86
+    auto b = get_perlin_backend();
+    if (b != PERLIN_SCALAR) {
+        const auto &t   = tables();
+        Lattice     lat = {
+            (x_wrap - 1) & 255, (y_wrap - 1) & 255, (z_wrap - 1) & 255, (unsigned char)seed
+        };
+        if (b == PERLIN_AVX2) {
+            for (; i + 8 <= n; i += 8) {
+                noise8_avx2(t, lat, x + i, y + i, z + i, out + i);
+            }
+        }
+        for (; i + 4 <= n; i += 4) {
+            noise4_sse4(t, lat, x + i, y + i, z + i, out + i);
+        }
+    }
+#endif
+
+    // tail and scalar backend
+    for (; i < n; i++) {
+        out[i] = stb_perlin_noise3_seed(x[i], y[i], z[i], x_wrap, y_wrap, z_wrap, seed);
+    }
+}
\ No newline at end of file
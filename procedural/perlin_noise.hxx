@@ -12,5 +12,29 @@ namespace terrain{
         protected:
         std::vector<std::vector<std::vector<float>>> data_;
     };
-    
+
+    // batched perlin kernel
+
+    enum PERLIN_BACKEND {
+        PERLIN_AUTO   = -1, // best supported by the cpu
+        PERLIN_SCALAR = 0,  // stb_perlin_noise3_seed per point
+        PERLIN_SSE4   = 1,  // 4 points per step, scalar table lookups
+        PERLIN_AVX2   = 2,  // 8 points per step, table lookups by gather
+    };
+
+    /// @brief out[i] = stb_perlin_noise3_seed(x[i], y[i], z[i], x_wrap, y_wrap, z_wrap, seed).
+    /// the SIMD backends repeat stb's arithmetic in the same order on stb's own tables, so the
+    /// result is bit-identical to stb when floating point contraction is off (see CMakeLists.txt).
+    /// wraps are lattice periods in cells, 0: 256. stb only wraps powers of two; any other period
+    /// up to 256 runs a scalar kernel on the same tables that wraps the lattice by modulo, equal to
+    /// stb wherever stb's wrap is periodic
+    void perlin_noise3_batch(
+        const float *x, const float *y, const float *z, float *out, int n, int seed,
+        int x_wrap = 0, int y_wrap = 0, int z_wrap = 0
+    );
+
+    /// @brief select backend, clamped to what the cpu supports. PERLIN_AUTO by default
+    void           set_perlin_backend(PERLIN_BACKEND backend);
+    PERLIN_BACKEND get_perlin_backend();
+
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+// x86 SIMD support shared by the batched kernels in procedural/. kernels are compiled per
+// instruction set with SIMD_TARGET and picked at runtime, so the build needs no -m flags
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SIMD_X86 1
+    #include <immintrin.h>
+    #if defined(__GNUC__) || defined(__clang__)
+        #define SIMD_TARGET(isa) __attribute__((target(isa)))
+    #else
+        #define SIMD_TARGET(isa)
+    #endif
+#else
+    #define SIMD_X86 0
+#endif
+
+namespace terrain {
+    inline bool simd_has_avx2() {
+#if SIMD_X86 && (defined(__GNUC__) || defined(__clang__))
+        static const bool has = [] {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+        }();
+        return has;
+#elif SIMD_X86 && defined(__AVX2__)
+        return true;
+#else
+        return false;
+#endif
+    }
+} // namespace terrain
\ No newline at end of file
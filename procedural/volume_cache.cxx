@@ -0,0 +1,127 @@
+#include "volume_cache.hxx"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+using namespace terrain;
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr char     cache_magic[8] = {'H', 'M', 'K', 'V', 'O', 'L', 0, 1};
+    constexpr uint32_t cache_align    = 64;
+
+    // followed by the key string, then the data at data_offs
+    struct CacheHeader {
+        char     magic[8];
+        uint32_t elem_size;
+        uint32_t key_len;
+        int32_t  shape[3];
+        uint32_t data_offs;
+        uint64_t key_hash;
+        uint64_t data_bytes;
+    };
+
+    fs::path entry_path(const CacheKey &key) {
+        return fs::path(cache_dir()) / fmt::format("{}_{:016x}.vol", key.generator(), key.hash());
+    }
+} // namespace
+
+CacheKey::CacheKey(const std::string &generator, int version) :
+    generator_(generator), desc_(fmt::format("{}@{}", generator, version)) {}
+
+uint64_t CacheKey::hash() const {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : desc_) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+std::string terrain::cache_dir() {
+    const char *env = std::getenv("HMK_CACHE_DIR");
+    if (env && *env) return env;
+    return (fs::temp_directory_path() / "hmk_cache").string();
+}
+
+std::shared_ptr<MappedFile> terrain::detail::cache_open(
+    const CacheKey &key, size_t elem_size, std::array<int, 3> &shape, size_t &data_offs
+) {
+    auto            path = entry_path(key);
+    std::error_code ec;
+    auto            file_size = fs::file_size(path, ec);
+    if (ec || file_size < sizeof(CacheHeader)) return nullptr;
+
+    auto file = std::make_shared<MappedFile>(path.string(), MAP_PRIVATE_RW);
+    auto hdr  = reinterpret_cast<const CacheHeader *>(file->data());
+
+    // anything unexpected is a miss, the entry is rewritten after generation
+    bool valid = memcmp(hdr->magic, cache_magic, sizeof(cache_magic)) == 0 &&
+                 hdr->elem_size == elem_size && hdr->key_hash == key.hash() &&
+                 hdr->key_len == key.str().size() &&
+                 sizeof(CacheHeader) + hdr->key_len <= hdr->data_offs &&
+                 hdr->data_offs % cache_align == 0 &&
+                 (uint64_t)hdr->data_offs + hdr->data_bytes == file->size();
+    valid = valid && memcmp(hdr + 1, key.str().data(), hdr->key_len) == 0;
+    valid = valid && hdr->shape[0] >= 0 && hdr->shape[1] >= 0 && hdr->shape[2] >= 0 &&
+            (uint64_t)hdr->shape[0] * hdr->shape[1] * hdr->shape[2] * elem_size == hdr->data_bytes;
+    if (!valid) {
+        spdlog::warn("terrain::cache_open: ignoring stale or corrupt {}", path.string());
+        return nullptr;
+    }
+
+    shape     = {hdr->shape[0], hdr->shape[1], hdr->shape[2]};
+    data_offs = hdr->data_offs;
+    return file;
+}
+
+bool terrain::detail::cache_write(
+    const CacheKey &key, size_t elem_size, std::array<int, 3> shape, const void *data,
+    size_t bytes
+) {
+    auto            path = entry_path(key);
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+
+    CacheHeader hdr;
+    memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+    hdr.elem_size  = (uint32_t)elem_size;
+    hdr.key_len    = (uint32_t)key.str().size();
+    hdr.shape[0]   = shape[0];
+    hdr.shape[1]   = shape[1];
+    hdr.shape[2]   = shape[2];
+    hdr.key_hash   = key.hash();
+    hdr.data_bytes = bytes;
+    hdr.data_offs  = (uint32_t)(sizeof(CacheHeader) + hdr.key_len + cache_align - 1);
+    hdr.data_offs -= hdr.data_offs % cache_align;
+
+    // concurrent writers each get their own file, the last rename wins
+    auto tmp = path;
+    tmp += fmt::format(".{:08x}.tmp", std::random_device()());
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        std::string   pad(hdr.data_offs - sizeof(CacheHeader) - hdr.key_len, '\0');
+        f.write((const char *)&hdr, sizeof(hdr));
+        f.write(key.str().data(), hdr.key_len);
+        f.write(pad.data(), pad.size());
+        f.write((const char *)data, bytes);
+        if (!f) {
+            spdlog::warn("terrain::cache_write: cannot write {}", tmp.string());
+            f.close();
+            fs::remove(tmp, ec);
+            return false;
+        }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        spdlog::warn("terrain::cache_write: cannot replace {} ({})", path.string(), ec.message());
+        fs::remove(tmp, ec);
+        return false;
+    }
+    spdlog::debug("terrain::cache_write: {}, {} bytes", path.string(), bytes);
+    return true;
+}
\ No newline at end of file
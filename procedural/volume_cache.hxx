@@ -0,0 +1,116 @@
+#pragma once
+
+#include "mapped_file.hxx"
+#include "types.hxx"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <spdlog/spdlog.h>
+
+// persistent cache of generated volumes and heightmaps. an entry is a small header followed by
+// the raw Array3D data, named by a hash of everything the generator depends on, and is loaded by
+// mapping the file: a hit costs a page-in per touched page instead of a regeneration
+
+namespace terrain {
+
+    /// @brief identifies generated content: generator name, version and every parameter that
+    /// changes the result. bump the version when the generator code changes
+    class CacheKey {
+        public:
+        CacheKey(const std::string &generator, int version = 1);
+
+        /// @brief append a named parameter; floats are written in shortest round-trip form
+        template<typename V> CacheKey &operator()(const std::string &name, const V &value) {
+            desc_ += fmt::format(";{}={}", name, value);
+            return *this;
+        }
+
+        inline const std::string &generator() const { return generator_; }
+        inline const std::string &str() const { return desc_; }
+        /// @brief 64-bit FNV-1a of str()
+        uint64_t hash() const;
+
+        protected:
+        std::string generator_;
+        std::string desc_;
+    };
+
+    /// @brief $HMK_CACHE_DIR, else hmk_cache/ in the system temp directory
+    std::string cache_dir();
+
+    namespace detail {
+        // map the entry of key read-only/copy-on-write if present and valid, else nullptr
+        std::shared_ptr<MappedFile> cache_open(
+            const CacheKey &key, size_t elem_size, std::array<int, 3> &shape, size_t &data_offs
+        );
+        // write a new entry through a temporary file and a rename, false on failure
+        bool cache_write(
+            const CacheKey &key, size_t elem_size, std::array<int, 3> shape, const void *data,
+            size_t bytes
+        );
+    } // namespace detail
+
+    /// @brief load a cached volume into out, mapped copy-on-write: writes to out stay in memory
+    template<typename T> bool cache_load(const CacheKey &key, Array3D<T> &out) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        std::array<int, 3> shape;
+        size_t             offs;
+        auto               file = detail::cache_open(key, sizeof(T), shape, offs);
+        if (!file) return false;
+
+        size_t n       = (size_t)shape[0] * shape[1] * shape[2];
+        auto   ptr     = reinterpret_cast<T *>((char *)file->data() + offs);
+        auto   storage = Array3DStorage<T>(ptr, n, file);
+        out            = Array3D<T>(shape[0], shape[1], shape[2], std::move(storage));
+        return true;
+    }
+
+    /// @brief store a volume under key, replacing any previous entry. failures only warn
+    template<typename T> bool cache_store(const CacheKey &key, const Array3D<T> &a) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto   shape = a.shape();
+        size_t n     = (size_t)shape[0] * shape[1] * shape[2];
+        return detail::cache_write(key, sizeof(T), shape, a.data(), n * sizeof(T));
+    }
+
+    /// @brief the cached volume for key and shape, or generate() stored for next time.
+    /// generate returns an Array3D<T> of the given shape
+    template<typename T, typename F>
+    Array3D<T> cached_array3d(CacheKey key, int dimX, int dimY, int dimZ, F generate) {
+        key("shape", fmt::format("{}x{}x{}", dimX, dimY, dimZ));
+
+        Array3D<T> out;
+        auto       t0 = std::chrono::steady_clock::now();
+        if (cache_load(key, out)) {
+            auto t1 = std::chrono::steady_clock::now();
+            spdlog::info(
+                "terrain::cached_array3d: {} loaded from cache in {:.2f}ms", key.generator(),
+                std::chrono::duration<double, std::milli>(t1 - t0).count()
+            );
+            return out;
+        }
+
+        out    = generate();
+        auto s = out.shape();
+        if (s[0] != dimX || s[1] != dimY || s[2] != dimZ) {
+            spdlog::error(
+                "terrain::cached_array3d: {} generated {}x{}x{}, expected {}x{}x{}",
+                key.generator(), s[0], s[1], s[2], dimX, dimY, dimZ
+            );
+            exit(-1);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        spdlog::info(
+            "terrain::cached_array3d: {} generated in {:.2f}ms", key.generator(),
+            std::chrono::duration<double, std::milli>(t1 - t0).count()
+        );
+        cache_store(key, out);
+        return out;
+    }
+
+} // namespace terrain
\ No newline at end of file
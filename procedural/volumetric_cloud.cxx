@@ -1,7 +1,16 @@
 #include "volumetric_cloud.hxx"
+#include "perlin_noise.hxx"
+#include "simd.hxx"
+#include "thread_pool.hxx"
 #include "types.hxx"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <spdlog/spdlog.h>
@@ -9,80 +18,278 @@
 
 using namespace terrain;
 
+// generator threading
+
+namespace {
+    // set_nb_threads replaces the pool, running generators keep theirs until they return
+    std::mutex                      pool_mutex;
+    std::shared_ptr<mf::ThreadPool> pool;
+    int                             nb_threads = 0;
+
+    // call f(x_begin, x_end) over slabs of [0, dimX)
+    void for_each_slab(int dimX, std::function<void(int, int)> f) {
+        std::shared_ptr<mf::ThreadPool> cur_pool;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (nb_threads != 1 && dimX > 1) {
+                if (!pool) pool = std::make_shared<mf::ThreadPool>(nb_threads);
+                cur_pool = pool;
+            }
+        }
+        if (!cur_pool) {
+            f(0, dimX);
+            return;
+        }
+        // several slabs per thread so stealing can balance uneven slabs
+        int grain = std::max(dimX / (cur_pool->nb_threads() * 4), 1);
+        cur_pool->parallel_for(0, dimX, grain, f);
+    }
+
+    // a tileable axis of n voxels holds a whole number of lattice cells, wrapped by the noise:
+    // the period in cells and the voxels per cell that replace the noise scale
+    struct TileAxis {
+        int   wrap;
+        float scale;
+    };
+    TileAxis tile_axis(int n, float scale) {
+        int wrap = std::clamp((int)std::lround(n / scale), 1, 256);
+        return {wrap, (float)n / wrap};
+    }
+
+    // f(v) over the voxels of brick (bx, by, bz) and the next voxel on each axis, wrapped, until
+    // f returns false
+    template<typename F>
+    void visit_brick(const Array3D<float> &data, int brick, int bx, int by, int bz, F f) {
+        auto shape = data.shape();
+        auto wrap  = [](int i, int n) { return (i % n + n) % n; };
+        int  i1    = std::min((bx + 1) * brick, shape[0]);
+        int  j1    = std::min((by + 1) * brick, shape[1]);
+        int  k1    = std::min((bz + 1) * brick, shape[2]);
+        for (int i = bx * brick; i <= i1; i++) {
+            for (int j = by * brick; j <= j1; j++) {
+                const float *row = &data.at(wrap(i, shape[0]), wrap(j, shape[1]), 0);
+                for (int k = bz * brick; k <= k1; k++) {
+                    if (!f(row[wrap(k, shape[2])])) return;
+                }
+            }
+        }
+    }
+} // namespace
+
+void terrain::set_nb_threads(int n) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (n <= 0) n = 0;
+    if (n == nb_threads) return;
+    nb_threads = n;
+    pool.reset();
+}
+
+int terrain::get_nb_threads() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (nb_threads == 1) return 1;
+    if (!pool) pool = std::make_shared<mf::ThreadPool>(nb_threads);
+    return pool->nb_threads();
+}
+
 VolumetricCloudData::VolumetricCloudData(
     int dimX, int dimY, int dimZ, array<int, nb_level> seed, array<float, nb_level> scale,
-    array<float, nb_level> amp
+    array<float, nb_level> amp, bool tileable
 ) :
     Array3D<float>(dimX, dimY, dimZ),
     noise_seeds(seed), noise_scales(scale), noise_amps(amp) {
 
     array<float, nb_level> offset;
+    // per level and axis
+    array<glm::vec3, nb_level>  scales;
+    array<glm::ivec3, nb_level> wraps;
     for (int l = 0; l < nb_level; l++) {
         offset[l] = stb_perlin_noise3_seed(.5, .5, .5, 0, 0, 0, seed[l]) * 0.1 + 0.5;
+        scales[l] = glm::vec3(scale[l]);
+        wraps[l]  = glm::ivec3(0);
+        if (tileable) {
+            auto tx = tile_axis(dimX, scale[l]), ty = tile_axis(dimY, scale[l]),
+                 tz = tile_axis(dimZ, scale[l]);
+            scales[l] = glm::vec3(tx.scale, ty.scale, tz.scale);
+            wraps[l]  = glm::ivec3(tx.wrap, ty.wrap, tz.wrap);
+        }
     }
 
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimY; j++) {
-            for (int k = 0; k < dimZ; k++) {
+    // one row along the contiguous (3rd) dimension per kernel call
+    for_each_slab(dimX, [&](int i0, int i1) {
+        std::vector<float> xs(dimZ), ys(dimZ), zs(dimZ), noise(dimZ);
+        for (int i = i0; i < i1; i++) {
+            for (int j = 0; j < dimY; j++) {
+                float *row = &(*this)[{i, j, 0}];
+                std::fill(row, row + dimZ, 0.f);
 
-                float noise = 0;
                 for (int l = 0; l < nb_level; l++) {
-                    noise += noise_amps[l] * //
-                             stb_perlin_noise3_seed(
-                                 (i + offset[l]) / scale[l], (j + offset[l]) / scale[l],
-                                 (k + offset[l]) / scale[l], 0, 0, 0, seed[l]
-                             );
+                    for (int k = 0; k < dimZ; k++) {
+                        xs[k] = (i + offset[l]) / scales[l].x;
+                        ys[k] = (j + offset[l]) / scales[l].y;
+                        zs[k] = (k + offset[l]) / scales[l].z;
+                    }
+                    perlin_noise3_batch(
+                        xs.data(), ys.data(), zs.data(), noise.data(), dimZ, seed[l], wraps[l].x,
+                        wraps[l].y, wraps[l].z
+                    );
+                    for (int k = 0; k < dimZ; k++) {
+                        row[k] += noise_amps[l] * noise[k];
+                    }
                 }
-                (*this)[{i, j, k}] = noise;
             }
         }
-    }
+    });
 }
 
+// trilinear sampling
+
+namespace {
+    // direct on the storage with precomputed strides: no index wrapping, no asserts
+    inline float sample_trilinear(
+        const float *data, const array<int, 3> &shape, float u, float v, float w
+    ) {
+        if (std::min<float>({u, v, w}) <= 0. || std::max<float>({u, v, w}) >= 1.) {
+            return 0.;
+        }
+        // find voxel
+        float fx = u * (shape[0] - 1);
+        float fy = v * (shape[1] - 1);
+        float fz = w * (shape[2] - 1);
+
+        int x0 = glm::clamp((int)fx, 0, shape[0] - 1);
+        int y0 = glm::clamp((int)fy, 0, shape[1] - 1);
+        int z0 = glm::clamp((int)fz, 0, shape[2] - 1);
+        int x1 = glm::min(x0 + 1, shape[0] - 1);
+        int y1 = glm::min(y0 + 1, shape[1] - 1);
+        int z1 = glm::min(z0 + 1, shape[2] - 1);
+
+        // offset in voxel
+        float dx = fx - x0;
+        float dy = fy - y0;
+        float dz = fz - z0;
+
+        int sx = shape[1] * shape[2], sy = shape[2];
+
+        // interp with 8 vertices
+        float c000 = data[x0 * sx + y0 * sy + z0];
+        float c100 = data[x1 * sx + y0 * sy + z0];
+        float c010 = data[x0 * sx + y1 * sy + z0];
+        float c110 = data[x1 * sx + y1 * sy + z0];
+        float c001 = data[x0 * sx + y0 * sy + z1];
+        float c101 = data[x1 * sx + y0 * sy + z1];
+        float c011 = data[x0 * sx + y1 * sy + z1];
+        float c111 = data[x1 * sx + y1 * sy + z1];
+
+        float c00 = glm::mix(c000, c100, dx);
+        float c01 = glm::mix(c001, c101, dx);
+        float c10 = glm::mix(c010, c110, dx);
+        float c11 = glm::mix(c011, c111, dx);
+
+        float c0 = glm::mix(c00, c10, dy);
+        float c1 = glm::mix(c01, c11, dy);
+
+        return glm::mix(c0, c1, dz);
+    }
+
+#if SIMD_X86
+    // avx2: 8 samples, same arithmetic as sample_trilinear so results are bit-identical
+
+    SIMD_TARGET("avx2")
+    inline __m256 mix8(__m256 a, __m256 b, __m256 t) {
+        // glm::mix: a * (1 - t) + b * t
+        return _mm256_add_ps(
+            _mm256_mul_ps(a, _mm256_sub_ps(_mm256_set1_ps(1.f), t)), _mm256_mul_ps(b, t)
+        );
+    }
+    // lower/upper voxel of one axis, scaled by stride, and offset in voxel
+    SIMD_TARGET("avx2")
+    inline void axis8(__m256 t, int dim, int stride, __m256i &i0, __m256i &i1, __m256 &d) {
+        __m256  f  = _mm256_mul_ps(t, _mm256_set1_ps((float)(dim - 1)));
+        __m256i hi = _mm256_set1_epi32(dim - 1);
+        __m256i i  = _mm256_min_epi32(
+            _mm256_max_epi32(_mm256_cvttps_epi32(f), _mm256_setzero_si256()), hi
+        );
+        d  = _mm256_sub_ps(f, _mm256_cvtepi32_ps(i));
+        i0 = _mm256_mullo_epi32(i, _mm256_set1_epi32(stride));
+        i1 = _mm256_mullo_epi32(
+            _mm256_min_epi32(_mm256_add_epi32(i, _mm256_set1_epi32(1)), hi),
+            _mm256_set1_epi32(stride)
+        );
+    }
+    SIMD_TARGET("avx2")
+    inline __m256 inside8(__m256 t) {
+        return _mm256_and_ps(
+            _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ),
+            _mm256_cmp_ps(t, _mm256_set1_ps(1.f), _CMP_LT_OQ)
+        );
+    }
+
+    SIMD_TARGET("avx2")
+    void sample8_avx2(
+        const float *data, const array<int, 3> &shape, const float *pu, const float *pv,
+        const float *pw, float *out
+    ) {
+        __m256 u = _mm256_loadu_ps(pu), v = _mm256_loadu_ps(pv), w = _mm256_loadu_ps(pw);
+
+        // outside samples 0; their indices are clamped in range so gathering them is safe
+        __m256 inside = _mm256_and_ps(_mm256_and_ps(inside8(u), inside8(v)), inside8(w));
+
+        __m256i x0, x1, y0, y1, z0, z1;
+        __m256  dx, dy, dz;
+        axis8(u, shape[0], shape[1] * shape[2], x0, x1, dx);
+        axis8(v, shape[1], shape[2], y0, y1, dy);
+        axis8(w, shape[2], 1, z0, z1, dz);
+
+        __m256i x0y0 = _mm256_add_epi32(x0, y0), x1y0 = _mm256_add_epi32(x1, y0);
+        __m256i x0y1 = _mm256_add_epi32(x0, y1), x1y1 = _mm256_add_epi32(x1, y1);
+
+        __m256 c000 = _mm256_i32gather_ps(data, _mm256_add_epi32(x0y0, z0), 4);
+        __m256 c100 = _mm256_i32gather_ps(data, _mm256_add_epi32(x1y0, z0), 4);
+        __m256 c010 = _mm256_i32gather_ps(data, _mm256_add_epi32(x0y1, z0), 4);
+        __m256 c110 = _mm256_i32gather_ps(data, _mm256_add_epi32(x1y1, z0), 4);
+        __m256 c001 = _mm256_i32gather_ps(data, _mm256_add_epi32(x0y0, z1), 4);
+        __m256 c101 = _mm256_i32gather_ps(data, _mm256_add_epi32(x1y0, z1), 4);
+        __m256 c011 = _mm256_i32gather_ps(data, _mm256_add_epi32(x0y1, z1), 4);
+        __m256 c111 = _mm256_i32gather_ps(data, _mm256_add_epi32(x1y1, z1), 4);
+
+        __m256 c00 = mix8(c000, c100, dx);
+        __m256 c01 = mix8(c001, c101, dx);
+        __m256 c10 = mix8(c010, c110, dx);
+        __m256 c11 = mix8(c011, c111, dx);
+
+        __m256 c0 = mix8(c00, c10, dy);
+        __m256 c1 = mix8(c01, c11, dy);
+
+        _mm256_storeu_ps(out, _mm256_and_ps(mix8(c0, c1, dz), inside));
+    }
+#endif // SIMD_X86
+} // namespace
+
 float terrain::VolumetricCloudData::tex_at(glm::vec3 uvw) const {
-    if (std::min<float>({uvw[0], uvw[1], uvw[2]}) <= 0. ||
-        std::max<float>({uvw[0], uvw[1], uvw[2]}) >= 1.) {
-        return 0.;
-    }
-    // find voxel
-    auto  shape = this->shape();
-    float fx    = uvw[0] * (shape[0] - 1);
-    float fy    = uvw[1] * (shape[1] - 1);
-    float fz    = uvw[2] * (shape[2] - 1);
-
-    int x0 = glm::clamp((int)fx, 0, shape[0] - 1);
-    int y0 = glm::clamp((int)fy, 0, shape[1] - 1);
-    int z0 = glm::clamp((int)fz, 0, shape[2] - 1);
-    int x1 = glm::min(x0 + 1, shape[0] - 1);
-    int y1 = glm::min(y0 + 1, shape[1] - 1);
-    int z1 = glm::min(z0 + 1, shape[2] - 1);
-
-    // offset in voxel
-    float dx = fx - x0;
-    float dy = fy - y0;
-    float dz = fz - z0;
-
-    // interp with 8 vertices
-    float c000 = (*this)[{x0, y0, z0}];
-    float c100 = (*this)[{x1, y0, z0}];
-    float c010 = (*this)[{x0, y1, z0}];
-    float c110 = (*this)[{x1, y1, z0}];
-    float c001 = (*this)[{x0, y0, z1}];
-    float c101 = (*this)[{x1, y0, z1}];
-    float c011 = (*this)[{x0, y1, z1}];
-    float c111 = (*this)[{x1, y1, z1}];
-
-    float c00 = glm::mix(c000, c100, dx);
-    float c01 = glm::mix(c001, c101, dx);
-    float c10 = glm::mix(c010, c110, dx);
-    float c11 = glm::mix(c011, c111, dx);
-
-    float c0 = glm::mix(c00, c10, dy);
-    float c1 = glm::mix(c01, c11, dy);
-
-    float c = glm::mix(c0, c1, dz);
-
-    return c;
+    return sample_trilinear(data_.data(), shape(), uvw[0], uvw[1], uvw[2]);
+}
+
+void terrain::VolumetricCloudData::tex_at(
+    const float *u, const float *v, const float *w, float *out, int n
+) const {
+    if (data_.empty()) {
+        std::fill(out, out + n, 0.f);
+        return;
+    }
+    auto         shape = this->shape();
+    const float *data  = data_.data();
+
+    int i = 0;
+#if SIMD_X86
+    if (simd_has_avx2()) {
+        for (; i + 8 <= n; i += 8) {
+            sample8_avx2(data, shape, u + i, v + i, w + i, out + i);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = sample_trilinear(data, shape, u[i], v[i], w[i]);
+    }
 }
 
 Array3D<float> terrain::gen_light_cache(
@@ -106,30 +313,31 @@ Array3D<float> terrain::gen_light_cache(
 
     glm::vec3 rd = glm::normalize(light_dir);
 
+    // the nb_iter samples of a voxel go through the batched sampler at once
+    std::vector<float> su(nb_iter), sv(nb_iter), sw(nb_iter), density(nb_iter);
+
     for (int i = 0; i < dimx; i++) {
         spdlog::debug("terrain::gen_light_cache: i={}", i);
         for (int j = 0; j < dimy; j++) {
             for (int k = 0; k < dimz; k++) {
-                // spdlog::debug(
-                // "{}-1*{}", repr(world2tex),
-                // repr(glm::vec4((float)i / dimx, (float)j / dimy, (float)k / dimz, 1.))
-                // );
-
                 glm::vec3 ro =
                     tex2world * glm::vec4((float)i / dimx, (float)j / dimy, (float)k / dimz, 1.);
-                float transmittance = 1.;
 
                 for (int it = 0; it < nb_iter; it++) {
-                    // spdlog::debug("ro:{},rd:{},step_size:{}", repr(ro), repr(rd), step_size);
                     auto sample_pos = ro - rd * step_size * (float)(nb_iter - it - 1);
-                    // spdlog::debug("sample_pos: {}", repr(glm::vec4(sample_pos, 1)));
 
                     glm::vec3 sample_tex_pos = world2tex * glm::vec4(sample_pos, 1.);
 
-                    float density = data.tex_at(sample_tex_pos);
-                    assert(density < 1e6);
+                    su[it] = sample_tex_pos[0];
+                    sv[it] = sample_tex_pos[1];
+                    sw[it] = sample_tex_pos[2];
+                }
+                data.tex_at(su.data(), sv.data(), sw.data(), density.data(), nb_iter);
 
-                    transmittance *= glm::exp(-density * extinction * step_size);
+                float transmittance = 1.;
+                for (int it = 0; it < nb_iter; it++) {
+                    assert(density[it] < 1e6);
+                    transmittance *= glm::exp(-density[it] * extinction * step_size);
                 }
 
                 result[{i, j, k}] = transmittance;
@@ -140,23 +348,285 @@ Array3D<float> terrain::gen_light_cache(
     return result;
 }
 
-Array3D<float> terrain::gen_perlin_tex(int dimX, int dimY, int dimZ, float noise_scale, int seed) {
-    Array3D<float> array{dimX, dimY, dimZ};
+Array3D<float> terrain::gen_light_cache_sweep(
+    const VolumetricCloudData &data, glm::mat4 world2tex, glm::vec3 light_dir, float max_length,
+    int nb_iter, float extinction, float sample_rate
+) {
+    spdlog::debug("terrain::gen_light_cache_sweep");
+
+    auto  shape     = data.shape();
+    int   dims[3]   = {
+        (int)glm::round(shape[0] / sample_rate), (int)glm::round(shape[1] / sample_rate),
+        (int)glm::round(shape[2] / sample_rate)
+    };
+    float step_size = max_length / (nb_iter - 1);
+
+    assert(step_size > 1e-6 && step_size < 1e6);
+
+    auto      result = Array3D<float>(dims[0], dims[1], dims[2]);
+    glm::vec3 vdims  = glm::vec3(dims[0], dims[1], dims[2]);
+
+    // light direction per unit world length, in texture and in output voxel units
+    glm::vec3 rd     = glm::normalize(light_dir);
+    glm::vec3 rd_tex = glm::mat3(world2tex) * rd;
+    glm::vec3 rd_vox = rd_tex * vdims;
 
-    for (int i = 0; i < dimX; i++) {
-        for (int j = 0; j < dimY; j++) {
-            for (int k = 0; k < dimZ; k++) {
-                float offset =
-                    stb_perlin_noise3_seed(i / 10., j / 10., k / 10., 0, 0, 0, seed + 5) * 0.5 +
-                    0.5;
+    // sweep along the dominant axis a, the others (b, c) span a slice
+    int a = 0;
+    for (int d = 1; d < 3; d++) {
+        if (glm::abs(rd_vox[d]) > glm::abs(rd_vox[a])) a = d;
+    }
+    int b = (a + 1) % 3;
+    int c = (a + 2) % 3;
+    assert(glm::abs(rd_vox[a]) > 1e-6);
+
+    int   nb_slices = dims[a];
+    int   dir       = rd_vox[a] > 0 ? 1 : -1;
+    // world length between two slices, and how far a light ray moves in b and c meanwhile
+    // (at most one voxel)
+    float slice_len = 1.f / glm::abs(rd_vox[a]);
+    float shift_b   = rd_vox[b] * slice_len;
+    float shift_c   = rd_vox[c] * slice_len;
+    // the marched path is nb_iter samples long; what leaves it is subtracted at this offset
+    glm::vec3 window = -rd_tex * (step_size * nb_iter);
+
+    // optical depth is kept per light ray, on a grid sheared along the light: ray (u, v) crosses
+    // slice n at (ob + u + n * shift_b, oc + v + n * shift_c). the rays are integrated exactly,
+    // only the resampling into each slice interpolates, so errors don't pile up across slices
+    float span_b = shift_b * (nb_slices - 1), span_c = shift_c * (nb_slices - 1);
+    int   ob     = (int)glm::floor(glm::min(0.f, -span_b)) - 1;
+    int   oc     = (int)glm::floor(glm::min(0.f, -span_c)) - 1;
+    int   nb_u   = (int)glm::ceil(glm::max(0.f, -span_b)) + dims[b] + 1 - ob;
+    int   nb_v   = (int)glm::ceil(glm::max(0.f, -span_c)) + dims[c] + 1 - oc;
+
+    std::vector<float> depth(nb_u * nb_v, 0.f);
+
+    for (int n = 0; n < nb_slices; n++) {
+        // start from the slice the light enters
+        int s = dir > 0 ? n : nb_slices - 1 - n;
+
+        // advance every ray to slice s, density at the middle of the segment
+        for_each_slab(nb_u, [&](int u0, int u1) {
+            // one row of rays per batched sampler call, at the segment and past the window
+            std::vector<float> uvw[3], uvw_out[3], density(nb_v), density_out(nb_v);
+            for (int d = 0; d < 3; d++) {
+                uvw[d].resize(nb_v);
+                uvw_out[d].resize(nb_v);
+            }
 
-                array[{i, j, k}] = stb_perlin_noise3_seed(
-                    (i + offset) / noise_scale, (j + offset) / noise_scale,
-                    (k + offset) / noise_scale, 0, 0, 0, seed
+            glm::vec3 pos;
+            pos[a] = s - 0.5f * dir;
+            for (int u = u0; u < u1; u++) {
+                pos[b] = ob + u + (n - 0.5f) * shift_b;
+                for (int v = 0; v < nb_v; v++) {
+                    pos[c]      = oc + v + (n - 0.5f) * shift_c;
+                    glm::vec3 p = pos / vdims;
+                    for (int d = 0; d < 3; d++) {
+                        uvw[d][v]     = p[d];
+                        uvw_out[d][v] = p[d] + window[d];
+                    }
+                }
+                data.tex_at(uvw[0].data(), uvw[1].data(), uvw[2].data(), density.data(), nb_v);
+                data.tex_at(
+                    uvw_out[0].data(), uvw_out[1].data(), uvw_out[2].data(), density_out.data(),
+                    nb_v
                 );
+
+                float *row = &depth[u * nb_v];
+                for (int v = 0; v < nb_v; v++) {
+                    row[v] += slice_len * (density[v] - density_out[v]);
+                    row[v] = glm::max(row[v], 0.f);
+                }
+            }
+        });
+
+        // resample into the voxels of slice s
+        for_each_slab(dims[b], [&](int b0, int b1) {
+            glm::ivec3 idx;
+            idx[a] = s;
+            for (int ib = b0; ib < b1; ib++) {
+                idx[b]   = ib;
+                float fu = ib - n * shift_b - ob;
+                int   u  = (int)glm::floor(fu);
+                float du = fu - u;
+                for (int ic = 0; ic < dims[c]; ic++) {
+                    idx[c]   = ic;
+                    float fv = ic - n * shift_c - oc;
+                    int   v  = (int)glm::floor(fv);
+                    float dv = fv - v;
+
+                    const float *d = &depth[u * nb_v + v];
+                    float        od =
+                        glm::mix(glm::mix(d[0], d[1], dv), glm::mix(d[nb_v], d[nb_v + 1], dv), du);
+
+                    result[{idx[0], idx[1], idx[2]}] = glm::exp(-od * extinction);
+                }
+            }
+        });
+    }
+
+    return result;
+}
+
+namespace {
+    // gen_perlin_tex one row along the contiguous (3rd) dimension at a time, for i in [x0, x1):
+    // f(i, j, row), then slab_done(i0, i1) once the rows of a slab are through
+    void for_each_perlin_row(
+        int x0, int x1, std::array<int, 3> shape, float noise_scale, int seed, bool tileable,
+        const std::function<void(int, int, const float *)> &f,
+        const std::function<void(int, int)>                &slab_done = nullptr
+    ) {
+        int dimY = shape[1], dimZ = shape[2];
+
+        // per axis: the offset noise every 10 voxels, the noise every noise_scale voxels
+        double offs_scale[3] = {10., 10., 10.};
+        float  scale[3]      = {noise_scale, noise_scale, noise_scale};
+        int    offs_wrap[3]  = {0, 0, 0}, wrap[3] = {0, 0, 0};
+        if (tileable) {
+            for (int a = 0; a < 3; a++) {
+                auto to       = tile_axis(shape[a], 10.f), t = tile_axis(shape[a], noise_scale);
+                offs_scale[a] = (double)shape[a] / to.wrap;
+                offs_wrap[a]  = to.wrap;
+                scale[a]      = t.scale;
+                wrap[a]       = t.wrap;
             }
         }
+
+        for_each_slab(x1 - x0, [&](int i0, int i1) {
+            std::vector<float> xs(dimZ), ys(dimZ), zs(dimZ), offset(dimZ), noise(dimZ);
+            for (int i = x0 + i0; i < x0 + i1; i++) {
+                for (int j = 0; j < dimY; j++) {
+                    for (int k = 0; k < dimZ; k++) {
+                        xs[k] = i / offs_scale[0];
+                        ys[k] = j / offs_scale[1];
+                        zs[k] = k / offs_scale[2];
+                    }
+                    perlin_noise3_batch(
+                        xs.data(), ys.data(), zs.data(), offset.data(), dimZ, seed + 5,
+                        offs_wrap[0], offs_wrap[1], offs_wrap[2]
+                    );
+
+                    for (int k = 0; k < dimZ; k++) {
+                        float offs = offset[k] * 0.5 + 0.5;
+                        xs[k]      = (i + offs) / scale[0];
+                        ys[k]      = (j + offs) / scale[1];
+                        zs[k]      = (k + offs) / scale[2];
+                    }
+                    perlin_noise3_batch(
+                        xs.data(), ys.data(), zs.data(), noise.data(), dimZ, seed, wrap[0], wrap[1],
+                        wrap[2]
+                    );
+
+                    f(i, j, noise.data());
+                }
+            }
+            if (slab_done) slab_done(x0 + i0, x0 + i1);
+        });
     }
+} // namespace
 
+Array3D<float> terrain::gen_perlin_tex(
+    int dimX, int dimY, int dimZ, float noise_scale, int seed, bool tileable
+) {
+    Array3D<float> array{dimX, dimY, dimZ};
+
+    gen_perlin_slab(array, 0, dimX, noise_scale, seed, tileable);
     return array;
+}
+
+void terrain::gen_perlin_slab(
+    Array3D<float> &dst, int x0, int x1, float noise_scale, int seed, bool tileable
+) {
+    auto shape = dst.shape();
+    assert(0 <= x0 && x0 <= x1 && x1 <= shape[0]);
+
+    for_each_perlin_row(
+        x0, x1, shape, noise_scale, seed, tileable,
+        [&](int i, int j, const float *row) { std::copy(row, row + shape[2], &dst[{i, j, 0}]); }
+    );
+}
+
+void terrain::add_perlin_tex(
+    Array3D<float> &dst, float noise_scale, int seed, float amp, bool tileable,
+    const std::function<void(int, int)> &then
+) {
+    auto shape = dst.shape();
+
+    for_each_perlin_row(
+        0, shape[0], shape, noise_scale, seed, tileable,
+        [&](int i, int j, const float *row) {
+            float *out = &dst[{i, j, 0}];
+            for (int k = 0; k < shape[2]; k++) {
+                out[k] += row[k] * amp;
+            }
+        },
+        then
+    );
+}
+
+terrain::Array3D<uint8_t> terrain::gen_occupancy_grid(
+    const Array3D<float> &data, int brick, float eps
+) {
+    assert(brick > 0);
+    auto shape = data.shape();
+    int  nx    = (shape[0] + brick - 1) / brick;
+    int  ny    = (shape[1] + brick - 1) / brick;
+    int  nz    = (shape[2] + brick - 1) / brick;
+
+    // a slab of bricks only reads brick + 1 depth layers, so a mapped volume is paged in piece
+    // by piece
+    Array3D<uint8_t> flags(nx, ny, nz);
+    for_each_slab(nx, [&](int bx0, int bx1) {
+        for (int bx = bx0; bx < bx1; bx++) {
+            for (int by = 0; by < ny; by++) {
+                for (int bz = 0; bz < nz; bz++) {
+                    bool occupied = false;
+                    visit_brick(data, brick, bx, by, bz, [&](float v) {
+                        occupied = std::abs(v) > eps;
+                        return !occupied;
+                    });
+                    flags.at(bx, by, bz) = occupied ? 255 : 0;
+                }
+            }
+        }
+    });
+    return flags;
+}
+
+terrain::Array3D<glm::vec2> terrain::gen_slope_map(
+    const Array3D<float> &heights, float scale, bool wrap
+) {
+    auto shape = heights.shape();
+    assert(shape[2] == 1);
+    int rows = shape[0], cols = shape[1];
+
+    Array3D<glm::vec2> slopes(rows, cols, 1);
+    // neighbours a, b of i on an axis of n, and the scale of h[b] - h[a]
+    auto neighbours = [&](int i, int n, int &a, int &b, float &s) {
+        if (wrap) {
+            a = (i + n - 1) % n, b = (i + 1) % n, s = scale;
+        } else {
+            a = std::max(i - 1, 0), b = std::min(i + 1, n - 1);
+            s = b > a ? scale * 2 / (b - a) : 0;
+        }
+    };
+
+    for_each_slab(rows, [&](int i0, int i1) {
+        for (int i = i0; i < i1; i++) {
+            int   ia, ib;
+            float si;
+            neighbours(i, rows, ia, ib, si);
+            const float *row = &heights.at(i, 0, 0);
+            const float *ra  = &heights.at(ia, 0, 0);
+            const float *rb  = &heights.at(ib, 0, 0);
+            glm::vec2   *out = &slopes.at(i, 0, 0);
+            for (int j = 0; j < cols; j++) {
+                int   ja, jb;
+                float sj;
+                neighbours(j, cols, ja, jb, sj);
+                out[j] = glm::vec2((row[jb] - row[ja]) * sj, (rb[j] - ra[j]) * si);
+            }
+        }
+    });
+    return slopes;
 }
\ No newline at end of file
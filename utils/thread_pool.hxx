@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mf {
+
+    /// @brief work-stealing thread pool. every worker owns a deque, pops its own tasks from the
+    /// back and steals from the front of the others when idle.
+    class ThreadPool {
+        public:
+        typedef std::function<void()> Task_t;
+
+        /// @param nb_threads number of workers, <=0: hardware concurrency
+        inline ThreadPool(int nb_threads = 0) {
+            if (nb_threads <= 0) nb_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+            queues_.resize(nb_threads);
+            for (auto &q : queues_) {
+                q = std::make_unique<WorkQueue>();
+            }
+            for (int i = 0; i < nb_threads; i++) {
+                workers_.emplace_back([this, i] { worker_loop_(i); });
+            }
+        }
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool(ThreadPool &&)      = delete;
+        inline ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            for (auto &w : workers_) {
+                w.join();
+            }
+        }
+
+        inline int nb_threads() const { return (int)workers_.size(); }
+
+        /// @brief push a task, distributed round-robin over the worker queues
+        inline void push(Task_t task) {
+            auto idx = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+            {
+                std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+                queues_[idx]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                nb_pending_++;
+            }
+            wake_.notify_one();
+        }
+
+        /// @brief push a task and get its result as a future
+        template<typename F> auto submit(F f) -> std::future<decltype(f())> {
+            auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+            auto ret  = task->get_future();
+            push([task] { (*task)(); });
+            return ret;
+        }
+
+        /// @brief run f(begin_i, end_i) over [begin, end) split into chunks of grain, block until
+        /// every chunk is done. the calling thread helps executing queued tasks meanwhile, so
+        /// nested calls from inside a worker don't deadlock.
+        inline void parallel_for(int begin, int end, int grain, std::function<void(int, int)> f) {
+            if (end <= begin) return;
+            grain = std::max(grain, 1);
+
+            int nb_chunks = (end - begin + grain - 1) / grain;
+            if (nb_chunks == 1) {
+                f(begin, end);
+                return;
+            }
+
+            auto remaining = std::make_shared<std::atomic<int>>(nb_chunks);
+            for (int b = begin; b < end; b += grain) {
+                int e = std::min(b + grain, end);
+                push([=, &f] {
+                    f(b, e);
+                    remaining->fetch_sub(1, std::memory_order_acq_rel);
+                });
+            }
+            while (remaining->load(std::memory_order_acquire) > 0) {
+                if (!run_one_(-1)) std::this_thread::yield();
+            }
+        }
+
+        /// @brief process-wide pool used by generators
+        inline static ThreadPool &global() {
+            std::lock_guard<std::mutex> lock(global_mutex_);
+            if (!global_) global_ = std::make_unique<ThreadPool>(global_nb_threads_);
+            return *global_;
+        }
+        /// @brief set number of threads of the global pool, recreated on next use.
+        /// must not be called while the global pool is busy
+        inline static void set_global_nb_threads(int nb_threads) {
+            std::lock_guard<std::mutex> lock(global_mutex_);
+            global_nb_threads_ = nb_threads;
+            global_.reset();
+        }
+        inline static int global_nb_threads() { return global().nb_threads(); }
+
+        protected:
+        struct WorkQueue {
+            std::mutex         mutex;
+            std::deque<Task_t> tasks;
+        };
+
+        // pop from own queue (back) or steal from others (front); self<0: caller thread
+        inline bool try_pop_(int self, Task_t &task) {
+            int n = (int)queues_.size();
+            if (self >= 0) {
+                std::lock_guard<std::mutex> lock(queues_[self]->mutex);
+                if (!queues_[self]->tasks.empty()) {
+                    task = std::move(queues_[self]->tasks.back());
+                    queues_[self]->tasks.pop_back();
+                    return true;
+                }
+            }
+            for (int i = 1; i <= n; i++) {
+                int victim = ((self < 0 ? 0 : self) + i) % n;
+                std::lock_guard<std::mutex> lock(queues_[victim]->mutex);
+                if (!queues_[victim]->tasks.empty()) {
+                    task = std::move(queues_[victim]->tasks.front());
+                    queues_[victim]->tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline bool run_one_(int self) {
+            Task_t task;
+            if (!try_pop_(self, task)) return false;
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                nb_pending_--;
+            }
+            task();
+            return true;
+        }
+
+        inline void worker_loop_(int self) {
+            while (true) {
+                if (run_one_(self)) continue;
+
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                wake_.wait(lock, [this] { return stop_ || nb_pending_ > 0; });
+                if (stop_ && nb_pending_ == 0) return;
+            }
+        }
+
+        std::vector<std::unique_ptr<WorkQueue>> queues_;
+        std::vector<std::thread>                workers_;
+        std::atomic<size_t>                     next_queue_{0};
+
+        std::mutex              wake_mutex_;
+        std::condition_variable wake_;
+        int                     nb_pending_ = 0;
+        bool                    stop_       = false;
+
+        inline static std::mutex                  global_mutex_;
+        inline static std::unique_ptr<ThreadPool> global_;
+        inline static int                         global_nb_threads_ = 0;
+    };
+
+} // namespace mf
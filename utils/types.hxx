@@ -1,10 +1,16 @@
 #pragma once
 
 #include "types.hxx"
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <functional>
 #include <map>
+#include <memory>
 #include <stddef.h>
 #include <type_traits>
 #include <variant>
@@ -19,33 +25,323 @@ namespace terrain {
     using glm::vec4;
     using std::array;
     using std::vector;
-    template<typename T> class Array3D {
+
+    // storage layouts of Array3D: map (x, y, z) to an offset in the storage. the indexing API is
+    // the same for all of them, only the memory order differs. non-linear layouts pad the
+    // storage, the padding is never visible through indexing
+
+    /// @brief row-major, z contiguous
+    struct LinearLayout {
+        static constexpr bool is_linear = true;
+
+        LinearLayout(int dimX = 0, int dimY = 0, int dimZ = 0);
+        size_t size() const { return size_; }
+        size_t operator()(int x, int y, int z) const { return ((size_t)x * dimY_ + y) * dimZ_ + z; }
+
+        protected:
+        int    dimY_, dimZ_;
+        size_t size_;
+    };
+
+    /// @brief 4x4x4 bricks in row-major order, each brick row-major: the 8 neighbors of a
+    /// trilinear lookup mostly share one brick of 256 bytes (float)
+    struct BrickedLayout {
+        static constexpr bool is_linear = false;
+
+        BrickedLayout(int dimX = 0, int dimY = 0, int dimZ = 0);
+        size_t size() const { return size_; }
+        size_t operator()(int x, int y, int z) const {
+            size_t brick = ((size_t)(x >> 2) * nb_y_ + (y >> 2)) * nb_z_ + (z >> 2);
+            return brick * 64 + ((x & 3) << 4 | (y & 3) << 2 | (z & 3));
+        }
+
+        protected:
+        int    nb_y_, nb_z_;
+        size_t size_;
+    };
+
+    /// @brief Z-order: bits of x, y, z interleaved over the extent the three dimensions share
+    /// (after rounding each up to a power of 2), row-major blocks of that cube beyond it
+    struct MortonLayout {
+        static constexpr bool is_linear = false;
+
+        MortonLayout(int dimX = 0, int dimY = 0, int dimZ = 0);
+        size_t size() const { return size_; }
+        size_t operator()(int x, int y, int z) const {
+            size_t block = ((size_t)(x >> bits_) * nb_y_ + (y >> bits_)) * nb_z_ + (z >> bits_);
+            size_t low   = spread_(x & mask_) << 2 | spread_(y & mask_) << 1 | spread_(z & mask_);
+            return block << (3 * bits_) | low;
+        }
+
+        protected:
+        // abc -> a00b00c, 10 bits
+        static size_t spread_(unsigned v) {
+            v = (v | v << 16) & 0x030000ffu;
+            v = (v | v << 8) & 0x0300f00fu;
+            v = (v | v << 4) & 0x030c30c3u;
+            v = (v | v << 2) & 0x09249249u;
+            return v;
+        }
+
+        int    bits_, mask_, nb_y_, nb_z_;
+        size_t size_;
+    };
+
+    /// @brief contiguous storage of an Array3D: a zeroed heap block by default, or memory owned
+    /// elsewhere (e.g. a file mapping, see procedural/mapped_file.hxx) whose owner is kept alive.
+    /// copies always go to the heap
+    template<typename T> class Array3DStorage {
+        public:
+        Array3DStorage(size_t size = 0) : heap_(size), ptr_(heap_.data()), size_(size) {}
+        Array3DStorage(T *ptr, size_t size, std::shared_ptr<void> owner) :
+            ptr_(ptr), size_(size), owner_(std::move(owner)) {}
+
+        Array3DStorage(const Array3DStorage &o) :
+            heap_(o.begin(), o.end()), ptr_(heap_.data()), size_(o.size_) {}
+        Array3DStorage(Array3DStorage &&o) noexcept :
+            heap_(std::move(o.heap_)), ptr_(o.ptr_), size_(o.size_), owner_(std::move(o.owner_)) {
+            o.ptr_  = nullptr;
+            o.size_ = 0;
+        }
+        Array3DStorage &operator=(Array3DStorage o) noexcept {
+            std::swap(heap_, o.heap_);
+            std::swap(ptr_, o.ptr_);
+            std::swap(size_, o.size_);
+            std::swap(owner_, o.owner_);
+            return *this;
+        }
+
+        T       *data() { return ptr_; }
+        const T *data() const { return ptr_; }
+        size_t   size() const { return size_; }
+        bool     empty() const { return size_ == 0; }
+        /// @brief not on the heap
+        bool     is_external() const { return owner_ != nullptr; }
+
+        T       &operator[](size_t i) { return ptr_[i]; }
+        const T &operator[](size_t i) const { return ptr_[i]; }
+
+        T       *begin() { return ptr_; }
+        T       *end() { return ptr_ + size_; }
+        const T *begin() const { return ptr_; }
+        const T *end() const { return ptr_ + size_; }
+
+        protected:
+        vector<T>             heap_;
+        T                    *ptr_;
+        size_t                size_;
+        std::shared_ptr<void> owner_;
+    };
+
+    // expression templates: arithmetic on Array3Ds and scalars, and terrain::map, build an
+    // expression that is evaluated in a single pass once assigned to an Array3D. no temporary
+    // volume, no std::function. arrays in one expression share shape and layout. nodes provide
+    // shape(), eval_at(offset, x, y, z) and layout_type (void for scalars)
+
+    template<typename E> struct ArrayExpr {
+        const E &self() const { return static_cast<const E &>(*this); }
+    };
+
+    template<typename T, typename Layout = LinearLayout>
+    class Array3D : public ArrayExpr<Array3D<T, Layout>> {
         public:
-        Array3D<T>(int dimX = 0, int dimY = 0, int dimZ = 0);
+        typedef T      value_type;
+        typedef Layout layout_type;
+
+        Array3D(int dimX = 0, int dimY = 0, int dimZ = 0);
+        /// @brief on given storage, at least Layout(dimX, dimY, dimZ).size() elements
+        Array3D(int dimX, int dimY, int dimZ, Array3DStorage<T> storage);
+        /// @brief copy from another layout
+        template<typename L> explicit Array3D(const Array3D<T, L> &);
+        /// @brief evaluate an expression
+        template<typename E> Array3D(const ArrayExpr<E> &);
+
+        /// @brief assign from row-major data
         void operator=(vector<T>);
-        void operator+=(const Array3D<T> &);
-        void operator*=(const Array3D<T> &);
-        void operator*=(const T &);
+        template<typename E> void operator=(const ArrayExpr<E> &);
+        template<typename E> void operator+=(const ArrayExpr<E> &);
+        template<typename E> void operator-=(const ArrayExpr<E> &);
+        template<typename E> void operator*=(const ArrayExpr<E> &);
+        void                      operator*=(const T &);
+        /// @brief this = e over the depth layers [x0, x1) only, e.g. one slab per thread. e may
+        /// read this
+        template<typename E> void assign(const ArrayExpr<E> &, int x0, int x1);
+
+        /// @brief expression leaf
+        T eval_at(size_t offs, int, int, int) const { return data_[offs]; }
 
         const T &operator[](array<int, 3> offs) const;
         T       &operator[](array<int, 3> offs);
 
+        /// @brief unchecked access, no wrapping of negative indices
+        const T &at(int x, int y, int z) const { return data_[layout_(x, y, z)]; }
+        T       &at(int x, int y, int z) { return data_[layout_(x, y, z)]; }
+
         void vectorize_inplace(std::function<T(T)>);
         void vectorize_inplace(std::function<T(T, int, int, int)>);
 
         array<int, 3> shape() const;
 
-        void *data();
+        /// @brief storage in layout order; row-major only with LinearLayout
+        void       *data();
+        const void *data() const { return data_.data(); }
+        /// @brief row-major copy, e.g. for texture upload
+        vector<T> to_linear() const;
+        /// @brief f(x_begin, x_end, const T *slab) over slabs of up to depth along X, each slab
+        /// row-major (LinearLayout only). e.g. streaming upload with glTexSubImage3D without
+        /// touching the whole volume at once
+        template<typename F> void visit_slabs(int depth, F f) const;
 
         void repr();
 
         protected:
-        vector<T> data_;
+        Array3DStorage<T> data_;
 
         int dimX_;
         int dimY_;
         int dimZ_;
+
+        Layout layout_;
+
+        // dst = f(dst, e) over the voxels of depth layers [x0, x1), row by row
+        template<typename E, typename F> void eval_(const E &e, F f, int x0, int x1);
     };
+
+    namespace detail {
+        template<typename E> struct is_array3d : std::false_type {};
+        template<typename T, typename L> struct is_array3d<Array3D<T, L>> : std::true_type {};
+
+        // arrays are held by reference, expression nodes by value
+        template<typename E>
+        using expr_store_t = std::conditional_t<is_array3d<E>::value, const E &, const E>;
+
+        template<typename A, typename B> struct common_layout {
+            static_assert(
+                std::is_void_v<A> || std::is_void_v<B> || std::is_same_v<A, B>,
+                "Array3D expression mixes layouts"
+            );
+            typedef std::conditional_t<std::is_void_v<A>, B, A> type;
+        };
+    } // namespace detail
+
+    /// @brief scalar broadcast to every voxel
+    template<typename T> class ArrayScalarExpr : public ArrayExpr<ArrayScalarExpr<T>> {
+        public:
+        typedef T    value_type;
+        typedef void layout_type;
+
+        ArrayScalarExpr(T v) : v_(v) {}
+        T             eval_at(size_t, int, int, int) const { return v_; }
+        array<int, 3> shape() const { return {-1, -1, -1}; }
+
+        protected:
+        T v_;
+    };
+
+    template<typename A, typename B, typename Op>
+    class ArrayBinaryExpr : public ArrayExpr<ArrayBinaryExpr<A, B, Op>> {
+        public:
+        typedef typename detail::common_layout<
+            typename A::layout_type, typename B::layout_type>::type layout_type;
+        typedef decltype(Op{}(
+            std::declval<typename A::value_type>(), std::declval<typename B::value_type>()
+        )) value_type;
+
+        ArrayBinaryExpr(const A &a, const B &b) : a_(a), b_(b) {
+            assert(
+                (a.shape()[0] < 0 || b.shape()[0] < 0 || a.shape() == b.shape()) &&
+                "Array3D expression: shape mismatch"
+            );
+        }
+        value_type eval_at(size_t offs, int x, int y, int z) const {
+            return Op{}(a_.eval_at(offs, x, y, z), b_.eval_at(offs, x, y, z));
+        }
+        array<int, 3> shape() const { return a_.shape()[0] < 0 ? b_.shape() : a_.shape(); }
+
+        protected:
+        detail::expr_store_t<A> a_;
+        detail::expr_store_t<B> b_;
+    };
+
+    /// @brief f(v) or f(v, x, y, z) of every voxel
+    template<typename A, typename F> class ArrayMapExpr : public ArrayExpr<ArrayMapExpr<A, F>> {
+        public:
+        typedef typename A::layout_type layout_type;
+        typedef typename A::value_type  value_type;
+
+        ArrayMapExpr(const A &a, F f) : a_(a), f_(f) {}
+        value_type eval_at(size_t offs, int x, int y, int z) const {
+            if constexpr (std::is_invocable_v<F, value_type, int, int, int>) {
+                return f_(a_.eval_at(offs, x, y, z), x, y, z);
+            } else {
+                return f_(a_.eval_at(offs, x, y, z));
+            }
+        }
+        array<int, 3> shape() const { return a_.shape(); }
+
+        protected:
+        detail::expr_store_t<A> a_;
+        F                       f_;
+    };
+
+    template<typename E, typename F> ArrayMapExpr<E, F> map(const ArrayExpr<E> &e, F f) {
+        return ArrayMapExpr<E, F>(e.self(), f);
+    }
+
+#define TERRAIN_ARRAY_EXPR_OP(op, functor)                                                         \
+    template<typename A, typename B>                                                               \
+    ArrayBinaryExpr<A, B, functor> operator op(const ArrayExpr<A> &a, const ArrayExpr<B> &b) {     \
+        return {a.self(), b.self()};                                                               \
+    }                                                                                              \
+    template<typename A, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>         \
+    ArrayBinaryExpr<A, ArrayScalarExpr<typename A::value_type>, functor> operator op(              \
+        const ArrayExpr<A> &a, S s                                                                 \
+    ) {                                                                                            \
+        return {a.self(), ArrayScalarExpr<typename A::value_type>(s)};                             \
+    }                                                                                              \
+    template<typename A, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>         \
+    ArrayBinaryExpr<ArrayScalarExpr<typename A::value_type>, A, functor> operator op(              \
+        S s, const ArrayExpr<A> &a                                                                 \
+    ) {                                                                                            \
+        return {ArrayScalarExpr<typename A::value_type>(s), a.self()};                             \
+    }
+
+    TERRAIN_ARRAY_EXPR_OP(+, std::plus<>)
+    TERRAIN_ARRAY_EXPR_OP(-, std::minus<>)
+    TERRAIN_ARRAY_EXPR_OP(*, std::multiplies<>)
+    TERRAIN_ARRAY_EXPR_OP(/, std::divides<>)
+#undef TERRAIN_ARRAY_EXPR_OP
+
+    // quantized storage, e.g. for R8/R16/R16F textures: a quarter or half of the float volume
+
+    /// @brief IEEE 754 binary16, as GL_HALF_FLOAT. conversion rounds to nearest even
+    struct half {
+        uint16_t bits = 0;
+
+        half() = default;
+        explicit half(float);
+        explicit operator float() const;
+    };
+
+    /// @brief real = stored * scale + bias, stored normalized to [0, 1] for integer types as GL
+    /// samples R8/R16. affine, so it commutes with linear filtering and can be applied after the
+    /// texture fetch
+    struct QuantizeParams {
+        float scale = 1;
+        float bias  = 0;
+    };
+
+    /// @brief params mapping the value range of a onto Q. half keeps values as they are
+    template<typename Q, typename T, typename Layout>
+    QuantizeParams quantize_params(const Array3D<T, Layout> &a);
+    /// @brief convert n values, rounding to nearest. e.g. slab by slab for streaming
+    template<typename Q, typename T>
+    void quantize(const T *src, Q *dst, size_t n, const QuantizeParams &params);
+    /// @brief whole volume, params filled
+    template<typename Q, typename T, typename Layout>
+    Array3D<Q, Layout> quantize(const Array3D<T, Layout> &a, QuantizeParams &params);
+    template<typename T, typename Q, typename Layout>
+    Array3D<T, Layout> dequantize(const Array3D<Q, Layout> &a, const QuantizeParams &params);
 } // namespace terrain
 
 namespace mf {
@@ -88,38 +384,153 @@ template<typename T> std::string repr(const T &var) {
 
 // implementations
 
-template<typename T>
-terrain::Array3D<T>::Array3D(int dimX, int dimY, int dimZ) :
-    data_(vector<T>(dimX * dimY * dimZ)), dimX_(dimX), dimY_(dimY), dimZ_(dimZ) {
+inline terrain::LinearLayout::LinearLayout(int dimX, int dimY, int dimZ) :
+    dimY_(dimY), dimZ_(dimZ), size_((size_t)dimX * dimY * dimZ) {}
+
+inline terrain::BrickedLayout::BrickedLayout(int dimX, int dimY, int dimZ) :
+    nb_y_((dimY + 3) / 4), nb_z_((dimZ + 3) / 4),
+    size_((size_t)((dimX + 3) / 4) * nb_y_ * nb_z_ * 64) {}
+
+inline terrain::MortonLayout::MortonLayout(int dimX, int dimY, int dimZ) {
+    // log2 of each dimension rounded up to a power of 2
+    auto log2_ceil = [](int v) {
+        int b = 0;
+        while ((1 << b) < v) {
+            b++;
+        }
+        return b;
+    };
+    int bx = log2_ceil(dimX), by = log2_ceil(dimY), bz = log2_ceil(dimZ);
+
+    bits_ = std::min({bx, by, bz, 10});
+    mask_ = (1 << bits_) - 1;
+    nb_y_ = 1 << (by - bits_);
+    nb_z_ = 1 << (bz - bits_);
+    size_ = (dimX && dimY && dimZ) ? (size_t)1 << (bx + by + bz) : 0;
+}
+
+template<typename T, typename Layout>
+terrain::Array3D<T, Layout>::Array3D(int dimX, int dimY, int dimZ) :
+    data_(Layout(dimX, dimY, dimZ).size()), dimX_(dimX), dimY_(dimY), dimZ_(dimZ),
+    layout_(dimX, dimY, dimZ) {
     static_assert(!std::is_same_v<T, bool>, "");
 }
 
-template<typename T> void terrain::Array3D<T>::operator=(vector<T> vec) {
-    assert(vec.size() == dimX_ * dimY_ * dimZ_ && "Array3D<T>::operator=: invalid size");
-    data_ = vec;
+template<typename T, typename Layout>
+terrain::Array3D<T, Layout>::Array3D(int dimX, int dimY, int dimZ, Array3DStorage<T> storage) :
+    data_(std::move(storage)), dimX_(dimX), dimY_(dimY), dimZ_(dimZ), layout_(dimX, dimY, dimZ) {
+    static_assert(!std::is_same_v<T, bool>, "");
+    assert(data_.size() >= layout_.size() && "Array3D: storage too small");
 }
-template<typename T> void terrain::Array3D<T>::operator+=(const Array3D<T> &o) {
-    assert(dimX_ == o.dimX_ && dimY_ == o.dimY_ && dimZ_ == o.dimZ_);
-    for (int i = 0; i < data_.size(); i++) {
-        data_[i] += o.data_[i];
+
+template<typename T, typename Layout>
+template<typename L>
+terrain::Array3D<T, Layout>::Array3D(const Array3D<T, L> &o) :
+    Array3D(o.shape()[0], o.shape()[1], o.shape()[2]) {
+    for (int i = 0; i < dimX_; i++) {
+        for (int j = 0; j < dimY_; j++) {
+            for (int k = 0; k < dimZ_; k++) {
+                at(i, j, k) = o.at(i, j, k);
+            }
+        }
     }
 }
-template<typename T> void terrain::Array3D<T>::operator*=(const Array3D<T> &o) {
-    assert(dimX_ == o.dimX_ && dimY_ == o.dimY_ && dimZ_ == o.dimZ_);
-    for (int i = 0; i < data_.size(); i++) {
-        data_[i] *= o.data_[i];
+
+template<typename T, typename Layout> void terrain::Array3D<T, Layout>::operator=(vector<T> vec) {
+    if (vec.size() != (size_t)dimX_ * dimY_ * dimZ_) {
+        spdlog::error(
+            "Array3D<T>::operator=: {} values for ({},{},{})", vec.size(), dimX_, dimY_, dimZ_
+        );
+        exit(-1);
+    }
+    if constexpr (Layout::is_linear) {
+        std::copy(vec.begin(), vec.end(), data_.begin());
+    } else {
+        for (int i = 0; i < dimX_; i++) {
+            for (int j = 0; j < dimY_; j++) {
+                for (int k = 0; k < dimZ_; k++) {
+                    at(i, j, k) = vec[((size_t)i * dimY_ + j) * dimZ_ + k];
+                }
+            }
+        }
+    }
+}
+template<typename T, typename Layout>
+template<typename E>
+terrain::Array3D<T, Layout>::Array3D(const ArrayExpr<E> &e) :
+    Array3D(e.self().shape()[0], e.self().shape()[1], e.self().shape()[2]) {
+    eval_(e.self(), [](T, T v) { return v; }, 0, dimX_);
+}
+
+template<typename T, typename Layout>
+template<typename E>
+void terrain::Array3D<T, Layout>::operator=(const ArrayExpr<E> &e) {
+    if (e.self().shape() != shape()) {
+        // not aliased: the operands of e all have e's shape
+        *this = Array3D<T, Layout>(e.self().shape()[0], e.self().shape()[1], e.self().shape()[2]);
     }
+    eval_(e.self(), [](T, T v) { return v; }, 0, dimX_);
+}
+template<typename T, typename Layout>
+template<typename E>
+void terrain::Array3D<T, Layout>::operator+=(const ArrayExpr<E> &e) {
+    eval_(e.self(), [](T a, T b) { return a + b; }, 0, dimX_);
+}
+template<typename T, typename Layout>
+template<typename E>
+void terrain::Array3D<T, Layout>::operator-=(const ArrayExpr<E> &e) {
+    eval_(e.self(), [](T a, T b) { return a - b; }, 0, dimX_);
+}
+template<typename T, typename Layout>
+template<typename E>
+void terrain::Array3D<T, Layout>::operator*=(const ArrayExpr<E> &e) {
+    eval_(e.self(), [](T a, T b) { return a * b; }, 0, dimX_);
+}
+template<typename T, typename Layout>
+template<typename E>
+void terrain::Array3D<T, Layout>::assign(const ArrayExpr<E> &e, int x0, int x1) {
+    assert(0 <= x0 && x0 <= x1 && x1 <= dimX_);
+    eval_(e.self(), [](T, T v) { return v; }, x0, x1);
 }
-template<typename T> void terrain::Array3D<T>::operator*=(const T &t) {
+
+template<typename T, typename Layout>
+template<typename E, typename F>
+void terrain::Array3D<T, Layout>::eval_(const E &e, F f, int x0, int x1) {
+    typedef typename detail::common_layout<Layout, typename E::layout_type>::type layout_check;
+    static_assert(std::is_same_v<layout_check, Layout>, "");
+    assert(shape() == e.shape() && "Array3D expression: shape mismatch");
+
+    // element-wise, so evaluating in place is safe when this appears in e
+    for (int i = x0; i < x1; i++) {
+        for (int j = 0; j < dimY_; j++) {
+            if constexpr (Layout::is_linear) {
+                // a row is contiguous: one offset per row, the inner loop can vectorize
+                size_t row = layout_(i, j, 0);
+                T     *dst = data_.data() + row;
+                for (int k = 0; k < dimZ_; k++) {
+                    dst[k] = f(dst[k], (T)e.eval_at(row + k, i, j, k));
+                }
+            } else {
+                for (int k = 0; k < dimZ_; k++) {
+                    size_t offs = layout_(i, j, k);
+                    data_[offs] = f(data_[offs], (T)e.eval_at(offs, i, j, k));
+                }
+            }
+        }
+    }
+}
+template<typename T, typename Layout> void terrain::Array3D<T, Layout>::operator*=(const T &t) {
     for (int i = 0; i < data_.size(); i++) {
         data_[i] *= t;
     }
 }
 
-template<typename T> const T &terrain::Array3D<T>::operator[](array<int, 3> offs) const {
-    return const_cast<Array3D<T> *>(this)->operator[](offs);
+template<typename T, typename Layout>
+const T &terrain::Array3D<T, Layout>::operator[](array<int, 3> offs) const {
+    return const_cast<Array3D<T, Layout> *>(this)->operator[](offs);
 }
-template<typename T> T &terrain::Array3D<T>::operator[](array<int, 3> offs) {
+template<typename T, typename Layout>
+T &terrain::Array3D<T, Layout>::operator[](array<int, 3> offs) {
     if (offs[0] < 0) offs[0] += dimX_;
     if (offs[1] < 0) offs[1] += dimY_;
     if (offs[2] < 0) offs[2] += dimZ_;
@@ -128,38 +539,69 @@ template<typename T> T &terrain::Array3D<T>::operator[](array<int, 3> offs) {
     assert(0 <= offs[1] && offs[1] < dimY_ && "dimY out of range");
     assert(0 <= offs[2] && offs[2] < dimZ_ && "dimZ out of range");
 
-    return data_[dimZ_ * dimY_ * offs[0] + dimZ_ * offs[1] + offs[2]];
+    return data_[layout_(offs[0], offs[1], offs[2])];
 }
 
-template<typename T> void terrain::Array3D<T>::vectorize_inplace(std::function<T(T)> f) {
+template<typename T, typename Layout>
+void terrain::Array3D<T, Layout>::vectorize_inplace(std::function<T(T)> f) {
+    // padding of non-linear layouts included, it is never read back
     for (auto &i : data_) {
         i = f(i);
     }
 }
-template<typename T>
-void terrain::Array3D<T>::vectorize_inplace(std::function<T(T, int, int, int)> f) {
+template<typename T, typename Layout>
+void terrain::Array3D<T, Layout>::vectorize_inplace(std::function<T(T, int, int, int)> f) {
     for (int i = 0; i < dimX_; i++) {
         for (int j = 0; j < dimY_; j++) {
             for (int k = 0; k < dimZ_; k++) {
-                T val = data_[dimZ_ * dimY_ * i + dimZ_ * j + k];
+                T &val = at(i, j, k);
 
-                data_[dimZ_ * dimY_ * i + dimZ_ * j + k] = f(val, i, j, k);
+                val = f(val, i, j, k);
             }
         }
     }
 }
 
-template<typename T> std::array<int, 3> terrain::Array3D<T>::shape() const {
+template<typename T, typename Layout>
+std::array<int, 3> terrain::Array3D<T, Layout>::shape() const {
     return {dimX_, dimY_, dimZ_};
 }
 
-template<typename T> void *terrain::Array3D<T>::data() {
+template<typename T, typename Layout> void *terrain::Array3D<T, Layout>::data() {
     return reinterpret_cast<void *>(data_.data());
 }
 
-template<typename T> void terrain::Array3D<T>::repr() {
+template<typename T, typename Layout>
+std::vector<T> terrain::Array3D<T, Layout>::to_linear() const {
+    if constexpr (Layout::is_linear) {
+        return vector<T>(data_.begin(), data_.begin() + layout_.size());
+    } else {
+        vector<T> ret((size_t)dimX_ * dimY_ * dimZ_);
+        for (int i = 0; i < dimX_; i++) {
+            for (int j = 0; j < dimY_; j++) {
+                for (int k = 0; k < dimZ_; k++) {
+                    ret[((size_t)i * dimY_ + j) * dimZ_ + k] = at(i, j, k);
+                }
+            }
+        }
+        return ret;
+    }
+}
+
+template<typename T, typename Layout>
+template<typename F>
+void terrain::Array3D<T, Layout>::visit_slabs(int depth, F f) const {
+    static_assert(Layout::is_linear, "Array3D::visit_slabs: slabs are only contiguous when linear");
+    depth = std::max(depth, 1);
+    for (int x0 = 0; x0 < dimX_; x0 += depth) {
+        int x1 = std::min(x0 + depth, dimX_);
+        f(x0, x1, data_.data() + layout_(x0, 0, 0));
+    }
+}
+
+template<typename T, typename Layout> void terrain::Array3D<T, Layout>::repr() {
     spdlog::info("Array3D<> ({},{},{})", (int)dimX_, (int)dimY_, (int)dimZ_);
-    assert(data_.size() == dimX_ * dimY_ * dimZ_ && "data_ size wrong");
+    assert(data_.size() >= layout_.size() && "data_ size wrong");
 
     std::string s;
     s = "[";
@@ -179,4 +621,136 @@ template<typename T> void terrain::Array3D<T>::repr() {
     }
     s += "]";
     spdlog::info(s);
+}
+
+inline terrain::half::half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t  exp  = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) {
+        // inf, nan keeps a mantissa bit
+        bits = (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+    } else if (exp >= 31) {
+        bits = (uint16_t)(sign | 0x7c00);
+    } else if (exp <= 0) {
+        // subnormal or zero
+        if (exp < -10) {
+            bits = (uint16_t)sign;
+            return;
+        }
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t h     = mant >> shift;
+        uint32_t rest  = mant & ((1u << shift) - 1);
+        uint32_t halfw = 1u << (shift - 1);
+        if (rest > halfw || (rest == halfw && (h & 1))) h++;
+        bits = (uint16_t)(sign | h);
+    } else {
+        uint32_t h    = ((uint32_t)exp << 10) | (mant >> 13);
+        uint32_t rest = mant & 0x1fff;
+        // a carry into the exponent is still correct, up to inf
+        if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+        bits = (uint16_t)(sign | h);
+    }
+}
+
+inline terrain::half::operator float() const {
+    uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+    uint32_t exp  = (bits >> 10) & 0x1f;
+    uint32_t mant = bits & 0x3ff;
+    uint32_t x;
+    if (exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+        x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        x = sign;
+    } else {
+        // subnormal: normalize
+        int e = -1;
+        do {
+            e++;
+            mant <<= 1;
+        } while (!(mant & 0x400));
+        x = sign | ((uint32_t)(127 - 15 - e) << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+template<typename Q, typename T, typename Layout>
+terrain::QuantizeParams terrain::quantize_params(const Array3D<T, Layout> &a) {
+    if constexpr (std::is_same_v<Q, half> || std::is_floating_point_v<Q>) {
+        return {};
+    } else {
+        static_assert(std::is_integral_v<Q> && std::is_unsigned_v<Q>, "unsupported storage type");
+        auto shape = a.shape();
+        T    lo    = std::numeric_limits<T>::max();
+        T    hi    = std::numeric_limits<T>::lowest();
+        for (int x = 0; x < shape[0]; x++) {
+            for (int y = 0; y < shape[1]; y++) {
+                for (int z = 0; z < shape[2]; z++) {
+                    lo = std::min(lo, a.at(x, y, z));
+                    hi = std::max(hi, a.at(x, y, z));
+                }
+            }
+        }
+        if (!(lo <= hi)) return {};
+        // a constant volume stores zeros
+        return {hi > lo ? (float)(hi - lo) : 1.f, (float)lo};
+    }
+}
+
+template<typename Q, typename T>
+void terrain::quantize(const T *src, Q *dst, size_t n, const QuantizeParams &params) {
+    if constexpr (std::is_same_v<Q, half>) {
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = half(((float)src[i] - params.bias) / params.scale);
+        }
+    } else if constexpr (std::is_floating_point_v<Q>) {
+        for (size_t i = 0; i < n; i++) {
+            dst[i] = (Q)(((float)src[i] - params.bias) / params.scale);
+        }
+    } else {
+        const float q_max = (float)std::numeric_limits<Q>::max();
+        for (size_t i = 0; i < n; i++) {
+            float v = ((float)src[i] - params.bias) / params.scale;
+            dst[i]  = (Q)std::lround(std::min(std::max(v, 0.f), 1.f) * q_max);
+        }
+    }
+}
+
+template<typename Q, typename T, typename Layout>
+terrain::Array3D<Q, Layout>
+terrain::quantize(const Array3D<T, Layout> &a, QuantizeParams &params) {
+    params       = quantize_params<Q>(a);
+    auto   shape = a.shape();
+    auto   ret   = Array3D<Q, Layout>(shape[0], shape[1], shape[2]);
+    size_t n     = Layout(shape[0], shape[1], shape[2]).size();
+    quantize((const T *)a.data(), (Q *)ret.data(), n, params);
+    return ret;
+}
+
+template<typename T, typename Q, typename Layout>
+terrain::Array3D<T, Layout>
+terrain::dequantize(const Array3D<Q, Layout> &a, const QuantizeParams &params) {
+    auto   shape = a.shape();
+    auto   ret   = Array3D<T, Layout>(shape[0], shape[1], shape[2]);
+    size_t n     = Layout(shape[0], shape[1], shape[2]).size();
+    auto   src   = (const Q *)a.data();
+    auto   dst   = (T *)ret.data();
+    for (size_t i = 0; i < n; i++) {
+        float v;
+        if constexpr (std::is_same_v<Q, half> || std::is_floating_point_v<Q>) {
+            v = (float)src[i];
+        } else {
+            v = (float)src[i] / (float)std::numeric_limits<Q>::max();
+        }
+        dst[i] = (T)(v * params.scale + params.bias);
+    }
+    return ret;
 }
\ No newline at end of file